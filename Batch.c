@@ -0,0 +1,620 @@
+/*  This file is part of the Elliott 803 emulator.
+
+    Copyright © 2020  Peter Onion
+
+    See LICENCE file. 
+*/
+
+/* Headless batch runner.  Loads a core image and a tape, works the
+   word generator from a script, or plays back a journal, and writes
+   out whatever was punched and the final core store.  Only the
+   emulation core and a file based PTS are linked in so it starts in a
+   few milliseconds. */
+
+#define G_LOG_USE_STRUCTURED
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <glib.h>
+
+#include "E803-types.h"
+#include "Emulate.h"
+#include "Cpu.h"
+#include "FilePTS.h"
+#include "Breakpoints.h"
+#include "Snapshot.h"
+#include "Rewind.h"
+#include "Journal.h"
+#include "Wiring.h"
+#include "wg-definitions.h"
+
+// Word times between checks for buttons and stop conditions.
+#define BATCH_QUANTUM 1000
+
+static gchar *coreFileName = NULL;
+static gchar *tapeFileName = NULL;
+static gchar *scriptFileName = NULL;
+static gchar *punchFileName = NULL;
+static gchar *saveCoreFileName = NULL;
+static gint64 wordTimesLimit = 100000000;
+static gint startAddress = 0;
+static gboolean threadedEngine = FALSE;
+static gchar *profileFileName = NULL;
+static gchar *traceFileName = NULL;
+static gint traceLength = 0;
+static gint rewindMegabytes = 0;
+static gint rewindInterval = 0;
+static gchar *recordFileName = NULL;
+static gchar *replayFileName = NULL;
+
+// Command line options
+static GOptionEntry entries[] =
+{
+    { "core", 'c', 0, G_OPTION_ARG_FILENAME, &coreFileName, "Load the core store from file.", "FILE" },
+    { "tape", 'r', 0, G_OPTION_ARG_FILENAME, &tapeFileName, "Put a tape in the reader.", "FILE" },
+    { "script", 's', 0, G_OPTION_ARG_FILENAME, &scriptFileName, "Word generator script.", "FILE" },
+    { "punch", 'p', 0, G_OPTION_ARG_FILENAME, &punchFileName, "Save the punched tape to file.", "FILE" },
+    { "savecorefile", 'o', 0, G_OPTION_ARG_FILENAME, &saveCoreFileName, "Save the core store to file.", "FILE" },
+    { "wordtimes", 'n', 0, G_OPTION_ARG_INT64, &wordTimesLimit, "Word times to run for without a script.", "N" },
+    { "start", 'a', 0, G_OPTION_ARG_INT, &startAddress, "Address to jump to without a script.", "N" },
+    { "threaded", 't' , 0,  G_OPTION_ARG_NONE, &threadedEngine, "Use the threaded code execution engine.",NULL},
+    { "profile", 'P', 0, G_OPTION_ARG_FILENAME, &profileFileName, "Write an execution profile to file.", "FILE" },
+    { "trace", 'R', 0, G_OPTION_ARG_FILENAME, &traceFileName, "Write an instruction trace to file.", "FILE" },
+    { "tracelength", 'L', 0, G_OPTION_ARG_INT, &traceLength, "Number of instructions to keep in the trace.", "N" },
+    { "rewind", 'b', 0, G_OPTION_ARG_INT, &rewindMegabytes, "Keep N MB of checkpoints so scripts can go backwards.", "N" },
+    { "rewindinterval", 'B', 0, G_OPTION_ARG_INT, &rewindInterval, "Word times between checkpoints (default 10000).", "N" },
+    { "record", 'j', 0, G_OPTION_ARG_FILENAME, &recordFileName, "Record the buttons and tapes to a journal.", "FILE" },
+    { "replay", 'J', 0, G_OPTION_ARG_FILENAME, &replayFileName, "Play back a journal instead of a script.", "FILE" },
+    { NULL }
+};
+
+/* What is run without a script.  Reads a jump to the start address
+   from the word generator, obeys it and then runs. */
+#define DEFAULT_SCRIPT \
+    "power on\n" \
+    "wordgen 40 %d : 00 0\n" \
+    "read\n" \
+    "operate\n" \
+    "wait 10\n" \
+    "obey\n" \
+    "operate\n" \
+    "wait 10\n" \
+    "normal\n" \
+    "operate\n" \
+    "run %" G_GINT64_FORMAT "\n"
+
+static FilePTS Pts;
+static gint64 WordTimesRun = 0;
+static const char *StopReason = NULL;
+static E803Breakpoints *Breakpoints = NULL;
+
+// Why the machine isn't doing anything useful, or NULL if it is.
+static const char *stopCondition(void)
+{
+    static char reason[40];
+    E803Machine *cpu = WiredMachine;
+
+    if(cpu->S)
+    {
+	if((Breakpoints != NULL) && (Breakpoints->lastHit != NULL))
+	{
+	    snprintf(reason,sizeof(reason),"breakpoint %d",Breakpoints->lastHit->number);
+	    return reason;
+	}
+	return "stopped";
+    }
+    if(cpu->R && cpu->Looping)
+	return "dynamic stop";
+    if(FilePTSReaderEmpty(&Pts,cpu))
+	return "tape ran out";
+    return NULL;
+}
+
+/* Run for up to wordTimes word times in the same way as CPU_sound,
+   but without the lamps.  If untilStop is set it stops early when
+   stopCondition() says so. */
+static void runFor(gint64 wordTimes,gboolean untilStop)
+{
+    E803Machine *cpu = WiredMachine;
+    int count;
+
+    StopReason = NULL;
+    if(Breakpoints != NULL)
+    {
+	Breakpoints->lastHit = NULL;
+    }
+    while(wordTimes > 0)
+    {
+	count = (wordTimes > BATCH_QUANTUM) ? BATCH_QUANTUM : (int) wordTimes;
+
+	PreEmulate(cpu,false);
+	Emulate(cpu,count);
+	cpu->WG_operate_pressed = false;
+
+	WordTimesRun += count;
+	wordTimes -= count;
+
+	if(untilStop && ((StopReason = stopCondition()) != NULL))
+	{
+	    return;
+	}
+    }
+}
+
+/* Play back a journal recorded by the emulator or by --record.  The
+   batches end wherever the journal puts something on the wires, so
+   nothing else about the run matters. */
+static gboolean replayJournal(const gchar *fileName)
+{
+    E803Machine *cpu = WiredMachine;
+    E803Journal *journal;
+    GError *error = NULL;
+    gint64 started,start;
+    double elapsed;
+    int wordTimes,count;
+    gboolean same;
+
+    journal = JournalLoad(fileName,&error);
+    if((journal == NULL) || !JournalReplay(journal,cpu,&error))
+    {
+	g_warning("Failed to play back journal %s (%s)\n",fileName,error->message);
+	g_error_free(error);
+	if(journal != NULL) JournalFree(journal);
+	return FALSE;
+    }
+
+    start = cpu->CPU_word_time_count;
+    started = g_get_monotonic_time();
+    while((wordTimes = JournalInject(journal)) > 0)
+    {
+	count = (wordTimes > BATCH_QUANTUM) ? BATCH_QUANTUM : wordTimes;
+
+	PreEmulate(cpu,false);
+	Emulate(cpu,count);
+	cpu->WG_operate_pressed = false;
+
+	WordTimesRun += count;
+    }
+    elapsed = (double) (g_get_monotonic_time() - started) / 1.0E6;
+
+    same = JournalReplayed(journal);
+    g_print("played back %" G_GINT64_FORMAT " word times in %.3f seconds (%.1f times real time), %s\n",
+	    cpu->CPU_word_time_count - start,elapsed,
+	    (elapsed > 0.0) ? ((double) (cpu->CPU_word_time_count - start) * 288.0E-6) / elapsed : 0.0,
+	    same ? "the same as when recorded" : "NOT the same as when recorded");
+    JournalFree(journal);
+    return same;
+}
+
+typedef struct
+{
+    const char *name;
+    enum WiringEvent wire;
+} ButtonWire;
+
+static const ButtonWire buttonWires[] =
+{
+    { "reset", RESETWIRE },
+    { "clear", CSWIRE },
+    { "manual", MDWIRE },
+    { "selected", SSWIRE },
+    { "operate", OPERATEWIRE },
+    { NULL, 0 }
+};
+
+static const ButtonWire *findButton(const char *name)
+{
+    for(const ButtonWire *bw = buttonWires; bw->name != NULL; bw++)
+    {
+	if(strcmp(bw->name,name) == 0) return bw;
+    }
+    return NULL;
+}
+
+/* Set the word generator from "F1 N1 : F2 N2" or "F1 N1 / F2 N2", with
+   the function codes in octal as they are written on 803 tapes. */
+static gboolean setWordGenerator(const gchar **words,int count)
+{
+    unsigned int f1,n1,b,f2 = 0,n2 = 0;
+
+    if((count != 2) && (count != 5)) return FALSE;
+
+    f1 = (unsigned int) g_ascii_strtoull(words[0],NULL,8);
+    n1 = (unsigned int) g_ascii_strtoull(words[1],NULL,10);
+    b = 0;
+    if(count == 5)
+    {
+	if(strcmp(words[2],"/") == 0)
+	    b = 1;
+	else if(strcmp(words[2],":") != 0)
+	    return FALSE;
+	f2 = (unsigned int) g_ascii_strtoull(words[3],NULL,8);
+	n2 = (unsigned int) g_ascii_strtoull(words[4],NULL,10);
+    }
+
+    if((f1 > 077) || (f2 > 077) || (n1 > 8191) || (n2 > 8191)) return FALSE;
+
+    wiring(F1WIRES,f1);
+    wiring(N1WIRES,(n1 << 1) | b);
+    wiring(F2WIRES,f2);
+    wiring(N2WIRES,n2);
+    return TRUE;
+}
+
+// "break ..." and "watch ...", see BreakpointParse().
+static gboolean setBreakpoint(const gchar **words,int count)
+{
+    if(Breakpoints == NULL)
+    {
+	Breakpoints = BreakpointsNew();
+	WiredMachine->Breakpoints = Breakpoints;
+    }
+    return (BreakpointParse(Breakpoints,words,count) != NULL) ? TRUE : FALSE;
+}
+
+static void listBreakpoints(void)
+{
+    gchar *text;
+
+    if(Breakpoints == NULL) return;
+    for(GSList *list = Breakpoints->points; list != NULL; list = g_slist_next(list))
+    {
+	text = BreakpointDescribe((E803Breakpoint *) list->data);
+	g_print("%s\n",text);
+	g_free(text);
+    }
+}
+
+// The tape station is part of snapshots too.
+static void saveFilePTS(GByteArray *data)
+{
+    FilePTSSnapshotSave(&Pts,data);
+}
+
+static gboolean restoreFilePTS(const guint8 *data,gsize length)
+{
+    return FilePTSSnapshotRestore(&Pts,data,length);
+}
+
+static gboolean saveSnapshot(const gchar *fileName)
+{
+    GByteArray *snapshot;
+    GError *error = NULL;
+    gboolean ok;
+
+    snapshot = SnapshotTake();
+    ok = SnapshotWrite(snapshot,fileName,&error);
+    if(!ok)
+    {
+	g_warning("Failed to write snapshot %s (%s)\n",fileName,error->message);
+	g_error_free(error);
+    }
+    g_byte_array_unref(snapshot);
+    return ok;
+}
+
+static gboolean restoreSnapshot(const gchar *fileName)
+{
+    GBytes *snapshot;
+    GError *error = NULL;
+    gconstpointer data;
+    gsize length;
+    gboolean ok = FALSE;
+
+    snapshot = SnapshotRead(fileName,&error);
+    if(snapshot != NULL)
+    {
+	data = g_bytes_get_data(snapshot,&length);
+	ok = SnapshotRestore((const guint8 *) data,length,&error);
+	g_bytes_unref(snapshot);
+    }
+    if(!ok)
+    {
+	g_warning("Failed to restore snapshot %s (%s)\n",fileName,error->message);
+	g_error_free(error);
+    }
+    return ok;
+}
+
+// rstep, rstepi and rcontinue.
+static gboolean goBack(const gchar *command,int count)
+{
+    E803Machine *cpu = WiredMachine;
+    gboolean ok;
+
+    if(cpu->Rewind == NULL) return FALSE;
+
+    if(strcmp(command,"rstep") == 0)
+    {
+	if(count <= 0) return FALSE;
+	ok = RewindWordTimes(cpu->Rewind,cpu,count);
+    }
+    else if(strcmp(command,"rstepi") == 0)
+    {
+	if(count <= 0) return FALSE;
+	ok = RewindInstructions(cpu->Rewind,cpu,count);
+    }
+    else
+    {
+	ok = RewindToBreakpoint(cpu->Rewind,cpu);
+    }
+
+    g_print("%s to word time %" G_GINT64_FORMAT ", SCR = %d%s\n",ok ? "back" : "no more history, back",
+	    cpu->CPU_word_time_count,cpu->SCR >> 1,(cpu->SCR & 1) ? "+" : "");
+    return TRUE;
+}
+
+/* Obey one line of a script.  The commands are
+       power on|off
+       wordgen F1 N1 [:|/ F2 N2]
+       read | normal | obey
+       press|release reset|clear|manual|selected|operate
+       operate                  press and release the operate bar
+       tape FILE                change the tape in the reader
+       wait N                   run for N word times
+       run N                    run for up to N word times or until
+                                the machine stops, reaches a dynamic
+                                stop or runs out of tape
+       break ...  watch ...     set a breakpoint, see BreakpointParse()
+       delete N                 remove breakpoint N
+       breakpoints              list the breakpoints
+       snapshot FILE            save a snapshot of the machine and tape station
+       restore FILE             and restore one
+       rstep N                  go back N word times (needs --rewind)
+       rstepi N                 go back N instructions
+       rcontinue                go back to the last breakpoint or watchpoint
+   Returns FALSE if the line makes no sense. */
+static gboolean obeyLine(const gchar **words,int count)
+{
+    const ButtonWire *bw;
+    GError *error = NULL;
+    gint64 wordTimes;
+
+    if(count == 0) return TRUE;
+
+    if((strcmp(words[0],"power") == 0) && (count == 2))
+    {
+	if(strcmp(words[1],"on") == 0)
+	    wiring(SUPPLIES_ON,1);
+	else if(strcmp(words[1],"off") == 0)
+	    wiring(SUPPLIES_OFF,1);
+	else
+	    return FALSE;
+    }
+    else if(strcmp(words[0],"wordgen") == 0)
+    {
+	return setWordGenerator(&words[1],count-1);
+    }
+    else if((strcmp(words[0],"read") == 0) && (count == 1))
+    {
+	wiring(RONWIRES,WG_read);
+    }
+    else if((strcmp(words[0],"normal") == 0) && (count == 1))
+    {
+	wiring(RONWIRES,WG_normal);
+    }
+    else if((strcmp(words[0],"obey") == 0) && (count == 1))
+    {
+	wiring(RONWIRES,WG_obey);
+    }
+    else if(((strcmp(words[0],"press") == 0) || (strcmp(words[0],"release") == 0)) && (count == 2))
+    {
+	if((bw = findButton(words[1])) == NULL) return FALSE;
+	wiring(bw->wire,(words[0][0] == 'p') ? 1 : 0);
+    }
+    else if((strcmp(words[0],"operate") == 0) && (count == 1))
+    {
+	wiring(OPERATEWIRE,1);
+	wiring(OPERATEWIRE,0);
+    }
+    else if((strcmp(words[0],"break") == 0) || (strcmp(words[0],"watch") == 0))
+    {
+	return setBreakpoint(words,count);
+    }
+    else if((strcmp(words[0],"delete") == 0) && (count == 2))
+    {
+	if(Breakpoints == NULL) return FALSE;
+	return BreakpointDelete(Breakpoints,(int) g_ascii_strtoll(words[1],NULL,10));
+    }
+    else if((strcmp(words[0],"breakpoints") == 0) && (count == 1))
+    {
+	listBreakpoints();
+    }
+    else if((strcmp(words[0],"snapshot") == 0) && (count == 2))
+    {
+	return saveSnapshot(words[1]);
+    }
+    else if((strcmp(words[0],"restore") == 0) && (count == 2))
+    {
+	return restoreSnapshot(words[1]);
+    }
+    else if(((strcmp(words[0],"rstep") == 0) || (strcmp(words[0],"rstepi") == 0)) && (count == 2))
+    {
+	return goBack(words[0],(int) g_ascii_strtoll(words[1],NULL,10));
+    }
+    else if((strcmp(words[0],"rcontinue") == 0) && (count == 1))
+    {
+	return goBack(words[0],0);
+    }
+    else if((strcmp(words[0],"tape") == 0) && (count == 2))
+    {
+	if(!FilePTSLoadTape(&Pts,words[1],&error))
+	{
+	    g_warning("Failed to open tape file %s (%s)\n",words[1],error->message);
+	    g_error_free(error);
+	    return FALSE;
+	}
+    }
+    else if(((strcmp(words[0],"wait") == 0) || (strcmp(words[0],"run") == 0)) && (count == 2))
+    {
+	wordTimes = g_ascii_strtoll(words[1],NULL,10);
+	if(wordTimes <= 0) return FALSE;
+	runFor(wordTimes,(words[0][0] == 'r') ? TRUE : FALSE);
+	if(StopReason != NULL)
+	{
+	    g_print("%s at word time %" G_GINT64_FORMAT ", SCR = %d%s\n",StopReason,WordTimesRun,
+		    WiredMachine->SCR >> 1,(WiredMachine->SCR & 1) ? "+" : "");
+	}
+    }
+    else
+    {
+	return FALSE;
+    }
+    return TRUE;
+}
+
+static gboolean runScript(const gchar *name,const gchar *script)
+{
+    gchar **lines,**fields,*hash;
+    const gchar *words[8];
+    int count;
+    gboolean ok = TRUE;
+
+    lines = g_strsplit(script,"\n",-1);
+    for(int lineNumber = 0; ok && (lines[lineNumber] != NULL); lineNumber++)
+    {
+	if((hash = strchr(lines[lineNumber],'#')) != NULL) *hash = '\0';
+
+	fields = g_strsplit_set(lines[lineNumber]," \t\r",-1);
+	count = 0;
+	for(int n = 0; fields[n] != NULL; n++)
+	{
+	    if(fields[n][0] == '\0') continue;
+	    if(count < 8) words[count] = fields[n];
+	    count += 1;
+	}
+
+	if((count > 8) || !obeyLine(words,count))
+	{
+	    g_warning("%s:%d: can't obey \"%s\"\n",name,lineNumber+1,lines[lineNumber]);
+	    ok = FALSE;
+	}
+	g_strfreev(fields);
+    }
+    g_strfreev(lines);
+    return ok;
+}
+
+int main(int argc,char **argv)
+{
+    GOptionContext *context;
+    GError *error = NULL;
+    E803word *core = NULL;
+    gchar *script;
+    gboolean ok = TRUE;
+
+    context = g_option_context_new ("- Elliott 803 batch runner");
+    g_option_context_add_main_entries (context, entries, NULL);
+    if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_print ("option parsing failed: %s\n", error->message);
+      exit (1);
+    }
+
+    if(coreFileName != NULL)
+    {
+	core = LoadCoreImage(coreFileName,&error);
+	if(core == NULL)
+	{
+	    g_print("Failed to open core file %s (%s)\n",coreFileName,error->message);
+	    exit(1);
+	}
+    }
+
+    CpuThreadedEngine(threadedEngine);
+    CpuTraceFromStart(FALSE,(guint) MAX(traceLength,0));
+    CpuRewind((guint) MAX(rewindMegabytes,0),(guint) MAX(rewindInterval,0));
+    CpuStart(core);
+
+    if(profileFileName != NULL)
+    {
+	CpuProfile(TRUE);
+    }
+    if(traceFileName != NULL)
+    {
+	CpuTrace(TRUE);
+    }
+
+    FilePTSInit(&Pts);
+    FilePTSConnect(&Pts,WiredMachine);
+    SnapshotRegister("FPTS",saveFilePTS,restoreFilePTS);
+    if(tapeFileName != NULL)
+    {
+	if(!FilePTSLoadTape(&Pts,tapeFileName,&error))
+	{
+	    g_print("Failed to open tape file %s (%s)\n",tapeFileName,error->message);
+	    exit(1);
+	}
+    }
+
+    if(recordFileName != NULL)
+    {
+	CpuRecord(recordFileName);
+    }
+
+    if(replayFileName != NULL)
+    {
+	script = NULL;
+	ok = replayJournal(replayFileName);
+    }
+    else if(scriptFileName != NULL)
+    {
+	if(!g_file_get_contents(scriptFileName,&script,NULL,&error))
+	{
+	    g_print("Failed to read script %s (%s)\n",scriptFileName,error->message);
+	    exit(1);
+	}
+	ok = runScript(scriptFileName,script);
+    }
+    else
+    {
+	script = g_strdup_printf(DEFAULT_SCRIPT,startAddress & 8191,wordTimesLimit);
+	ok = runScript("default script",script);
+    }
+    g_free(script);
+
+    if(recordFileName != NULL)
+    {
+	if(!CpuRecordSave())
+	    ok = FALSE;
+    }
+
+    g_print("%s after %" G_GINT64_FORMAT " word times, SCR = %d%s, %u characters punched\n",
+	    (StopReason != NULL) ? StopReason : "finished",WordTimesRun,
+	    WiredMachine->SCR >> 1,(WiredMachine->SCR & 1) ? "+" : "",Pts.punched->len);
+
+    if(punchFileName != NULL)
+    {
+	if(!FilePTSSavePunched(&Pts,punchFileName,&error))
+	{
+	    g_warning("Failed to write punched tape %s (%s)\n",punchFileName,error->message);
+	    g_clear_error(&error);
+	    ok = FALSE;
+	}
+    }
+
+    if(profileFileName != NULL)
+    {
+	if(!CpuProfileDump(profileFileName))
+	    ok = FALSE;
+    }
+
+    if(traceFileName != NULL)
+    {
+	if(!CpuTraceDump(traceFileName))
+	    ok = FALSE;
+    }
+
+    if(saveCoreFileName != NULL)
+    {
+	if(!SaveCoreImage(saveCoreFileName,WiredMachine->CoreStore,&error))
+	{
+	    g_warning("Failed to write core file %s (%s)\n",saveCoreFileName,error->message);
+	    g_clear_error(&error);
+	    ok = FALSE;
+	}
+    }
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,95 @@
+/*  This file is part of the Elliott 803 emulator.
+
+    Copyright © 2020  Peter Onion
+
+    See LICENCE file. 
+*/
+
+/* Fetch phase microbenchmark.  Runs a loop of short instructions on a
+   machine connected to nothing and reports word times per host second.
+   It is built twice, as 803-bench with the pre-decoded store and as
+   803-bench-fetch with DECODE_CACHE 0, so the two fetch paths can be
+   compared on the same host. */
+
+#define G_LOG_USE_STRUCTURED
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <glib.h>
+
+#include "E803-types.h"
+#include "Emulate.h"
+
+#ifndef DECODE_CACHE
+#define DECODE_CACHE 1
+#endif
+
+#define BENCH_QUANTUM 100000
+
+static gint64 wordTimesLimit = 100000000;
+static gboolean threadedEngine = FALSE;
+
+static GOptionEntry entries[] =
+{
+    { "wordtimes", 'n', 0, G_OPTION_ARG_INT64, &wordTimesLimit, "Word times to run for.", "N" },
+    { "threaded", 't' , 0,  G_OPTION_ARG_NONE, &threadedEngine, "Use the threaded code execution engine.",NULL},
+    { NULL }
+};
+
+// One word of two instructions, function codes in octal.
+static E803word instructions(unsigned int f1,unsigned int n1,unsigned int f2,unsigned int n2)
+{
+    return ((E803word) f1 << 33) | ((E803word) n1 << 20) | ((E803word) f2 << 13) | n2;
+}
+
+int main(int argc,char **argv)
+{
+    GOptionContext *context;
+    GError *error = NULL;
+    E803Machine cpu;
+    E803word *core;
+    gint64 wordTimes = 0;
+    gint64 started;
+    double seconds;
+
+    context = g_option_context_new ("- Elliott 803 fetch phase benchmark");
+    g_option_context_add_main_entries (context, entries, NULL);
+    if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+	g_print ("option parsing failed: %s\n", error->message);
+	exit (1);
+    }
+
+    // Loads, adds and stores round a jump back to the start
+    core = (E803word *) calloc(8194,sizeof(E803word));
+    core[4] = instructions(030,100,004,101);
+    core[5] = instructions(024,102,020,103);
+    core[6] = instructions(032,101,005,100);
+    core[7] = instructions(040,4,000,0);
+    core[100] = 1;
+    core[101] = 2;
+
+    InitMachine(&cpu,core);
+    setThreadedEngine(&cpu,threadedEngine ? true : false);
+    cpu.CpuRunning = true;
+    cpu.S = false;
+    cpu.R = true;
+    cpu.SCR = 4 << 1;
+    cpu.IR = 4;
+
+    started = g_get_monotonic_time();
+    while(wordTimes < wordTimesLimit)
+    {
+	Emulate(&cpu,BENCH_QUANTUM);
+	wordTimes += BENCH_QUANTUM;
+    }
+    seconds = (double) (g_get_monotonic_time() - started) / 1e6;
+
+    g_print("%s%s: %" G_GINT64_FORMAT " word times in %.2fs, %.1fM word times/s\n",
+	    DECODE_CACHE ? "decode cache" : "fetch",threadedEngine ? ", threaded" : "",
+	    wordTimes,seconds,(double) wordTimes / seconds / 1e6);
+
+    FreeMachine(&cpu);
+    free(core);
+    return 0;
+}
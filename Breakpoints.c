@@ -0,0 +1,320 @@
+/*  This file is part of the Elliott 803 emulator.
+
+    Copyright © 2020  Peter Onion
+
+    See LICENCE file. 
+*/
+
+/* Breakpoints and watchpoints.  The quick test is in Breakpoints.h,
+   this keeps the bitmaps up to date and does the slow checks. */
+
+#define G_LOG_USE_STRUCTURED
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <glib.h>
+
+#include "Breakpoints.h"
+
+#define RD BREAK_READ
+#define WR BREAK_WRITE
+#define RW (BREAK_READ | BREAK_WRITE)
+
+/* Group 0 reads the store, groups 1 to 3 read and write it (except 20
+   and 26 which only write).  Multiply, divide and the floating point
+   arithmetic read it and 73 writes the SCR into it.  Everything else
+   uses N for something other than an address. */
+const uint8_t breakStoreUse[64] =
+{
+    RD,RD,RD,RD,RD,RD,RD,RD,
+    RW,RW,RW,RW,RW,RW,RW,RW,
+    WR,RW,RW,RW,RW,RW,WR,RW,
+    RD,RW,RW,RW,RW,RW,RW,RW,
+    0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, RD,RD,0, 0, RD,0,
+    RD,RD,RD,RD,RD,0, 0, 0,
+    0, 0, 0, WR,0, 0, 0, 0
+};
+
+#undef RD
+#undef WR
+#undef RW
+
+E803Breakpoints *BreakpointsNew(void)
+{
+    E803Breakpoints *breakpoints;
+
+    breakpoints = (E803Breakpoints *) calloc(1,sizeof(E803Breakpoints));
+    breakpoints->nextNumber = 1;
+    return breakpoints;
+}
+
+void BreakpointsFree(E803Breakpoints *breakpoints)
+{
+    g_slist_free_full(breakpoints->points,g_free);
+    free(breakpoints);
+}
+
+// Work out the bitmaps again after a change to the list.
+static void rebuildBitmaps(E803Breakpoints *breakpoints)
+{
+    E803Breakpoint *bp;
+
+    memset(breakpoints->execute,0,sizeof(breakpoints->execute));
+    memset(breakpoints->read,0,sizeof(breakpoints->read));
+    memset(breakpoints->write,0,sizeof(breakpoints->write));
+
+    for(GSList *list = breakpoints->points; list != NULL; list = g_slist_next(list))
+    {
+	bp = (E803Breakpoint *) list->data;
+	if(bp->kind & BREAK_EXECUTE)
+	    breakpoints->execute[bp->address >> 5] |= 1U << (bp->address & 31);
+	if(bp->kind & BREAK_READ)
+	    breakpoints->read[bp->address >> 5] |= 1U << (bp->address & 31);
+	if(bp->kind & BREAK_WRITE)
+	    breakpoints->write[bp->address >> 5] |= 1U << (bp->address & 31);
+    }
+}
+
+/* Add a breakpoint that stops every time.  The caller can then set a
+   condition and an ignore count in the breakpoint returned. */
+E803Breakpoint *BreakpointAdd(E803Breakpoints *breakpoints,unsigned int kind,int address,int half)
+{
+    E803Breakpoint *bp;
+
+    bp = g_new0(E803Breakpoint,1);
+    bp->number = breakpoints->nextNumber++;
+    bp->kind = kind;
+    bp->address = address & 8191;
+    bp->half = half;
+    bp->what = BREAK_ALWAYS;
+
+    breakpoints->points = g_slist_append(breakpoints->points,bp);
+    rebuildBitmaps(breakpoints);
+    return bp;
+}
+
+gboolean BreakpointDelete(E803Breakpoints *breakpoints,int number)
+{
+    E803Breakpoint *bp;
+
+    for(GSList *list = breakpoints->points; list != NULL; list = g_slist_next(list))
+    {
+	bp = (E803Breakpoint *) list->data;
+	if(bp->number == number)
+	{
+	    if(breakpoints->lastHit == bp) breakpoints->lastHit = NULL;
+	    breakpoints->points = g_slist_delete_link(breakpoints->points,list);
+	    g_free(bp);
+	    rebuildBitmaps(breakpoints);
+	    return TRUE;
+	}
+    }
+    return FALSE;
+}
+
+void BreakpointsClear(E803Breakpoints *breakpoints)
+{
+    g_slist_free_full(breakpoints->points,g_free);
+    breakpoints->points = NULL;
+    breakpoints->lastHit = NULL;
+    rebuildBitmaps(breakpoints);
+}
+
+// 39 bit words as signed integers
+static int64_t wordValue(E803word word)
+{
+    word &= 0x7FFFFFFFFFULL;
+    return (word & 0x4000000000ULL) ? (int64_t) word - (int64_t) 0x8000000000ULL : (int64_t) word;
+}
+
+static bool conditionTrue(const E803Breakpoint *bp,E803Machine *cpu)
+{
+    int64_t value,against;
+
+    switch(bp->what)
+    {
+    case BREAK_ON_ACC:
+	value = wordValue(cpu->ACC);
+	break;
+    case BREAK_ON_STORE:
+	value = wordValue(cpu->CoreStore[bp->address]);
+	break;
+    default:
+	return true;
+    }
+
+    against = wordValue(bp->value);
+    switch(bp->compare)
+    {
+    case BREAK_EQ: return value == against;
+    case BREAK_NE: return value != against;
+    case BREAK_LT: return value < against;
+    case BREAK_GT: return value > against;
+    }
+    return true;
+}
+
+// Whether an instruction fetched from scr as ir is one bp looks for.
+static bool matches(const E803Breakpoint *bp,E803Machine *cpu,int32_t scr,int32_t ir)
+{
+    unsigned int use = breakStoreUse[(ir >> 13) & 077];
+
+    if((bp->kind & BREAK_EXECUTE) && (bp->address == ((scr >> 1) & 8191)) &&
+       ((bp->half < 0) || (bp->half == (scr & 1))))
+	return conditionTrue(bp,cpu);
+    if((bp->kind & use & (BREAK_READ | BREAK_WRITE)) && (bp->address == (ir & 8191)))
+	return conditionTrue(bp,cpu);
+    return false;
+}
+
+/* The slow check, only called when one of the bitmaps has a bit set
+   for this instruction. */
+bool breakpointsCheck(E803Breakpoints *breakpoints,E803Machine *cpu,int32_t scr)
+{
+    E803Breakpoint *bp;
+    bool stop = false;
+
+    for(GSList *list = breakpoints->points; list != NULL; list = g_slist_next(list))
+    {
+	bp = (E803Breakpoint *) list->data;
+
+	if(matches(bp,cpu,scr,cpu->IR))
+	{
+	    bp->hits += 1;
+	    if((bp->hits > bp->ignoreCount) && !stop)
+	    {
+		breakpoints->lastHit = bp;
+		breakpoints->lastHitAt = cpu->CPU_word_time_count;
+		stop = true;
+	    }
+	}
+    }
+    return stop;
+}
+
+/* Whether any breakpoint looks for an instruction, without counting
+   hits.  Used when going backwards, where ir is the instruction as it
+   was fetched and ignore counts don't apply. */
+bool breakpointsMatch(E803Breakpoints *breakpoints,E803Machine *cpu,int32_t scr,int32_t ir)
+{
+    for(GSList *list = breakpoints->points; list != NULL; list = g_slist_next(list))
+    {
+	if(matches((E803Breakpoint *) list->data,cpu,scr,ir)) return true;
+    }
+    return false;
+}
+
+/* Add a breakpoint from the words of "break ADDR[+]" or
+   "watch read|write|access ADDR" followed by an optional
+   "if acc|store ==|!=|<|> VALUE" and "after N".  A break at ADDR stops
+   at either half of the word and at ADDR+ only at the second.  Returns
+   NULL if the words don't make sense.  Used by the batch runner's
+   scripts and the debugger. */
+E803Breakpoint *BreakpointParse(E803Breakpoints *breakpoints,const gchar **words,int count)
+{
+    static const char *compares[] = {"==","!=","<",">"};
+    E803Breakpoint *bp;
+    unsigned int kind,c;
+    int address,half = -1,n;
+    gchar *end;
+
+    if(strcmp(words[0],"break") == 0)
+    {
+	kind = BREAK_EXECUTE;
+	n = 1;
+    }
+    else
+    {
+	if(count < 2) return NULL;
+	if(strcmp(words[1],"read") == 0)
+	    kind = BREAK_READ;
+	else if(strcmp(words[1],"write") == 0)
+	    kind = BREAK_WRITE;
+	else if(strcmp(words[1],"access") == 0)
+	    kind = BREAK_READ | BREAK_WRITE;
+	else
+	    return NULL;
+	n = 2;
+    }
+
+    if(n >= count) return NULL;
+    address = (int) g_ascii_strtoll(words[n],&end,10);
+    if((kind == BREAK_EXECUTE) && (*end == '+'))
+    {
+	half = 1;
+	end += 1;
+    }
+    if((*end != '\0') || (address < 0) || (address > 8191)) return NULL;
+    n += 1;
+
+    bp = BreakpointAdd(breakpoints,kind,address,half);
+
+    while(n < count)
+    {
+	if((strcmp(words[n],"if") == 0) && ((n + 3) < count))
+	{
+	    if(strcmp(words[n+1],"acc") == 0)
+		bp->what = BREAK_ON_ACC;
+	    else if(strcmp(words[n+1],"store") == 0)
+		bp->what = BREAK_ON_STORE;
+	    else
+		break;
+	    for(c = 0; c < G_N_ELEMENTS(compares); c++)
+	    {
+		if(strcmp(words[n+2],compares[c]) == 0) break;
+	    }
+	    if(c == G_N_ELEMENTS(compares)) break;
+	    bp->compare = (enum BreakCompare) c;
+	    bp->value = (E803word) g_ascii_strtoll(words[n+3],NULL,10) & 0x7FFFFFFFFFULL;
+	    n += 4;
+	}
+	else if((strcmp(words[n],"after") == 0) && ((n + 1) < count))
+	{
+	    bp->ignoreCount = (unsigned int) g_ascii_strtoull(words[n+1],NULL,10);
+	    n += 2;
+	}
+	else
+	{
+	    break;
+	}
+    }
+
+    if(n != count)
+    {
+	BreakpointDelete(breakpoints,bp->number);
+	return NULL;
+    }
+    return bp;
+}
+
+// One line description of a breakpoint, to be freed with g_free.
+gchar *BreakpointDescribe(const E803Breakpoint *bp)
+{
+    static const char *whatNames[] = {"","acc","store"};
+    static const char *compareNames[] = {"==","!=","<",">"};
+    GString *text;
+
+    text = g_string_new(NULL);
+    g_string_append_printf(text,"%d %s%s%s %d",bp->number,
+			   (bp->kind & BREAK_EXECUTE) ? "break" : "watch",
+			   (bp->kind & BREAK_READ) ? " read" : "",
+			   (bp->kind & BREAK_WRITE) ? " write" : "",
+			   bp->address);
+    if((bp->kind & BREAK_EXECUTE) && (bp->half >= 0))
+    {
+	g_string_append(text,bp->half ? "+" : "-");
+    }
+    if(bp->what != BREAK_ALWAYS)
+    {
+	g_string_append_printf(text," if %s %s %" PRId64,whatNames[bp->what],
+			       compareNames[bp->compare],wordValue(bp->value));
+    }
+    if(bp->ignoreCount != 0)
+    {
+	g_string_append_printf(text," after %u",bp->ignoreCount);
+    }
+    g_string_append_printf(text," (hit %u times)",bp->hits);
+    return g_string_free(text,FALSE);
+}
@@ -0,0 +1,89 @@
+/*  This file is part of the Elliott 803 emulator.
+
+    Copyright © 2020  Peter Onion
+
+    See LICENCE file. 
+*/
+
+#pragma once
+/* Breakpoints and watchpoints.  Each kind has a bitmap with one bit
+   per word of store which is tested at every fetch, so the cost of
+   having them set is a few bit tests per instruction.  Only when a bit
+   is set are the breakpoints for that address looked at to check their
+   conditions and hit counts.  A breakpoint that fires sets S, so the
+   machine stops before the instruction is obeyed, just as it does for
+   the word generator's selected stop. */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <glib.h>
+#include "E803-types.h"
+#include "Emulate.h"
+
+// Kinds of breakpoint
+#define BREAK_EXECUTE 0x01   // Instruction fetched from the address
+#define BREAK_READ    0x02   // Instruction that reads the word at the address
+#define BREAK_WRITE   0x04   // Instruction that writes the word at the address
+
+// What a condition looks at
+enum BreakWhat {BREAK_ALWAYS,BREAK_ON_ACC,BREAK_ON_STORE};
+// How it compares it, as signed 39 bit numbers
+enum BreakCompare {BREAK_EQ,BREAK_NE,BREAK_LT,BREAK_GT};
+
+typedef struct _e803Breakpoint
+{
+    int number;
+    unsigned int kind;
+    int address;
+    int half;                  // For BREAK_EXECUTE, 0, 1 or -1 for either
+    enum BreakWhat what;       // The condition
+    enum BreakCompare compare;
+    E803word value;
+    unsigned int ignoreCount;  // Hits to let past before stopping
+    unsigned int hits;         // Times the condition has been true
+} E803Breakpoint;
+
+typedef struct _e803Breakpoints
+{
+    uint32_t execute[256];
+    uint32_t read[256];
+    uint32_t write[256];
+    GSList *points;
+    int nextNumber;
+    E803Breakpoint *lastHit;   // The breakpoint that last stopped the machine
+    int64_t lastHitAt;         // Word time of the fetch it stopped
+} E803Breakpoints;
+
+E803Breakpoints *BreakpointsNew(void);
+void BreakpointsFree(E803Breakpoints *breakpoints);
+E803Breakpoint *BreakpointAdd(E803Breakpoints *breakpoints,unsigned int kind,int address,int half);
+E803Breakpoint *BreakpointParse(E803Breakpoints *breakpoints,const gchar **words,int count);
+gboolean BreakpointDelete(E803Breakpoints *breakpoints,int number);
+void BreakpointsClear(E803Breakpoints *breakpoints);
+gchar *BreakpointDescribe(const E803Breakpoint *breakpoint);
+bool breakpointsCheck(E803Breakpoints *breakpoints,E803Machine *cpu,int32_t scr);
+bool breakpointsMatch(E803Breakpoints *breakpoints,E803Machine *cpu,int32_t scr,int32_t ir);
+
+// Store accesses made by each function, BREAK_READ and BREAK_WRITE
+extern const uint8_t breakStoreUse[64];
+
+static inline bool breakBit(const uint32_t *bitmap,int address)
+{
+    return (bitmap[(address >> 5) & 255] >> (address & 31)) & 1;
+}
+
+/* Called at each fetch once IR holds the instruction.  TRUE if the
+   machine should stop before obeying it. */
+static inline bool breakpointsHit(E803Breakpoints *breakpoints,E803Machine *cpu,int32_t scr)
+{
+    int address = cpu->IR & 8191;
+    unsigned int use = breakStoreUse[(cpu->IR >> 13) & 077];
+
+    if(breakBit(breakpoints->execute,(scr >> 1) & 8191) ||
+       ((use & BREAK_READ) && breakBit(breakpoints->read,address)) ||
+       ((use & BREAK_WRITE) && breakBit(breakpoints->write,address)))
+    {
+	return breakpointsCheck(breakpoints,cpu,scr);
+    }
+    return false;
+}
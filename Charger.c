@@ -14,6 +14,7 @@
 #include "Charger.h"
 #include "Wiring.h"
 #include "Common.h"
+#include "Snapshot.h"
 
 
 
@@ -161,6 +162,62 @@ static void updateCharger(__attribute__((unused)) unsigned int dummy)
 
 
 
+/* The state of the model, so that a snapshot doesn't have to wait for
+   the charger to ramp up again. */
+typedef struct
+{
+    double V[7],I[6];
+    double Icharger,Icomputer,Ipts,Ireader,Ipunch,Ibat;
+    double CurrentMeterReading,Vop,Vbat,VoltageReading;
+    gboolean mainsAvailable,chargerConnected;
+} ChargerState;
+
+#define CHARGER_FIELD(name) SNAPSHOT_FIELD(ChargerState,name)
+
+static const SnapshotField ChargerFields[] = {
+    CHARGER_FIELD(V),CHARGER_FIELD(I),CHARGER_FIELD(Icharger),CHARGER_FIELD(Icomputer),
+    CHARGER_FIELD(Ipts),CHARGER_FIELD(Ireader),CHARGER_FIELD(Ipunch),CHARGER_FIELD(Ibat),
+    CHARGER_FIELD(CurrentMeterReading),CHARGER_FIELD(Vop),CHARGER_FIELD(Vbat),
+    CHARGER_FIELD(VoltageReading),CHARGER_FIELD(mainsAvailable),CHARGER_FIELD(chargerConnected)
+};
+
+static void saveCharger(GByteArray *data)
+{
+    ChargerState saved = {
+	{Va,Vb,Vc,Vd,Ve,Vf,Vg},{Ia,Ib,Ic,Id,Ie,If},
+	Icharger,Icomputer,Ipts,Ireader,Ipunch,Ibat,
+	CurrentMeterReading,Vop,Vbat,VoltageReading,
+	mainsAvailable,chargerConnected };
+
+    SnapshotSaveFields(data,&saved,ChargerFields,G_N_ELEMENTS(ChargerFields));
+}
+
+static gboolean restoreCharger(const guint8 *data,gsize length)
+{
+    ChargerState saved;
+
+    if(length != SnapshotFieldsLength(ChargerFields,G_N_ELEMENTS(ChargerFields))) return FALSE;
+    SnapshotRestoreFields(&saved,data,ChargerFields,G_N_ELEMENTS(ChargerFields));
+
+    Va = saved.V[0]; Vb = saved.V[1]; Vc = saved.V[2]; Vd = saved.V[3];
+    Ve = saved.V[4]; Vf = saved.V[5]; Vg = saved.V[6];
+    Ia = saved.I[0]; Ib = saved.I[1]; Ic = saved.I[2];
+    Id = saved.I[3]; Ie = saved.I[4]; If = saved.I[5];
+    Icharger = saved.Icharger;
+    Icomputer = saved.Icomputer;
+    Ipts = saved.Ipts;
+    Ireader = saved.Ireader;
+    Ipunch = saved.Ipunch;
+    Ibat = saved.Ibat;
+    CurrentMeterReading = saved.CurrentMeterReading;
+    Vop = saved.Vop;
+    Vbat = saved.Vbat;
+    VoltageReading = saved.VoltageReading;
+    mainsAvailable = saved.mainsAvailable;
+    chargerConnected = saved.chargerConnected;
+    return TRUE;
+}
+
 // Save the window position in the "ChargerState" config file.
 void ChargerTidy(__attribute__((unused)) GString *userPath)
 {
@@ -183,6 +240,8 @@ void ChargerInit(
 
     // Hook updateCharger into the 100Hz timer.
     connectWires(TIMER100HZ,updateCharger);
+
+    SnapshotRegister("CHGR",saveCharger,restoreCharger);
 }
 
 
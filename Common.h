@@ -5,6 +5,8 @@
     See LICENCE file. 
 */   
 
+#include "Ring.h"
+
 struct fsmtable {
     int state;
     int event;
@@ -41,18 +43,9 @@ typedef struct _buttonEvent
     guint time;
 } ButtonEvent;
 
-GAsyncQueue *ButtonEventQueue;
+#define BUTTON_EVENTS 256
+E803Ring *ButtonEventRing;     // GUI to emulation thread
 
-typedef struct _lampsEvent
-{
-    unsigned int lampId;
-    gboolean on;
-    gfloat brightness;
-    
-} LampsEvent;
-
-GAsyncQueue *LampsEventQueue;
-GAsyncQueue *PlotterMovesQueue;
 gboolean oldHandSwap;
 
 
@@ -7,30 +7,53 @@
 
 #define G_LOG_USE_STRUCTURED
 #include <stdio.h>
-#include <gtk/gtk.h> 
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include <gio/gio.h>
 #include <stdint.h>
-// There is no real gtk+ code here, so g_boolean is not used.
+// There is no gtk+ code here, so g_boolean is not used.
 #include <stdbool.h>
 
 #include "Cpu.h"
 #include "Wiring.h"
-#include "Sound.h"
 
 #include "E803-types.h"
 #include "wg-definitions.h"
 
 #include "Emulate.h"
+#include "Profile.h"
+#include "Trace.h"
+#include "Debugger.h"
+#include "Snapshot.h"
+#include "Rewind.h"
+#include "Journal.h"
+#include "Scheduler.h"
 #if 0
 #include "Plotter.h"
 #endif
 
 #define REMOTEPLOTTER 0
 
-E803word WG;
-unsigned int WG_ControlButtons;    
-
-bool WG_operate_pressed = false;
 unsigned int volume;
+static gboolean threadedEngine = FALSE;
+static gboolean profileFromStart = FALSE;
+static E803Profile *profile = NULL;
+static GString *ProfileFileName = NULL;
+static guint traceLength = 1048576;
+static gboolean traceFromStart = FALSE;
+static E803Trace *trace = NULL;
+static GString *TraceFileName = NULL;
+static GString *SnapshotFileName = NULL;
+static gint snapshotRequested = 0;           // Set by the GUI, cleared by the emulation thread
+static gpointer pendingRestore = NULL;       // GBytes read by the GUI for the emulation thread
+static gsize rewindLimit = 0;
+static int rewindInterval = 10000;
+static E803Journal *journal = NULL;
+static gchar *JournalFileName = NULL;
+static GAsyncQueue *Requests = NULL;         // Toggles from the GUI for the emulation thread
+
+enum CpuRequest {PROFILE_TOGGLE = 1,TRACE_TOGGLE};
 
 
 // Used if tracing is enabled
@@ -58,8 +81,8 @@ static void setF1(unsigned int value)
     E803word bits = value;
     g_debug(" value = %d\n",value);
 
-    WG &= 00077777777777;   // F1
-    WG |= 07700000000000 & (bits << 33);
+    WiredMachine->WG &= 00077777777777;   // F1
+    WiredMachine->WG |= 07700000000000 & (bits << 33);
 }
 
 static void setN1(unsigned int value)
@@ -67,58 +90,58 @@ static void setN1(unsigned int value)
     E803word bits = value;
     g_debug(" value = %d\n",value);
     
-    WG &= 07700001777777;   // N1 + B
-    WG |= 00077776000000 & (bits << 19);
+    WiredMachine->WG &= 07700001777777;   // N1 + B
+    WiredMachine->WG |= 00077776000000 & (bits << 19);
 }
 
 static void setF2(unsigned int value)
 {
     E803word bits = value;
     g_debug(" value = %d\n",value);
-    WG &= 07777776017777;   // F1
-    WG |= 00000001760000 & (bits << 13);
+    WiredMachine->WG &= 07777776017777;   // F1
+    WiredMachine->WG |= 00000001760000 & (bits << 13);
 }
 
 static void setN2(unsigned int value)
 {
     E803word bits = value;
     g_debug(" value = %d\n",value);
-    WG &= 07777777760000;   // N2
-    WG |= 00000000017777 & bits;
+    WiredMachine->WG &= 07777777760000;   // N2
+    WiredMachine->WG |= 00000000017777 & bits;
 }
 
 static void setRON(unsigned int button)
 {
     g_debug(" value = %d\n",button);
-    WG_ControlButtons &= ~(WG_read | WG_normal | WG_obey);
-    WG_ControlButtons |= button;
+    WiredMachine->WG_ControlButtons &= ~(WG_read | WG_normal | WG_obey);
+    WiredMachine->WG_ControlButtons |= button;
 }
 
 static void setMD(unsigned int value)
 {
     g_debug(" value = %d\n",value);
     if(value == 0)
-	WG_ControlButtons &= ~WG_manual_data;
+	WiredMachine->WG_ControlButtons &= ~WG_manual_data;
     else
-	WG_ControlButtons |= WG_manual_data;
+	WiredMachine->WG_ControlButtons |= WG_manual_data;
 }
 
 static void setRESET(unsigned int value)
 {
     g_debug(" value = %d\n",value);
     if(value == 0)
-	WG_ControlButtons &= ~WG_reset;
+	WiredMachine->WG_ControlButtons &= ~WG_reset;
     else
-	WG_ControlButtons |= WG_reset;
+	WiredMachine->WG_ControlButtons |= WG_reset;
 }
 
 static void setCS(unsigned int value)
 {
     g_debug(" value = %d\n",value);
     if(value == 0)
-	WG_ControlButtons &= ~WG_clear_store;
+	WiredMachine->WG_ControlButtons &= ~WG_clear_store;
     else
-	WG_ControlButtons |= WG_clear_store;
+	WiredMachine->WG_ControlButtons |= WG_clear_store;
 }
 
 static void setSS(unsigned int value)
@@ -126,11 +149,11 @@ static void setSS(unsigned int value)
     g_debug(" value = %d\n",value);
     if(value == 0)
     {
-	WG_ControlButtons &= ~WG_selected_stop;
+	WiredMachine->WG_ControlButtons &= ~WG_selected_stop;
     }
     else
     {
-	WG_ControlButtons |= WG_selected_stop;
+	WiredMachine->WG_ControlButtons |= WG_selected_stop;
     }
 }
 
@@ -139,17 +162,96 @@ static void setOPERATE(unsigned int value)
     g_debug(" value = %d\n",value);
     if(value == 0)
     {
-	WG_ControlButtons &= ~WG_operate;
+	WiredMachine->WG_ControlButtons &= ~WG_operate;
     }
     else
     {
-	WG_ControlButtons |= WG_operate;
-	WG_operate_pressed = true;
+	WiredMachine->WG_ControlButtons |= WG_operate;
+	WiredMachine->WG_operate_pressed = true;
     }
 
 }
 
 #if 1
+// Runs on the GUI thread so the emulation thread never waits for the disc.
+static gboolean writeSnapshot(gpointer data)
+{
+    GByteArray *snapshot = (GByteArray *) data;
+    GError *error = NULL;
+
+    if(SnapshotWrite(snapshot,SnapshotFileName->str,&error))
+    {
+	g_info("Snapshot written to %s\n",SnapshotFileName->str);
+    }
+    else
+    {
+	g_warning("Failed to write snapshot %s (%s)\n",SnapshotFileName->str,error->message);
+	g_error_free(error);
+    }
+    g_byte_array_unref(snapshot);
+    return G_SOURCE_REMOVE;
+}
+
+// Deal with snapshots asked for by the GUI.
+static void cpuSnapshots(void)
+{
+    GBytes *restore;
+    GError *error = NULL;
+    gconstpointer data;
+    gsize length;
+
+    if(g_atomic_int_get(&snapshotRequested))
+    {
+	g_atomic_int_set(&snapshotRequested,0);
+	g_idle_add(writeSnapshot,SnapshotTake());
+    }
+
+    restore = (GBytes *) g_atomic_pointer_get(&pendingRestore);
+    if((restore != NULL) && g_atomic_pointer_compare_and_exchange(&pendingRestore,restore,NULL))
+    {
+	data = g_bytes_get_data(restore,&length);
+	if(!SnapshotRestore((const guint8 *) data,length,&error))
+	{
+	    g_warning("Failed to restore snapshot (%s)\n",error->message);
+	    g_error_free(error);
+	}
+	g_bytes_unref(restore);
+	// History doesn't lead here any more
+	if(WiredMachine->Rewind != NULL) RewindReset(WiredMachine->Rewind);
+	if(journal != NULL) JournalRestart(journal);
+    }
+}
+
+static void profileToggle(void);
+static void traceToggle(void);
+
+/* Profiling and tracing are turned on and off here, between calls to
+   Emulate, as the counters and the ring are cleared when they start and
+   written out when they stop.  Writing them out waits for the disc, but
+   only when the operator asks. */
+static void cpuRequests(void)
+{
+    gpointer request;
+
+    while((request = g_async_queue_try_pop(Requests)) != NULL)
+    {
+	switch(GPOINTER_TO_INT(request))
+	{
+	case PROFILE_TOGGLE:
+	    profileToggle();
+	    break;
+	case TRACE_TOGGLE:
+	    traceToggle();
+	    break;
+	default:
+	    break;
+	}
+    }
+}
+
+// Word times the last call to CPU_sound moved the machine on by
+static gint64 WordTimesRun = 0;
+
 void CPU_sound(__attribute__((unused)) void *buffer, 
 		      __attribute__((unused))int sampleCount,
 		      __attribute__((unused))double bufferTime,
@@ -159,12 +261,25 @@ void CPU_sound(__attribute__((unused)) void *buffer,
     static bool updateFlag = true;
     static int updateRate  = UPDATE_RATE;
     static int callCount = 1;
+    int64_t wordTimeWas;
 
+    WordTimesRun = 0;
+
+    // Snapshots are taken and restored between calls to Emulate
+    cpuSnapshots();
+    cpuRequests();
+
+    // Time stands still while the debugger has the machine halted
+    if(DebuggerService(WiredMachine))
+    {
+	WiredMachine->WG_operate_pressed = false;
+	return;
+    }
 
     if (first)
     {
     	first = false;
-    	PreEmulate(false);
+    	PreEmulate(WiredMachine,false);
     }
     else
     {
@@ -184,86 +299,425 @@ void CPU_sound(__attribute__((unused)) void *buffer,
 
     // Simplified version for testing during development
 
-    PostEmulate(updateFlag);
+    PostEmulate(WiredMachine,updateFlag);
 
 #if REMOTEPLOTTER	
 	sendSteps();
 #endif
     
-    PreEmulate(updateFlag);
-    Emulate(wordTimes);
+    PreEmulate(WiredMachine,updateFlag);
+    wordTimeWas = WiredMachine->CPU_word_time_count;
+    Emulate(WiredMachine,wordTimes);
+    WordTimesRun = WiredMachine->CPU_word_time_count - wordTimeWas;
 
-    WG_operate_pressed = false;
+    WiredMachine->WG_operate_pressed = false;
 
     callCount += 1;
 }
 
+// TRUE if the last call to CPU_sound was spent waiting for the outside world.
+gboolean CPU_idle(void)
+{
+    return emulatorIdle(WiredMachine) ? TRUE : FALSE;
+}
 
+// Word times the last call to CPU_sound emulated, none while halted.
+gint64 CPU_wordTimesRun(void)
+{
+    return WordTimesRun;
+}
 
-extern E803word *CoreStore;
+// Called before CpuInit, so just remember the choice.
+void CpuThreadedEngine(gboolean threaded)
+{
+    threadedEngine = threaded;
+}
 
-void CpuTidy(GString *userPath,gchar *coreFileName)
+
+/* Turn profiling of the wired machine on or off.  Turning it on
+   starts a new profile.  The counters are kept until CpuTidy so that
+   they can be written out.  Only called while the machine is not
+   being emulated or on the emulation thread. */
+void CpuProfile(gboolean on)
+{
+    if(on)
+    {
+	if(profile == NULL)
+	    profile = ProfileNew();
+	else
+	    ProfileReset(profile);
+    }
+    WiredMachine->Profile = on ? profile : NULL;
+    wiringCounting(on);
+}
+
+gboolean CpuProfiling(void)
+{
+    return (WiredMachine->Profile != NULL) ? TRUE : FALSE;
+}
+
+// Called before CpuInit, so just remember the choice.
+void CpuProfileFromStart(gboolean on)
+{
+    profileFromStart = on;
+}
+
+// Write the last profile as an annotated listing of the store.
+gboolean CpuProfileDump(const gchar *fileName)
 {
-    GString *CoreImageFileName = NULL;
     GError *error = NULL;
-    GFile *gf;
-    GFileOutputStream *gfos;
-    gboolean writeOk;
-    gsize written;
-	
-    CoreImageFileName = g_string_new(userPath->str);
-    if(coreFileName != NULL)
+
+    if(profile == NULL) return FALSE;
+
+    if(!ProfileDump(profile,WiredMachine->CoreStore,fileName,&error))
     {
-	g_string_append(CoreImageFileName,coreFileName);
+	g_warning("Failed to write profile %s (%s)\n",fileName,error->message);
+	g_error_free(error);
+	return FALSE;
+    }
+    g_info("Profile written to %s\n",fileName);
+    return TRUE;
+}
+
+// The profile is written when it is turned off.
+static void profileToggle(void)
+{
+    if(CpuProfiling())
+    {
+	CpuProfile(FALSE);
+	CpuProfileDump(ProfileFileName->str);
     }
     else
     {
-	g_string_append(CoreImageFileName,"CoreImage");
+	CpuProfile(TRUE);
+	g_info("Profiling started\n");
     }
+}
 
-    g_info("Writing Core contents to %s\n",CoreImageFileName->str);
-    
-    gf = g_file_new_for_path(CoreImageFileName->str);
+/* Turn the instruction trace of the wired machine on or off.  As with
+   the profile the ring is kept when it is turned off so that it can
+   be written out, and it is only called from the same places. */
+void CpuTrace(gboolean on)
+{
+    if(on)
+    {
+	if(trace == NULL)
+	    trace = TraceNew(traceLength);
+	else
+	    TraceReset(trace);
+    }
+    WiredMachine->Trace = on ? trace : NULL;
+}
+
+gboolean CpuTracing(void)
+{
+    return (WiredMachine->Trace != NULL) ? TRUE : FALSE;
+}
+
+// Called before CpuInit, so just remember the choice.
+void CpuTraceFromStart(gboolean on,guint length)
+{
+    traceFromStart = on;
+    if(length != 0) traceLength = length;
+}
+
+gboolean CpuTraceDump(const gchar *fileName)
+{
+    GError *error = NULL;
+
+    if(trace == NULL) return FALSE;
+
+    if(!TraceDump(trace,fileName,&error))
+    {
+	g_warning("Failed to write trace %s (%s)\n",fileName,error->message);
+	g_error_free(error);
+	return FALSE;
+    }
+    g_info("Trace written to %s\n",fileName);
+    return TRUE;
+}
+
+// The same for the trace.
+static void traceToggle(void)
+{
+    if(CpuTracing())
+    {
+	CpuTrace(FALSE);
+	CpuTraceDump(TraceFileName->str);
+    }
+    else
+    {
+	CpuTrace(TRUE);
+	g_info("Tracing started\n");
+    }
+}
+
+// Key bindings in the GUI, passed on to the emulation thread.
+void CpuProfileToggle(void)
+{
+    g_async_queue_push(Requests,GINT_TO_POINTER(PROFILE_TOGGLE));
+}
+
+void CpuTraceToggle(void)
+{
+    g_async_queue_push(Requests,GINT_TO_POINTER(TRACE_TOGGLE));
+}
+
+/* Called before CpuInit or CpuStart.  Keep up to megabytes of
+   checkpoints, one every interval word times, so that the debugger can
+   go backwards.  Zero megabytes turns it off. */
+void CpuRewind(guint megabytes,guint interval)
+{
+    rewindLimit = (gsize) megabytes * 1024 * 1024;
+    if(interval != 0) rewindInterval = (int) MIN(interval,(guint) G_MAXINT);
+}
+
+/* Record everything that reaches the wired machine from now on, to be
+   written to fileName by CpuRecordSave.  Call once everything has been
+   connected and any snapshot resumed from. */
+void CpuRecord(const gchar *fileName)
+{
+    g_free(JournalFileName);
+    JournalFileName = g_strdup(fileName);
+    if(journal == NULL)
+    {
+	journal = JournalRecord(WiredMachine);
+    }
+}
+
+// Stop recording and write out the journal.  The emulation must be stopped.
+gboolean CpuRecordSave(void)
+{
+    GError *error = NULL;
+    gboolean ok;
+
+    if(journal == NULL) return TRUE;
+
+    JournalStop(journal);
+    ok = JournalSave(journal,JournalFileName,&error);
+    if(ok)
+    {
+	g_info("Journal of %u records written to %s\n",journal->records->len,JournalFileName);
+    }
+    else
+    {
+	g_warning("Failed to write journal %s (%s)\n",JournalFileName,error->message);
+	g_error_free(error);
+    }
+    JournalFree(journal);
+    journal = NULL;
+    return ok;
+}
+
+// Snapshot sections for the machine itself and its store.
+static void saveMachine(GByteArray *data)
+{
+    SaveMachineState(WiredMachine,data);
+}
+
+static gboolean restoreMachine(const guint8 *data,gsize length)
+{
+    return RestoreMachineState(WiredMachine,data,length) ? TRUE : FALSE;
+}
+
+static void saveCore(GByteArray *data)
+{
+    g_byte_array_append(data,(const guint8 *) WiredMachine->CoreStore,8192 * sizeof(E803word));
+}
+
+static gboolean restoreCore(const guint8 *data,gsize length)
+{
+    if(length != (8192 * sizeof(E803word))) return FALSE;
+    memcpy(WiredMachine->CoreStore,data,length);
+    flushDecodedStore(WiredMachine);
+    return TRUE;
+}
+
+// Key binding in the GUI.  The snapshot is taken by the emulation thread.
+void CpuSnapshotSave(void)
+{
+    g_atomic_int_set(&snapshotRequested,1);
+}
+
+/* Key binding in the GUI.  The file is read here and restored by the
+   emulation thread before it next emulates anything. */
+void CpuSnapshotRestore(void)
+{
+    GBytes *restore;
+    GError *error = NULL;
+
+    restore = SnapshotRead(SnapshotFileName->str,&error);
+    if(restore == NULL)
+    {
+	g_warning("Failed to read snapshot %s (%s)\n",SnapshotFileName->str,error->message);
+	g_error_free(error);
+	return;
+    }
+    if(!g_atomic_pointer_compare_and_exchange(&pendingRestore,NULL,restore))
+    {
+	// Still busy with the last one
+	g_bytes_unref(restore);
+    }
+}
+
+/* Restore the snapshot saved when the emulator last stopped.  Called
+   from main once everything has registered its sections and before the
+   emulation thread starts. */
+gboolean CpuResume(void)
+{
+    GBytes *restore;
+    GError *error = NULL;
+    gconstpointer data;
+    gsize length;
+    gboolean ok;
+
+    restore = SnapshotRead(SnapshotFileName->str,&error);
+    if(restore != NULL)
+    {
+	data = g_bytes_get_data(restore,&length);
+	ok = SnapshotRestore((const guint8 *) data,length,&error);
+	g_bytes_unref(restore);
+	if(ok)
+	{
+	    g_info("Resumed from %s\n",SnapshotFileName->str);
+	    return TRUE;
+	}
+    }
+    g_warning("Failed to resume from %s (%s)\n",SnapshotFileName->str,error->message);
+    g_error_free(error);
+    return FALSE;
+}
+
+/* Read a core image.  The store returned is always the full 8192 words,
+   padded with zeros if the file is short.  Returns NULL and sets error if
+   the file can't be read. */
+E803word *LoadCoreImage(const gchar *fileName,GError **error)
+{
+    GFile *gf;
+    GBytes *gb;
+    gconstpointer data;
+    gsize length;
+    E803word *core;
+
+    gf = g_file_new_for_path(fileName);
+    gb = g_file_load_bytes(gf,NULL,NULL,error);
+    g_object_unref(gf);
+
+    if(gb == NULL) return NULL;
+
+    data = g_bytes_get_data(gb,&length);
+    g_debug("Core image file Length = %zu\n",length);
+
+    if(length > 8192 * sizeof(E803word))
+    {
+	length = 8192 * sizeof(E803word);
+    }
+    core = (E803word *) calloc(8194,sizeof(E803word));
+    memcpy(core,data,length);
+
+    g_bytes_unref(gb);
+    return core;
+}
+
+// Write the 8192 words of a core store to a file.
+gboolean SaveCoreImage(const gchar *fileName,E803word *core,GError **error)
+{
+    GFile *gf;
+    GFileOutputStream *gfos;
+    gboolean writeOk;
+    gsize written = 0;
+
+    gf = g_file_new_for_path(fileName);
 
     gfos = g_file_replace (gf,
 			   NULL,
 			   TRUE,
 			   G_FILE_CREATE_NONE,
 			   NULL,
-			   &error);
+			   error);
+    g_object_unref(gf);
+
+    if(gfos == NULL) return FALSE;
 
     writeOk = g_output_stream_write_all (G_OUTPUT_STREAM(gfos),
-					 CoreStore,
+					 core,
 					 8192 * sizeof(E803word),
 					 &written,
 					 NULL,
-					 &error);
+					 error);
+
+    if(!g_output_stream_close (G_OUTPUT_STREAM(gfos),NULL,writeOk ? error : NULL))
+    {
+	writeOk = FALSE;
+    }
+    g_object_unref(gfos);
 
-    g_output_stream_close (G_OUTPUT_STREAM(gfos),NULL,&error);
-	
-    g_info("writeOk is %s\n",writeOk?"true":"false");
     g_debug("written = %zu\n",written);
+    return writeOk;
+}
 
-    g_object_unref(gf);
+void CpuTidy(GString *userPath,gchar *coreFileName)
+{
+    GString *CoreImageFileName = NULL;
+    GError *error = NULL;
+    gboolean writeOk;
+    GByteArray *snapshot;
+	
+    CoreImageFileName = g_string_new(userPath->str);
+    if(coreFileName != NULL)
+    {
+	g_string_append(CoreImageFileName,coreFileName);
+    }
+    else
+    {
+	g_string_append(CoreImageFileName,"CoreImage");
+    }
+
+    if(CpuProfiling())
+    {
+	CpuProfile(FALSE);
+	CpuProfileDump(ProfileFileName->str);
+    }
+
+    if(CpuTracing())
+    {
+	CpuTrace(FALSE);
+	CpuTraceDump(TraceFileName->str);
+    }
+
+    CpuRecordSave();
+
+    // The emulation thread has stopped, so everything can be saved from here
+    snapshot = SnapshotTake();
+    if(!SnapshotWrite(snapshot,SnapshotFileName->str,&error))
+    {
+	g_warning("Failed to write snapshot %s (%s)\n",SnapshotFileName->str,error->message);
+	g_clear_error(&error);
+    }
+    g_byte_array_unref(snapshot);
+
+    g_info("Writing Core contents to %s\n",CoreImageFileName->str);
+    
+    writeOk = SaveCoreImage(CoreImageFileName->str,WiredMachine->CoreStore,&error);
+
+    g_info("writeOk is %s\n",writeOk?"true":"false");
+    if(error != NULL)
+    {
+	g_warning("Failed to write core file %s (%s)\n",
+		  CoreImageFileName->str,error->message);
+	g_error_free(error);
+    }
 	
     g_string_free(CoreImageFileName,TRUE);
 }
 #endif
 
 
-void CpuInit(__attribute__((unused)) GString *sharedPath,
-		 __attribute__((unused)) GString *userPath,
-		 __attribute__((unused))gchar *coreFileName)
+/* Connect the word generator to the wired machine and start it with
+   the given core store (NULL for a clear store).  Used by CpuInit and
+   by the batch runner, which has no GUI to load anything else. */
+void CpuStart(E803word *core)
 {
-
-    GString *CoreImageFileName = NULL;
-    gchar *core = NULL;
-    GError *error = NULL;
-
-    GFile *gf;
-    GBytes *gb;
-    GByteArray *gba;
-
     connectWires(F1WIRES,setF1);
     connectWires(N1WIRES,setN1);
     connectWires(F2WIRES,setF2);
@@ -276,6 +730,28 @@ void CpuInit(__attribute__((unused)) GString *sharedPath,
     connectWires(OPERATEWIRE,setOPERATE);
     connectWires(VOLUME_CONTROL,setCPUVolume);
 
+    Requests = g_async_queue_new();
+    StartEmulate((char *) core);
+    setThreadedEngine(WiredMachine,threadedEngine ? true : false);
+    WiredMachine->Scheduler = SchedulerNew(WiredMachine->CPU_word_time_count);
+    if(rewindLimit != 0)
+    {
+	WiredMachine->Rewind = RewindNew(rewindLimit,rewindInterval);
+    }
+
+    SnapshotRegister("CPU ",saveMachine,restoreMachine);
+    SnapshotRegister("CORE",saveCore,restoreCore);
+}
+
+void CpuInit(__attribute__((unused)) GString *sharedPath,
+		 __attribute__((unused)) GString *userPath,
+		 __attribute__((unused))gchar *coreFileName)
+{
+
+    GString *CoreImageFileName = NULL;
+    E803word *core = NULL;
+    GError *error = NULL;
+
     CoreImageFileName = g_string_new(userPath->str);
     if(coreFileName != NULL)
     {
@@ -288,30 +764,33 @@ void CpuInit(__attribute__((unused)) GString *sharedPath,
 
     g_info("Loading core store from %s\n",CoreImageFileName->str);
 
-    gf = g_file_new_for_path(CoreImageFileName->str);
-	
-    gb = g_file_load_bytes(gf,
-			   NULL,NULL,&error);
+    core = LoadCoreImage(CoreImageFileName->str,&error);
 
-    if(error != NULL)
+    if(core == NULL)
     {
 	g_warning("Failed to open core file %s (%s), using a clear store\n",
 		  CoreImageFileName->str,error->message);
-	core = calloc(8192,sizeof(E803word));
-    }
-    else
-    {
-	// Don't unref the gba as it's data IS the core store.
-	gba = g_bytes_unref_to_array(gb);
-	g_byte_array_ref(gba);
-
-	core = (char *) gba->data;
-
-	g_debug("Core image file Length = %u\n",gba->len);
+	g_error_free(error);
     }
-    g_object_unref(gf);
     
-    StartEmulate(core);
+    CpuStart(core);
     
     g_string_free(CoreImageFileName,TRUE);
+
+    ProfileFileName = g_string_new(userPath->str);
+    g_string_append(ProfileFileName,"Profile");
+    if(profileFromStart)
+    {
+	CpuProfile(TRUE);
+    }
+
+    TraceFileName = g_string_new(userPath->str);
+    g_string_append(TraceFileName,"Trace");
+    if(traceFromStart)
+    {
+	CpuTrace(TRUE);
+    }
+
+    SnapshotFileName = g_string_new(userPath->str);
+    g_string_append(SnapshotFileName,"Snapshot");
 }
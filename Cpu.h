@@ -7,14 +7,54 @@
 
 
 #pragma once
+#include <glib.h>
+#include "E803-types.h"
+
 void CpuInit( __attribute__((unused)) GString *sharedPath,
 	      __attribute__((unused)) GString *userPath,
 	      gchar *coreFileName);
 
+void CpuStart(E803word *core);
+
 
 void CPU_sound(__attribute__((unused)) void *buffer, 
 	       __attribute__((unused))int sampleCount,
 	       __attribute__((unused))double bufferTime,
 	       int wordTimes);
 
+gboolean CPU_idle(void);
+gint64 CPU_wordTimesRun(void);
+
+// Call before CpuInit or CpuStart
+void CpuThreadedEngine(gboolean threaded);
+
+// Execution profiling of the wired machine
+void CpuProfile(gboolean on);
+gboolean CpuProfiling(void);
+void CpuProfileFromStart(gboolean on);
+gboolean CpuProfileDump(const gchar *fileName);
+void CpuProfileToggle(void);
+
+// Instruction trace of the wired machine
+void CpuTrace(gboolean on);
+gboolean CpuTracing(void);
+void CpuTraceFromStart(gboolean on,guint length);
+gboolean CpuTraceDump(const gchar *fileName);
+void CpuTraceToggle(void);
+
+// Checkpoints of the wired machine for going backwards
+void CpuRewind(guint megabytes,guint interval);
+
+// Recording what reaches the wired machine, for 803-batch --replay
+void CpuRecord(const gchar *fileName);
+gboolean CpuRecordSave(void);
+
+// Snapshots of the whole emulator in the config directory
+void CpuSnapshotSave(void);
+void CpuSnapshotRestore(void);
+gboolean CpuResume(void);
+
 void CpuTidy(GString *userPath,gchar *coreFileName);
+
+E803word *LoadCoreImage(const gchar *fileName,GError **error);
+gboolean SaveCoreImage(const gchar *fileName,E803word *core,GError **error);
@@ -0,0 +1,115 @@
+/*  This file is part of the Elliott 803 emulator.
+
+    Copyright © 2020  Peter Onion
+
+    See LICENCE file. 
+*/
+
+/* Turning runs of word times into samples.  The ring is filled and
+   read in at most two contiguous pieces each time, and the loops over
+   them are simple enough for the compiler to vectorise. */
+
+#define G_LOG_USE_STRUCTURED
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "CpuSound.h"
+
+#define RING_MASK (CPU_SOUND_RING - 1)
+
+E803CpuSound *CpuSoundNew(int framesPerWordTime)
+{
+    E803CpuSound *sound;
+
+    sound = (E803CpuSound *) calloc(1,sizeof(E803CpuSound));
+    sound->framesPerWordTime = framesPerWordTime;
+    return sound;
+}
+
+void CpuSoundFree(E803CpuSound *sound)
+{
+    free(sound);
+}
+
+static void fill(int16_t *samples,int16_t level,int frames)
+{
+    for(int n = 0; n < (frames * 2); n++)
+    {
+	samples[n] = level;
+    }
+}
+
+// Put frames at level into the ring.  FALSE when there isn't room.
+static gboolean put(E803CpuSound *sound,int16_t level,int frames)
+{
+    int at,piece;
+
+    if(frames > (int) (CPU_SOUND_RING - (sound->head - sound->tail))) return FALSE;
+
+    at = (int) (sound->head & RING_MASK);
+    piece = (frames < (CPU_SOUND_RING - at)) ? frames : (CPU_SOUND_RING - at);
+    fill(&sound->ring[at * 2],level,piece);
+    fill(sound->ring,level,frames - piece);
+    sound->head += (unsigned int) frames;
+    return TRUE;
+}
+
+static gboolean putRun(E803CpuSound *sound,const E803CpuSoundRun *run)
+{
+    int frames = sound->framesPerWordTime;
+
+    if(run->first == run->remainder)
+	return put(sound,run->first,run->wordTimes * frames);
+
+    for(int w = 0; w < run->wordTimes; w++)
+    {
+	if(!put(sound,run->first,1) || !put(sound,run->remainder,frames - 1)) return FALSE;
+    }
+    return TRUE;
+}
+
+/* Turn the runs into samples.  Called when they are mixed, or by
+   cpuSoundRecord() when there are no runs left.  If the ring fills up,
+   which it can only do if nothing has been mixed for several periods,
+   the rest are lost. */
+void cpuSoundRender(E803CpuSound *sound)
+{
+    for(int n = 0; n < sound->count; n++)
+    {
+	if(!putRun(sound,&sound->runs[n])) break;
+    }
+    sound->count = 0;
+}
+
+static void mix(int16_t *buffer,const int16_t *samples,int frames)
+{
+    for(int n = 0; n < (frames * 2); n++)
+    {
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wconversion"
+	buffer[n] += samples[n];
+#pragma GCC diagnostic pop
+    }
+}
+
+/* Add up to frames of the CPU's sound into buffer.  Returns the frames
+   left over for the next period. */
+int CpuSoundMix(E803CpuSound *sound,int16_t *buffer,int frames)
+{
+    int at,piece,available;
+
+    cpuSoundRender(sound);
+
+    available = (int) (sound->head - sound->tail);
+    if(frames > available) frames = available;
+
+    at = (int) (sound->tail & RING_MASK);
+    piece = (frames < (CPU_SOUND_RING - at)) ? frames : (CPU_SOUND_RING - at);
+    mix(buffer,&sound->ring[at * 2],piece);
+    mix(&buffer[piece * 2],sound->ring,frames - piece);
+    sound->tail += (unsigned int) frames;
+
+    return available - frames;
+}
@@ -0,0 +1,66 @@
+/*  This file is part of the Elliott 803 emulator.
+
+    Copyright © 2020  Peter Onion
+
+    See LICENCE file. 
+*/
+
+#pragma once
+/* The sound made by the CPU.  Each word time is one frame at the level
+   of its first sample followed by the rest at a second level.  While a
+   machine's sound pointer is set the emulator records these as runs of
+   identical word times, which usually means one run for every change
+   of level.  Once per period the runs are turned into samples in a
+   ring and mixed into the period's buffer, and whatever is left over
+   stays in the ring for the next period. */
+
+#include <stdint.h>
+#include <glib.h>
+
+#define CPU_SOUND_RUNS 1024
+#define CPU_SOUND_RING 8192      // Frames, a power of two
+
+typedef struct _e803CpuSoundRun
+{
+    int32_t wordTimes;
+    int16_t first;
+    int16_t remainder;
+} E803CpuSoundRun;
+
+typedef struct _e803CpuSound
+{
+    E803CpuSoundRun runs[CPU_SOUND_RUNS];   // Not yet turned into samples
+    int count;
+    int framesPerWordTime;
+    int16_t ring[CPU_SOUND_RING * 2];       // Stereo frames
+    unsigned int head,tail;                 // Frames written and read
+} E803CpuSound;
+
+E803CpuSound *CpuSoundNew(int framesPerWordTime);
+void CpuSoundFree(E803CpuSound *sound);
+int CpuSoundMix(E803CpuSound *sound,int16_t *buffer,int frames);
+void cpuSoundRender(E803CpuSound *sound);
+
+// Called by the emulator for every word time, or several the same.
+static inline void cpuSoundRecord(E803CpuSound *sound,int16_t first,int16_t remainder,int wordTimes)
+{
+    E803CpuSoundRun *run;
+
+    if(sound->count > 0)
+    {
+	run = &sound->runs[sound->count - 1];
+	if((run->first == first) && (run->remainder == remainder))
+	{
+	    run->wordTimes += wordTimes;
+	    return;
+	}
+    }
+
+    // Out of runs, so turn them into samples now rather than lose any
+    if(G_UNLIKELY(sound->count == CPU_SOUND_RUNS)) cpuSoundRender(sound);
+
+    run = &sound->runs[sound->count++];
+    run->wordTimes = wordTimes;
+    run->first = first;
+    run->remainder = remainder;
+}
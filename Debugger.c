@@ -0,0 +1,633 @@
+/*  This file is part of the Elliott 803 emulator.
+
+    Copyright © 2020  Peter Onion
+
+    See LICENCE file. 
+*/
+
+/* Remote debugger.  Commands arrive one per line on a TCP connection to
+   localhost.  Each gets back any number of lines of information followed
+   by a line starting "ok" or "error".  Lines starting "event" can come at
+   any time, for example when a breakpoint stops the machine.
+
+   halt                       Stop emulating, time stands still
+   continue                   Carry on (after a breakpoint, as if Operate was pressed)
+   step [N]                   Emulate N word times (default 1)
+   stepi [N]                  Emulate N instructions (default 1)
+   regs                       Show the registers
+   set REG VALUE              REG is ACC, AR, SCR, IR, B, M, OFLOW or S
+   read ADDR COUNT            Words from the store in one line
+   write ADDR WORD ...        Words into the store from one line
+   break ... / watch ...      As in BreakpointParse()
+   delete N                   Delete a breakpoint
+   breakpoints                List the breakpoints
+   status                     halted or running
+   rstep [N]                  Go back N word times (default 1)
+   rstepi [N]                 Go back N instructions (default 1)
+   rcontinue                  Go back to the last breakpoint or watchpoint
+   history                    The word times that can be gone back to
+
+   Going backwards needs the emulator to have been started with
+   --rewind, see Rewind.h for what it can't go back past.
+
+   Numbers can be decimal, octal with a leading 0 or hex with a leading
+   0x.  Words are shown in octal. */
+
+#define G_LOG_USE_STRUCTURED
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <glib.h>
+
+/* For network sockets */
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+
+#include "E803-types.h"
+#include "Emulate.h"
+#include "Breakpoints.h"
+#include "Rewind.h"
+#include "Debugger.h"
+
+#define WORD_MASK 0x7FFFFFFFFFULL
+// Most word times stepi will run looking for the end of an instruction
+#define STEPI_LIMIT 1000000
+
+typedef struct _debugMessage
+{
+    GIOChannel *channel;    // The connection it came from or is going to
+    gchar *text;
+} DebugMessage;
+
+// Lines from the debugger, pushed by the GUI thread and popped by the emulation thread
+static GAsyncQueue *RequestQueue = NULL;
+
+// Only used by the GUI thread
+static GIOChannel *listeningChannel = NULL;
+static GIOChannel *debuggerChannel = NULL;
+static GString *lineBuffer = NULL;
+
+// Only used by the emulation thread
+static gboolean Halted = FALSE;
+static gboolean BreakpointStop = FALSE;   // Halted because a breakpoint set S
+static GIOChannel *eventChannel = NULL;
+
+static DebugMessage *newMessage(GIOChannel *channel,gchar *text)
+{
+    DebugMessage *message;
+
+    message = g_new(DebugMessage,1);
+    message->channel = g_io_channel_ref(channel);
+    message->text = text;
+    return message;
+}
+
+static void freeMessage(DebugMessage *message)
+{
+    g_io_channel_unref(message->channel);
+    g_free(message->text);
+    g_free(message);
+}
+
+/************************** GUI thread *****************************/
+
+// Idle callback that writes a reply, unless the debugger has gone away.
+static gboolean sendReply(gpointer data)
+{
+    DebugMessage *reply = (DebugMessage *) data;
+    gsize written;
+
+    if(reply->channel == debuggerChannel)
+    {
+	g_io_channel_write_chars(reply->channel,reply->text,-1,&written,NULL);
+	g_io_channel_flush(reply->channel,NULL);
+    }
+    freeMessage(reply);
+    return G_SOURCE_REMOVE;
+}
+
+// Let the machine run on if the debugger goes away while it is halted.
+static void closeDebugger(void)
+{
+    g_async_queue_push(RequestQueue,newMessage(debuggerChannel,g_strdup("continue")));
+    g_io_channel_shutdown(debuggerChannel,FALSE,NULL);
+    g_io_channel_unref(debuggerChannel);
+    debuggerChannel = NULL;
+    g_info("Disconnect from debugger\n");
+}
+
+// Split what has arrived into lines and queue them for the emulation thread.
+static gboolean process_command(GIOChannel *source,
+				__attribute__((unused))GIOCondition condition,
+				__attribute__((unused))gpointer data)
+{
+    gchar buffer[4096];
+    gchar *newline;
+    gsize length;
+    GIOStatus status;
+
+    if(source != debuggerChannel) return FALSE;
+
+    status = g_io_channel_read_chars(source,buffer,sizeof(buffer),&length,NULL);
+    if((status != G_IO_STATUS_NORMAL) && (status != G_IO_STATUS_AGAIN))
+    {
+	closeDebugger();
+	return FALSE;
+    }
+
+    g_string_append_len(lineBuffer,buffer,(gssize) length);
+    while((newline = memchr(lineBuffer->str,'\n',lineBuffer->len)) != NULL)
+    {
+	gsize lineLength = (gsize) (newline - lineBuffer->str);
+
+	g_async_queue_push(RequestQueue,
+			   newMessage(source,g_strndup(lineBuffer->str,lineLength)));
+	g_string_erase(lineBuffer,0,(gssize) (lineLength + 1));
+    }
+    return TRUE;
+}
+
+// Only one debugger at a time, a new connection replaces the old one.
+static gboolean
+accept_debugger(GIOChannel *source,
+		__attribute__((unused))GIOCondition condition,
+		__attribute__((unused))gpointer data)
+{
+    struct sockaddr_in from;
+    socklen_t fromlen;
+    int debugger_socket;
+
+    fromlen = sizeof(from);
+    debugger_socket = accept(g_io_channel_unix_get_fd(source),(struct sockaddr *) &from,&fromlen);
+    if(debugger_socket >= 0)
+    {
+	if(debuggerChannel != NULL) closeDebugger();
+
+	debuggerChannel = g_io_channel_unix_new(debugger_socket);
+	g_io_channel_set_close_on_unref(debuggerChannel,TRUE);
+	g_io_channel_set_encoding(debuggerChannel,NULL,NULL);
+	g_io_channel_set_buffered(debuggerChannel,FALSE);
+	g_string_truncate(lineBuffer,0);
+
+	g_io_add_watch(debuggerChannel,G_IO_IN | G_IO_HUP | G_IO_ERR,process_command,NULL);
+	g_info("Debugger connected\n");
+    }
+    return TRUE;
+}
+
+/* Listen for a debugger on localhost.  Only connections from this
+   machine are accepted as the debugger can change anything. */
+gboolean DebuggerInit(int port)
+{
+    struct sockaddr_in name;
+    int listen_socket;
+    int reuseaddr;
+
+    listen_socket = socket(AF_INET, SOCK_STREAM, 0);
+    if(listen_socket < 0)
+    {
+	g_warning("opening TCP socket for debugger connections\n");
+	return FALSE;
+    }
+
+    reuseaddr = 1;
+    if(setsockopt(listen_socket,SOL_SOCKET,SO_REUSEADDR,&reuseaddr,sizeof(reuseaddr)) == -1)
+    {
+	g_warning("setsockopt FAILED\n");
+    }
+
+    memset(&name,0,sizeof(name));
+    name.sin_family = AF_INET;
+    name.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    name.sin_port = htons((uint16_t) port);
+    if(bind(listen_socket,(struct sockaddr *) &name,sizeof(name)))
+    {
+	g_warning("binding debugger TCP socket to port %d failed\n",port);
+	close(listen_socket);
+	return FALSE;
+    }
+    if(listen(listen_socket,1) == -1)
+    {
+	g_warning("listening on debugger TCP socket port %d failed\n",port);
+	close(listen_socket);
+	return FALSE;
+    }
+    g_info("Listening for a debugger on localhost port #%d\n",port);
+
+    RequestQueue = g_async_queue_new_full((GDestroyNotify) freeMessage);
+    lineBuffer = g_string_new(NULL);
+
+    // Only watched once it is listening
+    listeningChannel = g_io_channel_unix_new(listen_socket);
+    g_io_add_watch(listeningChannel,G_IO_IN,accept_debugger,NULL);
+
+    return TRUE;
+}
+
+/************************** Emulation thread *****************************/
+
+static void reply(GIOChannel *channel,gchar *text)
+{
+    if(channel != NULL)
+    {
+	g_idle_add(sendReply,newMessage(channel,text));
+    }
+    else
+    {
+	g_free(text);
+    }
+}
+
+static void showRegisters(GString *text,E803Machine *cpu)
+{
+    g_string_append_printf(text,"ACC=%013" PRIo64 " AR=%013" PRIo64 " SCR=%d%s IR=%07" PRIo32
+			   " B=%d M=%d OFLOW=%d S=%d R=%d L=%d WORDTIME=%" PRId64,
+			   (uint64_t) (cpu->ACC & WORD_MASK),(uint64_t) (cpu->AR & WORD_MASK),
+			   (cpu->SCR >> 1) & 8191,(cpu->SCR & 1) ? "+" : "",
+			   (uint32_t) cpu->IR & 0x7FFFF,
+			   cpu->B,cpu->M,cpu->OFLOW,cpu->S,cpu->R,cpu->L,
+			   cpu->CPU_word_time_count);
+}
+
+static gboolean parseNumber(const gchar *word,gint64 *value)
+{
+    gchar *end;
+
+    *value = g_ascii_strtoll(word,&end,0);
+    return (end != word) && (*end == '\0');
+}
+
+// How many of something, defaulting to 1.
+static gboolean parseCount(gchar **words,int count,int n,gint64 *value)
+{
+    *value = 1;
+    if(n >= count) return TRUE;
+    return parseNumber(words[n],value) && (*value > 0);
+}
+
+/* Emulate without making any sound, otherwise a long step while halted
+   would overfill the buffer of samples for the next period. */
+static void quietEmulate(E803Machine *cpu,int wordTimes)
+{
+    struct _e803CpuSound *sound;
+
+    sound = cpu->sound;
+    cpu->sound = NULL;
+    Emulate(cpu,wordTimes);
+    cpu->sound = sound;
+}
+
+/* Run until R comes back, which is the fetch of the next instruction.
+   A stopped machine or a jump only takes one word time.  FALSE if the
+   instruction is still waiting for a peripheral after STEPI_LIMIT word
+   times. */
+static gboolean stepInstruction(E803Machine *cpu)
+{
+    int limit = STEPI_LIMIT;
+
+    do
+    {
+	quietEmulate(cpu,1);
+    } while(!cpu->R && (--limit > 0));
+    return cpu->R ? TRUE : FALSE;
+}
+
+static gboolean setRegister(E803Machine *cpu,const gchar *name,const gchar *value)
+{
+    gint64 number;
+    gchar *end;
+
+    if(g_ascii_strcasecmp(name,"SCR") == 0)
+    {
+	// An address, with a + for the second instruction
+	number = g_ascii_strtoll(value,&end,0);
+	if((end == value) || (number < 0) || (number > 8191)) return FALSE;
+	if(*end == '+')
+	{
+	    number = number * 2 + 1;
+	    end += 1;
+	}
+	else
+	{
+	    number = number * 2;
+	}
+	if(*end != '\0') return FALSE;
+	cpu->SCR = (int32_t) number;
+	return TRUE;
+    }
+
+    if(!parseNumber(value,&number)) return FALSE;
+
+    if(g_ascii_strcasecmp(name,"ACC") == 0)
+	cpu->ACC = (E803word) number & WORD_MASK;
+    else if(g_ascii_strcasecmp(name,"AR") == 0)
+	cpu->AR = (E803word) number & WORD_MASK;
+    else if(g_ascii_strcasecmp(name,"IR") == 0)
+	cpu->IR = (int32_t) (number & 0x7FFFF);
+    else if(g_ascii_strcasecmp(name,"B") == 0)
+	cpu->B = (number != 0);
+    else if(g_ascii_strcasecmp(name,"M") == 0)
+	cpu->M = (number != 0);
+    else if(g_ascii_strcasecmp(name,"OFLOW") == 0)
+	cpu->OFLOW = (number != 0);
+    else if(g_ascii_strcasecmp(name,"S") == 0)
+	cpu->S = (number != 0);
+    else
+	return FALSE;
+    return TRUE;
+}
+
+// Go back for rstep, rstepi and rcontinue.
+static void reverse(GString *text,E803Machine *cpu,gchar **words,int count)
+{
+    gint64 number;
+    gboolean ok;
+
+    if(cpu->Rewind == NULL)
+    {
+	g_string_append(text,"error rewind is not enabled");
+	return;
+    }
+
+    if(strcmp(words[0],"rstep") == 0)
+    {
+	if(!parseCount(words,count,1,&number) || (number > G_MAXINT))
+	{
+	    g_string_append(text,"error rstep [WORDTIMES]");
+	    return;
+	}
+	ok = RewindWordTimes(cpu->Rewind,cpu,(int) number);
+    }
+    else if(strcmp(words[0],"rstepi") == 0)
+    {
+	if(!parseCount(words,count,1,&number) || (number > G_MAXINT))
+	{
+	    g_string_append(text,"error rstepi [INSTRUCTIONS]");
+	    return;
+	}
+	ok = RewindInstructions(cpu->Rewind,cpu,(int) number);
+    }
+    else
+    {
+	ok = RewindToBreakpoint(cpu->Rewind,cpu);
+    }
+
+    Halted = TRUE;
+    BreakpointStop = FALSE;
+
+    g_string_append(text,ok ? "ok " : "error no more history ");
+    showRegisters(text,cpu);
+}
+
+// Obey one command, returning the text to send back.
+static gchar *obey(E803Machine *cpu,gchar *line)
+{
+    GString *text;
+    gchar **words;
+    int count;
+    gint64 address,number;
+    E803Breakpoint *bp;
+
+    text = g_string_new(NULL);
+    words = g_strsplit_set(g_strstrip(line)," \t",-1);
+
+    // Drop the empty words left by runs of spaces
+    count = 0;
+    for(int n = 0; words[n] != NULL; n++)
+    {
+	if(words[n][0] != '\0')
+	    words[count++] = words[n];
+	else
+	    g_free(words[n]);
+    }
+    words[count] = NULL;
+
+    if(count == 0)
+    {
+	g_string_append(text,"error no command");
+    }
+    else if(strcmp(words[0],"halt") == 0)
+    {
+	Halted = TRUE;
+	g_string_append(text,"ok ");
+	showRegisters(text,cpu);
+    }
+    else if(strcmp(words[0],"continue") == 0)
+    {
+	if(BreakpointStop)
+	{
+	    // Carry on from a breakpoint the way the operator would
+	    if(cpu->Breakpoints != NULL) cpu->Breakpoints->lastHit = NULL;
+	    if(cpu->S) cpu->SS25 = true;
+	    BreakpointStop = FALSE;
+	}
+	Halted = FALSE;
+	g_string_append(text,"ok");
+    }
+    else if(strcmp(words[0],"step") == 0)
+    {
+	if(!parseCount(words,count,1,&number) || (number > G_MAXINT))
+	{
+	    g_string_append(text,"error step [WORDTIMES]");
+	}
+	else
+	{
+	    Halted = TRUE;
+	    quietEmulate(cpu,(int) number);
+	    g_string_append(text,"ok ");
+	    showRegisters(text,cpu);
+	}
+    }
+    else if(strcmp(words[0],"stepi") == 0)
+    {
+	if(!parseCount(words,count,1,&number))
+	{
+	    g_string_append(text,"error stepi [INSTRUCTIONS]");
+	}
+	else
+	{
+	    gboolean finished = TRUE;
+
+	    Halted = TRUE;
+	    while(finished && (number-- > 0))
+	    {
+		finished = stepInstruction(cpu);
+	    }
+	    g_string_append(text,finished ? "ok " : "error still busy ");
+	    showRegisters(text,cpu);
+	}
+    }
+    else if(strcmp(words[0],"regs") == 0)
+    {
+	g_string_append(text,"ok ");
+	showRegisters(text,cpu);
+    }
+    else if(strcmp(words[0],"set") == 0)
+    {
+	if((count == 3) && setRegister(cpu,words[1],words[2]))
+	{
+	    if(cpu->Rewind != NULL) rewindBarrier(cpu->Rewind,cpu);
+	    g_string_append(text,"ok");
+	}
+	else
+	    g_string_append(text,"error set ACC|AR|SCR|IR|B|M|OFLOW|S VALUE");
+    }
+    else if(strcmp(words[0],"read") == 0)
+    {
+	if((count != 3) || !parseNumber(words[1],&address) || !parseNumber(words[2],&number) ||
+	   (address < 0) || (number < 0) || ((address + number) > 8192))
+	{
+	    g_string_append(text,"error read ADDR COUNT");
+	}
+	else
+	{
+	    g_string_append(text,"ok");
+	    for(gint64 n = 0; n < number; n++)
+	    {
+		g_string_append_printf(text," %013" PRIo64,
+				       (uint64_t) (cpu->CoreStore[address + n] & WORD_MASK));
+	    }
+	}
+    }
+    else if(strcmp(words[0],"write") == 0)
+    {
+	gboolean ok;
+
+	ok = (count >= 2) && parseNumber(words[1],&address) &&
+	    (address >= 0) && ((address + count - 2) <= 8192);
+	for(int n = 2; ok && (n < count); n++)
+	{
+	    ok = parseNumber(words[n],&number);
+	}
+	if(!ok)
+	{
+	    g_string_append(text,"error write ADDR WORD ...");
+	}
+	else
+	{
+	    for(int n = 2; n < count; n++)
+	    {
+		parseNumber(words[n],&number);
+		cpu->CoreStore[address + n - 2] = (E803word) number & WORD_MASK;
+	    }
+	    // The threaded engine has to decode them again
+	    flushDecodedStore(cpu);
+	    if(cpu->Rewind != NULL) rewindBarrier(cpu->Rewind,cpu);
+	    g_string_append_printf(text,"ok %d",count - 2);
+	}
+    }
+    else if((strcmp(words[0],"break") == 0) || (strcmp(words[0],"watch") == 0))
+    {
+	if(cpu->Breakpoints == NULL)
+	{
+	    cpu->Breakpoints = BreakpointsNew();
+	}
+	const gchar *args[count + 1];
+
+	for(int n = 0; n <= count; n++)
+	    args[n] = words[n];
+	bp = BreakpointParse(cpu->Breakpoints,args,count);
+	if(bp == NULL)
+	    g_string_append(text,"error break ADDR[+] | watch read|write|access ADDR"
+			    " [if acc|store ==|!=|<|> VALUE] [after N]");
+	else
+	    g_string_append_printf(text,"ok %d",bp->number);
+    }
+    else if(strcmp(words[0],"delete") == 0)
+    {
+	if((count == 2) && parseNumber(words[1],&number) && (cpu->Breakpoints != NULL) &&
+	   BreakpointDelete(cpu->Breakpoints,(int) number))
+	    g_string_append(text,"ok");
+	else
+	    g_string_append(text,"error no such breakpoint");
+    }
+    else if(strcmp(words[0],"breakpoints") == 0)
+    {
+	if(cpu->Breakpoints != NULL)
+	{
+	    for(GSList *list = cpu->Breakpoints->points; list != NULL; list = g_slist_next(list))
+	    {
+		gchar *description = BreakpointDescribe((E803Breakpoint *) list->data);
+
+		g_string_append_printf(text,"%s\n",description);
+		g_free(description);
+	    }
+	}
+	g_string_append(text,"ok");
+    }
+    else if(strcmp(words[0],"status") == 0)
+    {
+	g_string_append(text,Halted ? "ok halted" : "ok running");
+    }
+    else if((strcmp(words[0],"rstep") == 0) || (strcmp(words[0],"rstepi") == 0) ||
+	    (strcmp(words[0],"rcontinue") == 0))
+    {
+	reverse(text,cpu,words,count);
+    }
+    else if(strcmp(words[0],"history") == 0)
+    {
+	if(cpu->Rewind == NULL)
+	    g_string_append(text,"error rewind is not enabled");
+	else
+	    g_string_append_printf(text,"ok %" PRId64 " %" PRId64,RewindOldest(cpu->Rewind),RewindNow(cpu));
+    }
+    else
+    {
+	g_string_append_printf(text,"error unknown command %s",words[0]);
+    }
+
+    g_strfreev(words);
+    g_string_append_c(text,'\n');
+    return g_string_free(text,FALSE);
+}
+
+/* Notice when a breakpoint has stopped the machine, so that continue
+   knows to press operate.  If it was running the debugger is told. */
+static void checkBreakpoint(E803Machine *cpu)
+{
+    GString *text;
+
+    if(BreakpointStop || !cpu->S || (cpu->Breakpoints == NULL) ||
+       (cpu->Breakpoints->lastHit == NULL))
+	return;
+
+    BreakpointStop = TRUE;
+    if(!Halted)
+    {
+	Halted = TRUE;
+	text = g_string_new(NULL);
+	g_string_append_printf(text,"event breakpoint %d ",cpu->Breakpoints->lastHit->number);
+	showRegisters(text,cpu);
+	g_string_append_c(text,'\n');
+	reply(eventChannel,g_string_free(text,FALSE));
+    }
+}
+
+/* Called by the emulation thread before each call to Emulate.  Obeys
+   anything the debugger has sent and returns TRUE if the machine is
+   halted, in which case Emulate must not be called. */
+gboolean DebuggerService(E803Machine *cpu)
+{
+    DebugMessage *request;
+
+    if(RequestQueue == NULL) return FALSE;
+
+    checkBreakpoint(cpu);
+
+    while((request = g_async_queue_try_pop(RequestQueue)) != NULL)
+    {
+	// Events go to whoever sent the last command
+	if(eventChannel != request->channel)
+	{
+	    if(eventChannel != NULL) g_io_channel_unref(eventChannel);
+	    eventChannel = g_io_channel_ref(request->channel);
+	}
+	reply(request->channel,obey(cpu,request->text));
+	freeMessage(request);
+	checkBreakpoint(cpu);
+    }
+
+    return Halted;
+}
@@ -0,0 +1,19 @@
+/*  This file is part of the Elliott 803 emulator.
+
+    Copyright © 2020  Peter Onion
+
+    See LICENCE file. 
+*/
+
+#pragma once
+/* Remote debugger.  A debugger connects to a TCP port on localhost and
+   sends one command per line.  The socket is handled by the GTK main
+   loop alongside the PLTS listener, the commands are obeyed by the
+   emulation thread between calls to Emulate, so neither ever waits for
+   the other. */
+
+#include <glib.h>
+#include "Emulate.h"
+
+gboolean DebuggerInit(int port);
+gboolean DebuggerService(E803Machine *cpu);
@@ -12,6 +12,8 @@
 #include <inttypes.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
 #include <glib.h>
 #include "E803-types.h"
 #include "E803ops.h"
@@ -19,112 +21,66 @@
 #include "wg-definitions.h"
 #include "Wiring.h"
 #include "Common.h"
-#include "Sound.h"
-
-#define TRACE 0
-
-// Defined in Cpu.c
-extern unsigned int WG_ControlButtons;    // State of the buttons like Reset etc 
-extern bool WG_operate_pressed;
-
-/* Various 803 registers */
-E803word ACC;           // The Accumulator
-E803word AR;            // Auxillary register used in double length working
-E803word MREG;          // Multipler
-E803word STORE_CHAIN;   // Data read from and written back into store
-E803word WG;            // value on the Word Generator buttons
-E803word QACC,QAR;      // Q register for double length multiply  
-E803word MANTREG;       // Mantissa and Exponents in fp maths 
-int T;                  // Number of places to shift in Gp 5 
-int EXPREG;
-
-/* Short values */
-int32_t BREG;       // For B modification 
-int32_t IR;         // Instruction register 
-int32_t SCR;        // Sequence Control Register 
-int32_t STORE_MS;   // Top half on store chain 
-int32_t STORE_LS;   // Bottom half on store chain 
+#include "Profile.h"
+#include "Trace.h"
+#include "Breakpoints.h"
+#include "Rewind.h"
+#include "Scheduler.h"
+#include "CpuSound.h"
+#include "Panel.h"
+#include "Snapshot.h"
+
+#ifndef DECODE_CACHE
+#define DECODE_CACHE 1       // 803-bench-fetch is built with it off
+#endif
+#ifndef BULK_LONG_FUNCTIONS
+#define BULK_LONG_FUNCTIONS 1  // 803-longtest-wordtimes is built with it off
+#endif
+#if BULK_LONG_FUNCTIONS
+#define BULK_CHECK 0
+#endif
+
+// Buttons that change what happens at the start of an instruction
+#define WG_SLOW_BUTTONS (WG_read | WG_obey | WG_reset | WG_clear_store | WG_selected_stop)
 
 /* Some 803 constants */
 E803word E803_ONE  = 1;
 E803word E803_ZERO = 0;
 E803word E803_AR_MSB= 02000000000000; // Rounding bit for Fn 53 
 
+/* The one machine on the wiring bus.  The peripherals on the bus (PTS.c)
+   and the sound and 100Hz timer (Sound.c) keep their state in statics
+   and only ever work for this machine. */
+static E803Machine GuiMachine;
+E803Machine *WiredMachine = &GuiMachine;
 
-/* Various 803 internal sisnals */
-bool S;
-bool SS25;
-bool WI;         // Something to do with manual data
-bool SS2,SS3;    // Timing for operate to clear busy on Fn70
-bool R;          //  Beat counter (R=Fetch,!R=Execute)
-bool FPO;        // Gp6 / floating point overflow 
-bool OFLOW;      // Integer overflow flag
-bool PARITY;
-bool L;          // Long function, prolongs R-bar (execute) phase
-bool LW;         // Last word time in some long functions */
-bool B;          // Busy
-bool M;          // B Modifier flag
-bool N;          // Read Button
-bool ALWAYS = true;   /* used for conditional jump decoding */
-bool NEGA,Z;
-bool GPFOUR;     // surpresses execute phase for jumps 
-bool TC;         // Transfer Contol for jumps
-bool J;          // Interrrupt request (unused) 
-
-
-bool *Conditions[] = {&ALWAYS,&NEGA,&Z,&OFLOW};
-
-
-/* Emulation variables */
-int32_t IR_saved;
-
-/* working space */
-E803word tmp;
-
-bool *DM160s_bits[] = {&PARITY,&L,&B,&FPO,&S,&OFLOW};
-int DM160s_bright[7];
-bool CpuRunning = false;
-
-int PTSBusyBright;
-
-int16_t CPUVolume = 0x100;
+void fn00(E803Machine *cpu); void fn01(E803Machine *cpu); void fn02(E803Machine *cpu); void fn03(E803Machine *cpu);
+void fn04(E803Machine *cpu); void fn05(E803Machine *cpu); void fn06(E803Machine *cpu); void fn07(E803Machine *cpu);
 
+void fn10(E803Machine *cpu); void fn11(E803Machine *cpu); void fn12(E803Machine *cpu); void fn13(E803Machine *cpu);
+void fn14(E803Machine *cpu); void fn15(E803Machine *cpu); void fn16(E803Machine *cpu); void fn17(E803Machine *cpu);
 
-/* The next two run since the emulator was started */
-int CPU_word_time_count = 0;
-unsigned int CPU_word_time_stop = 1;
-/* The next one refers to the current emulation cycle */
-unsigned int word_times_done =  0;
+void fn20(E803Machine *cpu); void fn21(E803Machine *cpu); void fn22(E803Machine *cpu); void fn23(E803Machine *cpu);
+void fn24(E803Machine *cpu); void fn25(E803Machine *cpu); void fn26(E803Machine *cpu); void fn27(E803Machine *cpu);
 
-E803word *CoreStore = NULL; 
+void fn30(E803Machine *cpu); void fn31(E803Machine *cpu); void fn32(E803Machine *cpu); void fn33(E803Machine *cpu);
+void fn34(E803Machine *cpu); void fn35(E803Machine *cpu); void fn36(E803Machine *cpu); void fn37(E803Machine *cpu);
 
-void fn00(void); void fn01(void); void fn02(void); void fn03(void);
-void fn04(void); void fn05(void); void fn06(void); void fn07(void);
+void fn40(E803Machine *cpu); void fn41(E803Machine *cpu); void fn42(E803Machine *cpu); void fn43(E803Machine *cpu);
+void fn44(E803Machine *cpu); void fn45(E803Machine *cpu); void fn46(E803Machine *cpu); void fn47(E803Machine *cpu);
 
-void fn10(void); void fn11(void); void fn12(void); void fn13(void);
-void fn14(void); void fn15(void); void fn16(void); void fn17(void);
+void fn50(E803Machine *cpu); void fn51(E803Machine *cpu); void fn52(E803Machine *cpu); void fn53(E803Machine *cpu);
+void fn54(E803Machine *cpu); void fn55(E803Machine *cpu); void fn56(E803Machine *cpu); void fn57(E803Machine *cpu);
 
-void fn20(void); void fn21(void); void fn22(void); void fn23(void);
-void fn24(void); void fn25(void); void fn26(void); void fn27(void);
+void fn60(E803Machine *cpu); void fn61(E803Machine *cpu); void fn62(E803Machine *cpu); void fn63(E803Machine *cpu);
+void fn64(E803Machine *cpu); void fn65(E803Machine *cpu); void fn66(E803Machine *cpu); void fn67(E803Machine *cpu);
 
-void fn30(void); void fn31(void); void fn32(void); void fn33(void);
-void fn34(void); void fn35(void); void fn36(void); void fn37(void);
-
-void fn40(void); void fn41(void); void fn42(void); void fn43(void);
-void fn44(void); void fn45(void); void fn46(void); void fn47(void);
-
-void fn50(void); void fn51(void); void fn52(void); void fn53(void);
-void fn54(void); void fn55(void); void fn56(void); void fn57(void);
-
-void fn60(void); void fn61(void); void fn62(void); void fn63(void);
-void fn64(void); void fn65(void); void fn66(void); void fn67(void);
-
-void fn70(void); void fn71(void); void fn72(void); void fn73(void);
-void fn74(void); void fn75(void); void fn76(void); void fn77(void);
+void fn70(E803Machine *cpu); void fn71(E803Machine *cpu); void fn72(E803Machine *cpu); void fn73(E803Machine *cpu);
+void fn74(E803Machine *cpu); void fn75(E803Machine *cpu); void fn76(E803Machine *cpu); void fn77(E803Machine *cpu);
 
 
 /** Jump table for 803 op codes */
-void (*functions[])(void) =
+void (*functions[])(E803Machine *cpu) =
 { fn00,fn01,fn02,fn03,fn04,fn05,fn06,fn07,
   fn10,fn11,fn12,fn13,fn14,fn15,fn16,fn17,
   fn20,fn21,fn22,fn23,fn24,fn25,fn26,fn27,
@@ -135,8 +91,91 @@ void (*functions[])(void) =
   fn70,fn71,fn72,fn73,fn74,fn75,fn76,fn77};
 
 
+#if DECODE_CACHE
+/* Pre-decoded shadow of the core store for the fetch phase.  Each
+   entry holds both halves of a word as they are loaded into the IR,
+   with the function code and handler already extracted.  Entries are
+   built on first fetch and invalidated whenever the word is written. */
+typedef struct _decodedWord
+{
+    bool valid;
+    bool bMod;                  // B modifier bit
+    int fn[2];                  // Function codes for F1 and F2
+    int32_t half[2];            // F1 N1 and B F2 N2 as loaded into IR
+    void (*handler[2])(E803Machine *cpu);   // Handlers for F1 and F2
+    struct _chain *chain[2];    // Threaded code starting at F1 and F2, or NULL
+    uint64_t chained;           // cpu->ChainEpoch when last put in a chain
+} DecodedWord;
+
+static DecodedWord *FetchDecoded(E803Machine *cpu,int32_t address)
+{
+    DecodedWord *decoded;
+    E803word word;
+
+    address &= 8191;
+    decoded = &cpu->DecodedStore[address];
+
+    if(!decoded->valid)
+    {
+	word = cpu->CoreStore[address];
+	decoded->half[1] = (int32_t) (word & 0xFFFFF);
+	decoded->half[0] = (int32_t) ((word >> 20) & 0xFFFFF);
+	decoded->bMod = (decoded->half[1] & 0x80000) ? true : false;
+	for(int n = 0; n < 2; n++)
+	{
+	    decoded->fn[n] = (decoded->half[n] >> 13) & 077;
+	    decoded->handler[n] = functions[decoded->fn[n]];
+	}
+	decoded->valid = true;
+    }
+    return decoded;
+}
+
+// Must be called after anything outside Emulate() changes the store.
+void flushDecodedStore(E803Machine *cpu)
+{
+    for(int n = 0; n < 8192; n++)
+    {
+	cpu->DecodedStore[n].valid = false;
+    }
+    cpu->ChainEpoch += 1;
+    if(cpu->Rewind != NULL)
+    {
+	memset(cpu->Rewind->dirty,0xFF,sizeof(cpu->Rewind->dirty));
+    }
+}
+
+static inline void writeStore(E803Machine *cpu,int address,E803word word)
+{
+    if(cpu->CoreStore[address] != word)
+    {
+	cpu->CoreStore[address] = word;
+	cpu->DecodedStore[address].valid = false;
+	// Every chain goes if this word is in one
+	if(cpu->DecodedStore[address].chained == cpu->ChainEpoch) cpu->ChainEpoch += 1;
+	if(cpu->Rewind != NULL) rewindDirty(cpu->Rewind,address);
+    }
+}
+#else
+static inline void writeStore(E803Machine *cpu,int address,E803word word)
+{
+    cpu->CoreStore[address] = word;
+    if(cpu->Rewind != NULL) rewindDirty(cpu->Rewind,address);
+}
+
+void flushDecodedStore(E803Machine *cpu)
+{
+    if(cpu->Rewind != NULL)
+    {
+	memset(cpu->Rewind->dirty,0xFF,sizeof(cpu->Rewind->dirty));
+    }
+}
+#endif
+
+#if !DECODE_CACHE
 // New version 4/11/19
-static void FetchStore(int32_t address,
+static void FetchStore(E803Machine *cpu,
+			       int32_t address,
 		       int32_t *MSp, 
 		       int32_t *LSp, 
 		       E803word *STORE_READ)
@@ -144,7 +183,7 @@ static void FetchStore(int32_t address,
     E803word readWord;
     
     address &= 8191;
-    readWord = CoreStore[address];
+    readWord = cpu->CoreStore[address];
   
     *STORE_READ = readWord;
     
@@ -154,719 +193,1495 @@ static void FetchStore(int32_t address,
     
     *MSp = readWord &  0xFFFFF; /* Top 20 bits */
 }
+#endif
 
 
 void setCPUVolume(unsigned int level)
 {
-    CPUVolume = (int16_t) level;
+    WiredMachine->CPUVolume = (int16_t) level;
+}
+
+static void noWires(__attribute__((unused)) E803Machine *cpu,
+		    __attribute__((unused)) enum WiringEvent event,
+		    __attribute__((unused)) unsigned int value)
+{
+}
+
+static inline void cpuSound(E803Machine *cpu,int16_t first,int16_t remainder,int wordTimes)
+{
+    if(cpu->sound != NULL)
+    {
+	cpuSoundRecord(cpu->sound,first,remainder,wordTimes);
+    }
+}
+
+static bool jumpCondition(E803Machine *cpu,int fn)
+{
+    switch(fn & 3)
+    {
+	case 0:  return true;
+	case 1:  return cpu->NEGA;
+	case 2:  return cpu->Z;
+	default: return cpu->OFLOW;
+    }
 }
 
 // Called before emulate to handle button presses etc.
-void PreEmulate(bool updateFlag)
+void PreEmulate(E803Machine *cpu,bool updateFlag)
 {
     // Check if the machine is on 
-    if(CpuRunning)
+    if(cpu->CpuRunning)
     {
-	if(WG_operate_pressed)
+	if(cpu->WG_operate_pressed)
 	{
 	    //printf("Operate Bar pressed\n");
-	    if(S) SS25 = true;
-	    if(WI && !R) SS3 = true; /* 17/4/06 added !R */
+	    if(cpu->S) cpu->SS25 = true;
+	    if(cpu->WI && !cpu->R) cpu->SS3 = true; /* 17/4/06 added !R */
 	}
 
-	if(SS25) PARITY = FPO = false;
+	if(cpu->SS25) cpu->PARITY = cpu->FPO = false;
     }
 
     if(updateFlag)
     {
 	for(int n=0; n<7; n+=1)
 	{
-	    DM160s_bright[n] = 0;
+	    cpu->DM160s_bright[n] = 0;
 	}
     }
     
-    PTSBusyBright = 0;
-    word_times_done = 0;
+    cpu->PTSBusyBright = 0;
 }
 
 
-void PostEmulate(bool updateFlag)
+void PostEmulate(E803Machine *cpu,bool updateFlag)
 {
-    LampsEvent *le;
-    
     if(updateFlag)
     {
-	for(unsigned int n = 0; n < 7; n++)
+	PanelDM160s(cpu->DM160s_bright);
+    }
+}
+
+static inline void countLamps(E803Machine *cpu,int wordTimes)
+{
+    cpu->DM160s_bright[6] += wordTimes;  // Use for a maximum value
+
+    // If the signal is up, increase the brightness
+    if(cpu->PARITY) cpu->DM160s_bright[0] += wordTimes;
+    if(cpu->L)      cpu->DM160s_bright[1] += wordTimes;
+    if(cpu->B)      cpu->DM160s_bright[2] += wordTimes;
+    if(cpu->FPO)    cpu->DM160s_bright[3] += wordTimes;
+    if(cpu->S)      cpu->DM160s_bright[4] += wordTimes;
+    if(cpu->OFLOW)  cpu->DM160s_bright[5] += wordTimes;
+}
+
+/* Credit some word times that are exact repeats of the one just done. */
+static void repeatWordTimes(E803Machine *cpu,int wordTimes,int16_t first,int16_t remainder)
+{
+    cpu->CPU_word_time_count += wordTimes;
+    cpuSound(cpu,first,remainder,wordTimes);
+    countLamps(cpu,wordTimes);
+}
+
+/* Called after each word time.  If the machine is off, stopped, sat in a
+   jump to itself, or held waiting for a peripheral or the operator,
+   every word time until something outside the CPU changes is the same
+   as the one just done.  The buttons only change between calls to
+   Emulate(), so skip ahead to when the peripheral said it would be
+   ready or to the end of the batch.  A peripheral that must be asked
+   again every word time, as the reader waiting for tape from the PLTS
+   is in real time, says the next word time.  Nothing is skipped while
+   profiling or tracing, so the loops are counted and traced like any
+   other instructions.  Returns the word times used. */
+static int idleWordTimes(E803Machine *cpu,int wordTimesLeft)
+{
+    int wordTimes;
+    int64_t until;
+    int16_t first,remainder;
+
+    if(wordTimesLeft <= 0) return 0;
+
+    if(!cpu->CpuRunning)
+    {   /* Turned off */
+	cpu->CPU_word_time_count += wordTimesLeft;
+	cpuSound(cpu,0x0000,0x0000,wordTimesLeft);
+	cpu->Idle = true;
+	return wordTimesLeft;
+    }
+
+    wordTimes = wordTimesLeft;
+    if(cpu->R)
+    {
+	if(cpu->S)
+	{   /* Stopped */
+	    if(cpu->SS25 || cpu->N || (cpu->OFLOW && (cpu->WG_ControlButtons & WG_reset))) return 0;
+	    first = remainder = 0x0000;
+	}
+	else
+	{   /* Jump to self */
+	    if((cpu->Profile != NULL) || (cpu->Trace != NULL)) return 0;
+	    if(!cpu->Looping || cpu->SS25 || (cpu->WG_ControlButtons & WG_SLOW_BUTTONS)) return 0;
+	    first = 0x0000;
+	    remainder = cpu->CPUVolume;
+	}
+    }
+    else
+    {   /* Held in the execute phase by a peripheral, fn75/76 or fn77 */
+	if((cpu->Profile != NULL) || (cpu->Trace != NULL)) return 0;
+	if(!(cpu->B || (cpu->L && (cpu->fn == 077)))) return 0;
+	if(cpu->PeripheralEventAt >= 0)
 	{
-	    le = (LampsEvent *) malloc(sizeof(LampsEvent));
-	    le->lampId = n+1; // 1U << n;
-	    le->on = DM160s_bright[n] > 0 ? TRUE : FALSE;
-	    le->brightness = (gfloat) DM160s_bright[n];
-	    
-	    g_async_queue_push(LampsEventQueue,(gpointer) le);
+	    until = cpu->PeripheralEventAt - cpu->CPU_word_time_count - 1;
+	    if(until <= 0) return 0;
+	    if(until < wordTimesLeft) wordTimes = (int) until;
+	}
+	first = remainder = (cpu->fn & 040) ? cpu->CPUVolume : 0x0000;
+    }
+
+    if((wordTimes == wordTimesLeft) && (cpu->PeripheralEventAt < 0)) cpu->Idle = true;
+    repeatWordTimes(cpu,wordTimes,first,remainder);
+    return wordTimes;
+}
+
+#if BULK_LONG_FUNCTIONS
+/* Long functions in one go.  Once the first word time of a shift,
+   multiply or divide has been emulated the rest of the instruction
+   depends only on the registers, so if it will finish within the
+   current batch the final result is formed directly and the word
+   times are credited in one step.  Instructions that straddle the
+   end of a batch are still done one word time at a time.  Setting
+   BULK_CHECK runs the word time code as well and compares the two, and
+   LongTest.c compares whole runs against a build without this. */
+
+// Sign extend the 39 bit number in the bottom of a word
+static inline int64_t signed39(E803word word)
+{
+    return ((int64_t) (word << 25)) >> 25;
+}
+
+// Put back the duplicate sign bit
+static inline E803word canonical(E803word word)
+{
+    return (word & Bits39) | ((word << 1) & BitsSign2);
+}
+
+// ACC:AR arithmetic shift right by several places
+static void doubleShiftRight(E803word *acc,E803word *ar,int places)
+{
+    int64_t hi = signed39(*acc);
+    uint64_t lo = *ar & Bits38;
+
+    if(places < 38)
+    {
+	lo = ((lo >> places) | ((uint64_t) hi << (38 - places))) & Bits38;
+	hi >>= places;
+    }
+    else
+    {
+	lo = (uint64_t) (hi >> (places < 101 ? places - 38 : 63)) & Bits38;
+	hi >>= 63;
+    }
+    *acc = canonical((E803word) hi);
+    *ar = lo;
+}
+
+/* ACC:AR shift left by several places.  Returns the place at which
+   it first overflowed, or zero. */
+static int doubleShiftLeft(E803word *acc,E803word *ar,int places)
+{
+    uint64_t hi = *acc & Bits39;
+    uint64_t lo = *ar & Bits38;
+    uint64_t invert = (hi & BitsSign) ? ~0ULL : 0;
+    uint64_t h = (hi ^ invert) & Bits39;
+    uint64_t l = (lo ^ invert) & Bits38;
+    int same;
+
+    /* Overflow happens when the top two bits differ, so count the
+       leading bits that match the sign.  Zeros are shifted in at the
+       bottom. */
+    if(h != 0)
+	same = __builtin_clzll(h) - 25;
+    else if(l != 0)
+	same = __builtin_clzll(l) + 13;
+    else
+	same = invert ? 77 : places + 1;
+
+    if(places <= 38)
+    {
+	hi = ((hi << places) | (lo >> (38 - places))) & Bits39;
+	lo = (lo << places) & Bits38;
+    }
+    else if(places < 77)
+    {
+	hi = (lo << (places - 38)) & Bits39;
+	lo = 0;
+    }
+    else
+    {
+	hi = lo = 0;
+    }
+    *acc = canonical(hi);
+    *ar = lo;
+
+    return (same <= places) ? same : 0;
+}
+
+// Number of Booth steps left in a multiply that has just started
+static int multiplySteps(E803Machine *cpu)
+{
+    int64_t m = signed39(cpu->MREG >> 1);
+    uint64_t bits = (uint64_t) (m ^ (m >> 63));
+
+    return 1 + ((bits != 0) ? 64 - __builtin_clzll(bits) : 0);
+}
+
+/* The Booth steps add Q times each digit of the multiplier so the
+   product can be formed directly.  Q and the multiplier are both 39
+   bits so it is built from two 64 bit partial products.  Returns true
+   if the last step overflowed (only -1 x -1 can). */
+static bool multiply(E803Machine *cpu,int steps)
+{
+    int64_t q = signed39(cpu->QACC) * (1LL << 38) + (int64_t) cpu->QAR;
+    int64_t m = signed39(cpu->MREG >> 1);
+    int64_t lo = q * (m & 0x7FFFF);
+    int64_t hi = q * (m >> 19);
+
+    lo += (hi & 0x7FFFF) * (1LL << 19);
+    hi = (hi >> 19) + (lo >> 38);
+
+    cpu->ACC = canonical((E803word) hi);
+    cpu->AR = (E803word) lo & Bits38;
+    doubleShiftLeft(&cpu->QACC,&cpu->QAR,steps);
+    cpu->MREG = (m < 0) ? Bits40 : E803_ZERO;
+
+    return (hi < -(1LL << 38)) || (hi >= (1LL << 38));
+}
+
+// The remaining steps of fn56, returns the step that overflowed or zero.
+static int divide(E803Machine *cpu)
+{
+    E803word acc = cpu->ACC, ar = cpu->AR, qacc = cpu->QACC, qar = cpu->QAR;
+    int oflowAt = 0;
+
+    while(cpu->T--)
+    {
+	E803_shift_left(&qacc,&qar);
+	if((acc ^ cpu->M_sign) & 0x8000000000)
+	{
+	    E803_add56(&cpu->MREG,&acc);
+	}
+	else
+	{
+	    E803_sub56(&cpu->MREG,&acc);
+	    if(cpu->T != 39) qacc |= 1;
+	}
+	if((cpu->T == 39) && (((acc ^ cpu->ACC) & 0x8000000000) == 0))
+	{
+	    oflowAt = 1;
 	}
+	E803_shift_left56(&acc,&ar);
     }
+    cpu->QACC = qacc;
+    cpu->QAR = qar;
+    cpu->ACC = qacc;
+    cpu->AR = E803_ZERO;
+
+    return oflowAt;
 }
 
-void Emulate(int wordTimesToEmulate)
+#if BULK_CHECK
+typedef struct _longState
+{
+    E803word ACC,AR,MREG,QACC,QAR;
+    int T;
+    bool L,LW,OFLOW;
+    int oflowAt;
+} LongState;
+
+static void saveLongState(E803Machine *cpu,LongState *state)
 {
-    static int ADDRESS,fn;
+    memset(state,0,sizeof(LongState));
+    state->ACC = cpu->ACC;  state->AR = cpu->AR;  state->MREG = cpu->MREG;
+    state->QACC = cpu->QACC;  state->QAR = cpu->QAR;  state->T = cpu->T;
+    state->L = cpu->L;  state->LW = cpu->LW;  state->OFLOW = cpu->OFLOW;
+    state->oflowAt = 0;
+}
+
+static void restoreLongState(E803Machine *cpu,LongState *state)
+{
+    cpu->ACC = state->ACC;  cpu->AR = state->AR;  cpu->MREG = state->MREG;
+    cpu->QACC = state->QACC;  cpu->QAR = state->QAR;  cpu->T = state->T;
+    cpu->L = state->L;  cpu->LW = state->LW;  cpu->OFLOW = state->OFLOW;
+}
+#endif
+
+/* Called straight after the first word time of a long function.
+   Returns the number of extra word times used. */
+static int bulkLongFunction(E803Machine *cpu,int wordTimesLeft)
+{
+    int wordTimes,oflowAt = 0;
+    bool oflowWas = cpu->OFLOW;
+#if BULK_CHECK
+    LongState before,expected,got;
+#endif
+
+    switch(cpu->fn)
+    {
+	case 050: case 051: case 054: case 055:
+	    wordTimes = cpu->T + 2;
+	    break;
+	case 052:
+	    wordTimes = multiplySteps(cpu);
+	    break;
+	case 053:
+	    wordTimes = multiplySteps(cpu) + 1;
+	    break;
+	case 056:
+	    wordTimes = cpu->T + 1;
+	    break;
+	default:
+	    return 0;
+    }
+
+    if((wordTimes < 2) || (wordTimes > wordTimesLeft) ||
+       (cpu->WG_ControlButtons & (WG_reset | WG_clear_store)))
+    {
+	return 0;
+    }
+
+#if BULK_CHECK
+    saveLongState(cpu,&before);
+    for(int n = 1; n <= wordTimes; n++)
+    {
+	(cpu->handler)(cpu);
+	if(cpu->OFLOW && !oflowWas && (oflowAt == 0)) oflowAt = n;
+    }
+    saveLongState(cpu,&expected);
+    expected.oflowAt = oflowAt;
+    restoreLongState(cpu,&before);
+    oflowAt = 0;
+#endif
+
+    /* The rest of the instruction, all of it counted here as the
+       caller takes wordTimes off its batch.  Only OFLOW can change
+       while L is up. */
+    repeatWordTimes(cpu,wordTimes,cpu->CPUVolume,cpu->CPUVolume);
+
+    switch(cpu->fn)
+    {
+	case 050:
+	    doubleShiftRight(&cpu->ACC,&cpu->AR,cpu->T + 1);
+	    cpu->T = -2;
+	    break;
+	case 051:
+	    cpu->ACC = (cpu->T < 63) ? cpu->ACC >> (cpu->T + 1) : E803_ZERO;
+	    cpu->AR = E803_ZERO;
+	    cpu->T = -2;
+	    break;
+	case 054:
+	    oflowAt = doubleShiftLeft(&cpu->ACC,&cpu->AR,cpu->T + 1);
+	    cpu->T = -2;
+	    break;
+	case 055:
+	    oflowAt = doubleShiftLeft(&cpu->ACC,&cpu->AR,cpu->T + 1);
+	    cpu->AR = E803_ZERO;
+	    cpu->T = -2;
+	    break;
+	case 052:
+	    if(multiply(cpu,wordTimes)) oflowAt = wordTimes;
+	    break;
+	case 053:
+	    if(multiply(cpu,wordTimes - 1)) oflowAt = wordTimes - 1;
+	    if(E803_dadd(&E803_ZERO,&E803_AR_MSB,&cpu->ACC,&cpu->AR) && (oflowAt == 0))
+	    {
+		oflowAt = wordTimes;
+	    }
+	    cpu->AR = E803_ZERO;
+	    break;
+	case 056:
+	    oflowAt = divide(cpu);
+	    break;
+    }
+    cpu->L = cpu->LW = false;
+    if(oflowAt) cpu->OFLOW = true;
+
+    if(oflowAt && !oflowWas)
+    {
+	cpu->DM160s_bright[5] += wordTimes - oflowAt;
+    }
+
+#if BULK_CHECK
+    saveLongState(cpu,&got);
+    got.oflowAt = oflowWas ? 0 : oflowAt;
+    if(memcmp(&got,&expected,sizeof(LongState)) != 0)
+    {
+	g_error("Fn %02o bulk result differs from word time emulation\n",cpu->fn);
+    }
+#endif
+    return wordTimes;
+}
+#endif
+
+// The word time accurate emulation loop.
+static void EmulateWordTimes(E803Machine *cpu,int wordTimesToEmulate)
+{
+#if DECODE_CACHE
+    DecodedWord *decoded;
+    int half = 0;
+#endif
+#if BULK_LONG_FUNCTIONS
+    bool wasLong;
+#endif
+    bool mWas;
+    int32_t scrWas,irWas;
     
     while(wordTimesToEmulate--)
     {
-	CPU_word_time_count += 1;
-	if(CpuRunning)
+	cpu->CPU_word_time_count += 1;
+	if(cpu->CpuRunning)
 	{
 	    /* This is the heart of the emulation.  It fetches instructions and executes them. */
-	    if (R)
+	    if (cpu->R)
 	    { /* fetch */
+#if DECODE_CACHE
+		decoded = NULL;
+#endif
+		scrWas = cpu->SCR;
+		irWas = cpu->IR;
+		mWas = cpu->M;
+		cpu->Looping = false;
 		// 23/2/10 There may be more to do when reset is pressed, but not reseting OFLOW was the
 		// visible clue to the bug!
-		if (WG_ControlButtons & WG_reset)
+		if (cpu->WG_ControlButtons & WG_reset)
 		{
-		    OFLOW = 0;
+		    cpu->OFLOW = 0;
 		}
-		if (!S)
+		if (!cpu->S)
 		{ // Not stopped
-		    if (WG_ControlButtons & WG_clear_store)
+		    if (cpu->WG_ControlButtons & WG_clear_store)
 		    {
-			STORE_CHAIN = E803_ZERO;
-			STORE_LS = STORE_MS = 0;
-			M = 0;
-			if ((ADDRESS = IR & 8191) >= 4)
+			cpu->STORE_CHAIN = E803_ZERO;
+			cpu->STORE_LS = cpu->STORE_MS = 0;
+			cpu->M = 0;
+			if ((cpu->ADDRESS = cpu->IR & 8191) >= 4)
 			{
-			    CoreStore[ADDRESS] = STORE_CHAIN;
+			    writeStore(cpu,cpu->ADDRESS,cpu->STORE_CHAIN);
 			}
 		    }
 		    else
 		    {
-			FetchStore(IR, &STORE_MS, &STORE_LS, &STORE_CHAIN);
-			if (SCR & 1) /* H or D */
+#if DECODE_CACHE
+			decoded = FetchDecoded(cpu,cpu->IR);
+			cpu->STORE_CHAIN = cpu->CoreStore[cpu->IR & 8191];
+			cpu->STORE_MS = decoded->half[0];
+			cpu->STORE_LS = decoded->half[1];
+			half = cpu->SCR & 1;
+#else
+			FetchStore(cpu,cpu->IR, &cpu->STORE_MS, &cpu->STORE_LS, &cpu->STORE_CHAIN);
+#endif
+			if (cpu->SCR & 1) /* H or D */
 			{ /* F2 N2 */
-			    if (M == 0)
+			    if (cpu->M == 0)
 			    { /* No B-mod */
-				IR = STORE_LS;
-				BREG = 0;
+				cpu->IR = cpu->STORE_LS;
+				cpu->BREG = 0;
 			    }
 			    else
 			    { /* B-Mod */
-				IR = STORE_LS + BREG;
-				BREG = 0;
-				M = false;
+				cpu->IR = cpu->STORE_LS + cpu->BREG;
+				cpu->BREG = 0;
+				cpu->M = false;
+#if DECODE_CACHE
+				// Modified so the cached function code can't be used.
+				decoded = NULL;
+#endif
 			    }
 			}
 			else
 			{ /* F1 N1 */
-			    IR = STORE_MS;
-			    BREG = STORE_LS; /* Save for B-mod later */
-			    M = (STORE_LS & 0x80000) ? true : false;
+			    cpu->IR = cpu->STORE_MS;
+			    cpu->BREG = cpu->STORE_LS; /* Save for B-mod later */
+#if DECODE_CACHE
+			    cpu->M = decoded->bMod;
+#else
+			    cpu->M = (cpu->STORE_LS & 0x80000) ? true : false;
+#endif
+			}
+
+			if((cpu->Breakpoints != NULL) && breakpointsHit(cpu->Breakpoints,cpu,scrWas))
+			{
+			    cpu->S = true;
 			}
 		    }
 		}
 
-		IR_saved = IR;
+		cpu->IR_saved = cpu->IR;
 
 		/* Need to check RON to see if S should be set */
-		S |= (WG_ControlButtons & (WG_read | WG_obey | WG_reset)) ? true : false;
+		cpu->S |= (cpu->WG_ControlButtons & (WG_read | WG_obey | WG_reset)) ? true : false;
 
 		/* Selected stop */
-		if(WG_ControlButtons & WG_selected_stop)
+		if(cpu->WG_ControlButtons & WG_selected_stop)
 		{
-		    if((WG & 017777) == ((SCR >> 1) & 017777))
+		    if((cpu->WG & 017777) == ((cpu->SCR >> 1) & 017777))
 		    {
-			S = true;
+			cpu->S = true;
 		    }
 		}
 
 		/* Do a single instruction if operate been pressed */
-		if (SS25 && (WG_ControlButtons & (WG_normal |WG_obey)))
+		if (cpu->SS25 && (cpu->WG_ControlButtons & (WG_normal |WG_obey)))
 		{
-		    SS25 = S = false;
+		    cpu->SS25 = cpu->S = false;
 		}
 
-		if (SS25 && (WG_ControlButtons & WG_read))
+		if (cpu->SS25 && (cpu->WG_ControlButtons & WG_read))
 		{
-		    N = true;
-		    M = false;
-		    SS25 = false;
+		    cpu->N = true;
+		    cpu->M = false;
+		    cpu->SS25 = false;
 		}
 		
-		if (!S)
+		if (!cpu->S)
 		{
-		    fn = (IR >> 13) & 077;
-#if TRACE
-		    if (traceChannel != NULL)
+#if DECODE_CACHE
+		    if(decoded != NULL)
 		    {
-			g_string_truncate(traceText,0);	
-
-			g_string_printf(traceText,"\nSCR= %"PRId32"%c IR = %02o %4"PRId32" \nACC=",
-					(SCR>>1),SCR & 1 ? '+' : ' ', fn,IR & 8191);
-			traceText = dumpWord(traceText,&ACC);
-
-			g_string_append_printf(traceText,"\nAR =");
-			traceText = dumpWord(traceText,&AR);
-
-			g_string_append_printf(traceText,"\nSTR=");
-			traceText= dumpWord(traceText,&CoreStore[IR & 8191]);
-
-			//g_string_append_c(traceText,');
-			g_io_channel_write_chars(traceChannel,traceText->str,-1,NULL,NULL);
-			//printf("%s\n",traceText->str);
+			cpu->fn = decoded->fn[half];
+			cpu->handler = decoded->handler[half];
 		    }
+		    else
 #endif
-		    if ((fn & 070) == 040)
 		    {
-			GPFOUR = true;
+			cpu->fn = (cpu->IR >> 13) & 077;
+			cpu->handler = functions[cpu->fn];
+		    }
+		    if(cpu->Profile != NULL)
+		    {
+			profileFetch(cpu->Profile,cpu->fn,scrWas,cpu->CPU_word_time_count);
+		    }
+		    if(cpu->Trace != NULL)
+		    {
+			traceFetch(cpu->Trace,cpu,scrWas,(scrWas & 1) && mWas);
+		    }
+		    if ((cpu->fn & 070) == 040)
+		    {
+			cpu->GPFOUR = true;
 
-			if (*Conditions[fn & 3]) /* if(TC)  */
+			if (jumpCondition(cpu,cpu->fn)) /* if(TC)  */
 			{
-			    SCR = ((IR & 8191) << 1) + ((fn >> 2) & 1);
-			    M = false;
+			    cpu->SCR = ((cpu->IR & 8191) << 1) + ((cpu->fn >> 2) & 1);
+			    cpu->M = false;
 
-			    if ((fn & 3) == 3)
-				OFLOW = 0; 
-			    TC = true; /* set TC */
+			    if ((cpu->fn & 3) == 3)
+				cpu->OFLOW = 0; 
+			    cpu->TC = true; /* set TC */
+
+			    /* Nothing changes if it jumps to itself, unless it
+			       is a jump on overflow which clears OFLOW */
+			    cpu->Looping = ((cpu->fn & 3) != 3) && (cpu->SCR == scrWas) &&
+				((cpu->SCR >> 1) == irWas) && !mWas && !cpu->SS25;
 			}
 			else
 			{
-			    TC = false;
+			    cpu->TC = false;
 
-			    SCR += 1;
-			    SCR &= 16383;
+			    cpu->SCR += 1;
+			    cpu->SCR &= 16383;
 			}
 
-			IR = SCR >> 1;
+			cpu->IR = cpu->SCR >> 1;
 		    }
 		    else
 		    {
-			GPFOUR = false;
-			R = !R;
+			cpu->GPFOUR = false;
+			cpu->R = !cpu->R;
 		    }
 
-		    if (fn & 040)
+		    if (cpu->fn & 040)
 		    {
-			addSamplesFromCPU(0x0000, CPUVolume);
+			cpuSound(cpu,0x0000,cpu->CPUVolume,1);
 		    }
 		    else
 		    {
-			addSamplesFromCPU(0x0000,0x0000);
+			cpuSound(cpu,0x0000,0x0000,1);
 		    }
 		}
 		else
 		{ /* S == TRUE  --> stopped */
-		    if (N)
+		    if(cpu->Profile != NULL)
+		    {
+			profileStopped(cpu->Profile,cpu->CPU_word_time_count);
+		    }
+		    if (cpu->N)
 		    {
-			IR = (WG >> 20) & 0x7FFFF;
-			N = false;
+			cpu->IR = (cpu->WG >> 20) & 0x7FFFF;
+			cpu->N = false;
 		    }
 
-		    addSamplesFromCPU(0x0000,0x0000);
+		    cpuSound(cpu,0x0000,0x0000,1);
 		}
-		TC = GPFOUR = false;
+		cpu->TC = cpu->GPFOUR = false;
 	    }
 	    else
 	    { /* execute R-bar*/
-		if (fn & 040)
+		if (cpu->fn & 040)
 		{
-		    addSamplesFromCPU( CPUVolume, CPUVolume);
+		    cpuSound(cpu,cpu->CPUVolume,cpu->CPUVolume,1);
 		}
 		else
 		{
-		    addSamplesFromCPU(0x0000,0x0000);
+		    cpuSound(cpu,0x0000,0x0000,1);
 		}
 
-		ADDRESS = IR & 8191;
+		cpu->ADDRESS = cpu->IR & 8191;
 
-		if (ADDRESS >= 4)
+		if (cpu->ADDRESS >= 4)
 		{
-		    STORE_CHAIN = CoreStore[ADDRESS];
+		    cpu->STORE_CHAIN = cpu->CoreStore[cpu->ADDRESS];
 		}
 		else
 		{
-		    STORE_CHAIN = E803_ZERO;
+		    cpu->STORE_CHAIN = E803_ZERO;
 		}
 
 		/* Call the handler for the current instruction */
 
-		(functions[fn])();
+#if BULK_LONG_FUNCTIONS
+		wasLong = cpu->L;
+#endif
+		cpu->PeripheralEventAt = -1;
+		(cpu->handler)(cpu);
+#if BULK_LONG_FUNCTIONS
+		if(cpu->L && !wasLong)
+		{
+		    wordTimesToEmulate -= bulkLongFunction(cpu,wordTimesToEmulate);
+		}
+#endif
 
-		if (ADDRESS >= 4)
+		if (cpu->ADDRESS >= 4)
 		{
-		    CoreStore[ADDRESS] = STORE_CHAIN;
+		    writeStore(cpu,cpu->ADDRESS,cpu->STORE_CHAIN);
 		}
 
-		Z = (ACC & Bits39) ? false : true;
+		cpu->Z = (cpu->ACC & Bits39) ? false : true;
 
-		NEGA = (ACC & BitsSign) ? true : false;
+		cpu->NEGA = (cpu->ACC & BitsSign) ? true : false;
 		
 		/* Added PTSBusy to variables to set cleared by reset
 		   Fri Aug  8 20:20:31 BST 1997*/
 		{
 
-		    if (WG_ControlButtons & (WG_reset | WG_clear_store))
+		    if (cpu->WG_ControlButtons & (WG_reset | WG_clear_store))
 		    {
-			OFLOW = B = L = J = 0; /*= F77State*/
+			cpu->OFLOW = cpu->B = cpu->L = cpu->J = 0; /*= F77State*/
 		    }
 		}
 
-		if ( !(L | B))
+		if ( !(cpu->L | cpu->B))
 		{
-		    R = !R;
+		    cpu->R = !cpu->R;
 
-		    SCR += 1;
-		    SCR &= 16383;
+		    cpu->SCR += 1;
+		    cpu->SCR &= 16383;
 
 		    /* If M is set, don't replace previous address in IR with SCR */
-		    if (!M)
+		    if (!cpu->M)
 		    {
-			IR = SCR >> 1;
+			cpu->IR = cpu->SCR >> 1;
 		    }
 		}
 	    }
 
-	    DM160s_bright[6]+=1;  // Use for a maximum value
-	    for(int n=0;n<6;n++)
+	    countLamps(cpu,1);
+	    wordTimesToEmulate -= idleWordTimes(cpu,wordTimesToEmulate);
+	}
+	else
+	{  // The computer is turned off, but there are still thing to do....
+	    if(cpu->Profile != NULL)
 	    {
-		// If the signal is up, increase the brightness
-		if(*DM160s_bits[n]) DM160s_bright[n]+=1;
+		profileStopped(cpu->Profile,cpu->CPU_word_time_count);
 	    }
+	    cpuSound(cpu,0x0000,0x0000,1);
+	    wordTimesToEmulate -= idleWordTimes(cpu,wordTimesToEmulate);
+	}
+    }
+}
+
+#if DECODE_CACHE
+/* Threaded code execution engine.  A straight run of instructions from
+   groups 0 to 3 is compiled the first time it is reached into a chain
+   of the addresses of the code for each function, kept in the decoded
+   store with the half-word it starts at.  The chain is then obeyed one
+   computed goto after another with nothing looked at between the
+   instructions except a store write that has spoilt it.  None of those
+   functions make a sound, light L or B or stop the machine, so the
+   word time count, sound and lamps for the whole run are added up in
+   one step at the end.  Jumps are done here too, one at a time.
+   Peripheral transfers (group 7), long functions (groups 5 and 6),
+   B-modified instructions and anything the operator, the debugger, the
+   profiler or a trace wants to see go to EmulateWordTimes(). */
+
+#define CHAIN_MAX 32         // Instructions in one chain
+#define LONG_STRETCH 130     // Fetch, first word time and the rest of a 127 place shift
+
+typedef struct _chainStep
+{
+    const void *code;        // Where fn's code is in EmulateThreaded()
+    DecodedWord *decoded;    // The word the instruction is in
+    int half;
+} ChainStep;
+
+typedef struct _chain
+{
+    uint64_t epoch;          // cpu->ChainEpoch when it was compiled
+    int length;
+    ChainStep steps[CHAIN_MAX];
+} Chain;
+
+// Compile the run starting at scr into chain.
+static void compileChain(E803Machine *cpu,Chain *chain,int32_t scr,const void *const *dispatch)
+{
+    DecodedWord *decoded;
+    int32_t address = scr >> 1;
+    int half = scr & 1;
+    int fn;
+
+    chain->epoch = cpu->ChainEpoch;
+    chain->length = 0;
+    while(chain->length < CHAIN_MAX)
+    {
+	decoded = FetchDecoded(cpu,address);
+	decoded->chained = cpu->ChainEpoch;
+	fn = decoded->fn[half];
+	if(fn & 040) break;
+
+	chain->steps[chain->length].code = dispatch[fn];
+	chain->steps[chain->length].decoded = decoded;
+	chain->steps[chain->length].half = half;
+	chain->length += 1;
+
+	// The next F2 is fetched from elsewhere and modified
+	if((half == 0) && decoded->bMod) break;
+
+	half ^= 1;
+	if(half == 0) address = (address + 1) & 8191;
+    }
+}
+
+// The chain starting at scr, compiled again if the store has changed.
+static Chain *chainAt(E803Machine *cpu,int32_t scr,const void *const *dispatch)
+{
+    DecodedWord *decoded = FetchDecoded(cpu,scr >> 1);
+    Chain **chain = &decoded->chain[scr & 1];
+
+    if(*chain == NULL)
+    {
+	*chain = (Chain *) malloc(sizeof(Chain));
+	(*chain)->epoch = 0;
+    }
+    if((*chain)->epoch != cpu->ChainEpoch)
+    {
+	compileChain(cpu,*chain,scr,dispatch);
+    }
+    return *chain;
+}
+
+static void freeChains(E803Machine *cpu)
+{
+    for(int n = 0; n < 8192; n++)
+    {
+	free(cpu->DecodedStore[n].chain[0]);
+	free(cpu->DecodedStore[n].chain[1]);
+    }
+}
+
+#define OP(N) op##N: fn##N(cpu); goto executed;
+
+static void EmulateThreaded(E803Machine *cpu,int wordTimesToEmulate)
+{
+    static const void *dispatch[32] =
+	{ &&op00,&&op01,&&op02,&&op03,&&op04,&&op05,&&op06,&&op07,
+	  &&op10,&&op11,&&op12,&&op13,&&op14,&&op15,&&op16,&&op17,
+	  &&op20,&&op21,&&op22,&&op23,&&op24,&&op25,&&op26,&&op27,
+	  &&op30,&&op31,&&op32,&&op33,&&op34,&&op35,&&op36,&&op37};
+    Chain *chain;
+    const ChainStep *step,*end;
+    DecodedWord *decoded;
+    uint64_t epoch;
+    int half,fn,wordTimes,oflowWordTimes;
+    int32_t scrWas;
+
+    while(wordTimesToEmulate > 0)
+    {
+	if(!cpu->CpuRunning || !cpu->R || cpu->S || cpu->L || cpu->B || cpu->M || cpu->SS25 ||
+	   (cpu->IR != (cpu->SCR >> 1)) || (cpu->WG_ControlButtons & WG_SLOW_BUTTONS) ||
+	   (cpu->Breakpoints != NULL) || (cpu->Profile != NULL) || (cpu->Trace != NULL))
+	{
+	    EmulateWordTimes(cpu,1);
+	    wordTimesToEmulate -= 1;
+	    wordTimesToEmulate -= idleWordTimes(cpu,wordTimesToEmulate);
+	    continue;
+	}
+
+	chain = chainAt(cpu,cpu->SCR,dispatch);
+	if((chain->length > 0) && (wordTimesToEmulate >= 2))
+	{
+	    step = chain->steps;
+	    end = step + MIN(chain->length,wordTimesToEmulate / 2);
+	    epoch = chain->epoch;
+	    oflowWordTimes = 0;
+	    cpu->PeripheralEventAt = -1;
+
+	    do
+	    {
+		/* Fetch beat */
+		decoded = step->decoded;
+		half = step->half;
+		cpu->STORE_MS = decoded->half[0];
+		cpu->STORE_LS = decoded->half[1];
+		if(half)
+		{
+		    cpu->IR = cpu->STORE_LS;
+		    cpu->BREG = 0;
+		}
+		else
+		{
+		    cpu->IR = cpu->STORE_MS;
+		    cpu->BREG = cpu->STORE_LS; /* Save for B-mod later */
+		    cpu->M = decoded->bMod;
+		}
+		cpu->IR_saved = cpu->IR;
+		cpu->fn = decoded->fn[half];
+		cpu->handler = decoded->handler[half];
+		oflowWordTimes += cpu->OFLOW;
+
+		/* Execute beat */
+		cpu->ADDRESS = cpu->IR & 8191;
+		cpu->STORE_CHAIN = (cpu->ADDRESS >= 4) ? cpu->CoreStore[cpu->ADDRESS] : E803_ZERO;
+		goto *step->code;
+
+		OP(00) OP(01) OP(02) OP(03) OP(04) OP(05) OP(06) OP(07)
+		OP(10) OP(11) OP(12) OP(13) OP(14) OP(15) OP(16) OP(17)
+		OP(20) OP(21) OP(22) OP(23) OP(24) OP(25) OP(26) OP(27)
+		OP(30) OP(31) OP(32) OP(33) OP(34) OP(35) OP(36) OP(37)
+
+	    executed:
+		if (cpu->ADDRESS >= 4)
+		{
+		    writeStore(cpu,cpu->ADDRESS,cpu->STORE_CHAIN);
+		}
+		cpu->Z = (cpu->ACC & Bits39) ? false : true;
+		cpu->NEGA = (cpu->ACC & BitsSign) ? true : false;
+
+		cpu->SCR += 1;
+		cpu->SCR &= 16383;
+		/* If M is set, don't replace previous address in IR with SCR */
+		if (!cpu->M)
+		{
+		    cpu->IR = cpu->SCR >> 1;
+		}
+		oflowWordTimes += cpu->OFLOW;
+		step += 1;
+		// Stop if it has written over a word of any chain
+	    } while((step != end) && (cpu->ChainEpoch == epoch));
+
+	    /* Two word times for each instruction, none of them making a
+	       sound or lighting anything but PARITY, FPO and OFLOW */
+	    wordTimes = (int) (step - chain->steps) * 2;
+	    cpu->CPU_word_time_count += wordTimes;
+	    cpuSound(cpu,0x0000,0x0000,wordTimes);
+	    cpu->DM160s_bright[6] += wordTimes;
+	    if(cpu->PARITY) cpu->DM160s_bright[0] += wordTimes;
+	    if(cpu->FPO)    cpu->DM160s_bright[3] += wordTimes;
+	    cpu->DM160s_bright[5] += oflowWordTimes;
+	    cpu->Looping = cpu->TC = cpu->GPFOUR = false;
+	    wordTimesToEmulate -= wordTimes;
+	    continue;
+	}
+
+	decoded = FetchDecoded(cpu,cpu->IR);
+	half = cpu->SCR & 1;
+	fn = decoded->fn[half];
+	if((fn & 070) != 040)
+	{   /* Groups 5, 6 and 7, long functions done in one go if they fit */
+	    wordTimes = ((fn & 070) == 070) ? 1 : MIN(wordTimesToEmulate,LONG_STRETCH);
+	    EmulateWordTimes(cpu,wordTimes);
+	    wordTimesToEmulate -= wordTimes;
+	    wordTimesToEmulate -= idleWordTimes(cpu,wordTimesToEmulate);
+	    continue;
+	}
+
+	/* A jump, which has no execute beat */
+	cpu->CPU_word_time_count += 1;
+	scrWas = cpu->SCR;
+	cpu->STORE_CHAIN = cpu->CoreStore[cpu->IR & 8191];
+	cpu->STORE_MS = decoded->half[0];
+	cpu->STORE_LS = decoded->half[1];
+	if(half)
+	{
+	    cpu->IR = cpu->STORE_LS;
+	    cpu->BREG = 0;
 	}
 	else
-	{  // The computer is turned off, but there are still thing to do....
-	    addSamplesFromCPU(0x0000,0x0000);
+	{
+	    cpu->IR = cpu->STORE_MS;
+	    cpu->BREG = cpu->STORE_LS; /* Save for B-mod later */
+	    cpu->M = decoded->bMod;
 	}
+	cpu->IR_saved = cpu->IR;
+	cpu->fn = fn;
+	cpu->handler = decoded->handler[half];
+	cpu->Looping = false;
+
+	if (jumpCondition(cpu,cpu->fn))
+	{
+	    cpu->SCR = ((cpu->IR & 8191) << 1) + ((cpu->fn >> 2) & 1);
+	    cpu->M = false;
+
+	    if ((cpu->fn & 3) == 3)
+		cpu->OFLOW = 0; 
+
+	    cpu->Looping = ((cpu->fn & 3) != 3) && (cpu->SCR == scrWas);
+	}
+	else
+	{
+	    cpu->SCR += 1;
+	    cpu->SCR &= 16383;
+	}
+	cpu->IR = cpu->SCR >> 1;
+	cpu->TC = cpu->GPFOUR = false;
+
+	cpuSound(cpu,0x0000,cpu->CPUVolume,1);
+	countLamps(cpu,1);
+	wordTimesToEmulate -= 1;
+	wordTimesToEmulate -= idleWordTimes(cpu,wordTimesToEmulate);
+    }
+}
+#undef OP
+#endif
+
+void setThreadedEngine(__attribute__((unused)) E803Machine *cpu,bool threaded)
+{
+#if DECODE_CACHE
+    cpu->ThreadedEngine = threaded;
+#else
+    if(threaded)
+	g_warning("The threaded code engine needs DECODE_CACHE\n");
+#endif
+}
+
+bool emulatorIdle(E803Machine *cpu)
+{
+    return cpu->Idle;
+}
+
+static void emulateStretch(E803Machine *cpu,int wordTimesToEmulate)
+{
+    cpu->Idle = false;
+#if DECODE_CACHE
+    if(cpu->ThreadedEngine)
+    {
+	EmulateThreaded(cpu,wordTimesToEmulate);
+	return;
+    }
+#endif
+    EmulateWordTimes(cpu,wordTimesToEmulate);
+}
+
+static void emulateCheckpointed(E803Machine *cpu,int wordTimesToEmulate)
+{
+    int wordTimes;
+
+    if((cpu->Rewind == NULL) || cpu->Rewind->replaying)
+    {
+	emulateStretch(cpu,wordTimesToEmulate);
+	return;
+    }
+
+    // Stop at each checkpoint on the way
+    while(wordTimesToEmulate > 0)
+    {
+	wordTimes = RewindCheckpoint(cpu->Rewind,cpu,wordTimesToEmulate);
+	emulateStretch(cpu,wordTimes);
+	wordTimesToEmulate -= wordTimes;
+    }
+    RewindSeen(cpu->Rewind,cpu);
+}
+
+void Emulate(E803Machine *cpu,int wordTimesToEmulate)
+{
+    E803Scheduler *scheduler = cpu->Scheduler;
+    int wordTimes;
+
+    if(scheduler == NULL)
+    {
+	emulateCheckpointed(cpu,wordTimesToEmulate);
+	return;
+    }
+
+    // Stop at each event on the way
+    SchedulerRun(scheduler,cpu);
+    while(wordTimesToEmulate > 0)
+    {
+	wordTimes = SchedulerUntil(scheduler,cpu,wordTimesToEmulate);
+	emulateCheckpointed(cpu,wordTimes);
+	wordTimesToEmulate -= wordTimes;
+	SchedulerRun(scheduler,cpu);
     }
 }
 
 
 // nop
-void fn00(void)
+void fn00(__attribute__((unused)) E803Machine *cpu)
 {
 
 }
 
 // a' = -a   n' = n
-void fn01(void)
+void fn01(E803Machine *cpu)
 {
-    OFLOW |= E803_neg(&ACC,&ACC);
+    cpu->OFLOW |= E803_neg(&cpu->ACC,&cpu->ACC);
 }
 
 // a' = n+1   n' = n
-void fn02(void)
+void fn02(E803Machine *cpu)
 {
-    ACC = STORE_CHAIN;
-    OFLOW |= E803_add(&E803_ONE,&ACC);
+    cpu->ACC = cpu->STORE_CHAIN;
+    cpu->OFLOW |= E803_add(&E803_ONE,&cpu->ACC);
 }
 
 // a' = a & n   n' = n
-void fn03(void)
+void fn03(E803Machine *cpu)
 {
-    E803_and(&STORE_CHAIN,&ACC);
+    E803_and(&cpu->STORE_CHAIN,&cpu->ACC);
 }
 
 // a' = a + n   n' = n
-void fn04(void)
+void fn04(E803Machine *cpu)
 {
-    OFLOW |= E803_add(&STORE_CHAIN,&ACC);
+    cpu->OFLOW |= E803_add(&cpu->STORE_CHAIN,&cpu->ACC);
 }
 
 // a' = a - n   n' = n
-void fn05(void)
+void fn05(E803Machine *cpu)
 {
-    OFLOW |= E803_sub(&STORE_CHAIN,&ACC);
+    cpu->OFLOW |= E803_sub(&cpu->STORE_CHAIN,&cpu->ACC);
 }
 
 // a' = 0   n' = n
-void fn06(void)
+void fn06(E803Machine *cpu)
 {
-    ACC = E803_ZERO;
+    cpu->ACC = E803_ZERO;
 }
 
 // a' = n - a   n' = n
-void fn07(void)
+void fn07(E803Machine *cpu)
 {
-    OFLOW |= E803_neg_add(&STORE_CHAIN,&ACC);
+    cpu->OFLOW |= E803_neg_add(&cpu->STORE_CHAIN,&cpu->ACC);
 }
 
 //a' = n   n' = a   
-void fn10(void)
+void fn10(E803Machine *cpu)
 {
-    tmp = ACC;
-    ACC = STORE_CHAIN;
-    STORE_CHAIN = tmp;
+    E803word tmp;
+
+    tmp = cpu->ACC;
+    cpu->ACC = cpu->STORE_CHAIN;
+    cpu->STORE_CHAIN = tmp;
 }
 
 // a' = -n   n' = a
-void fn11(void)
+void fn11(E803Machine *cpu)
 {
-    tmp = ACC;
-    OFLOW |= E803_neg(&STORE_CHAIN,&ACC);
-    STORE_CHAIN = tmp;
+    E803word tmp;
+
+    tmp = cpu->ACC;
+    cpu->OFLOW |= E803_neg(&cpu->STORE_CHAIN,&cpu->ACC);
+    cpu->STORE_CHAIN = tmp;
 }
 
 // a' = n+1   n' = a
-void fn12(void)
+void fn12(E803Machine *cpu)
 {
-    tmp = ACC;
-    ACC = STORE_CHAIN;
-    STORE_CHAIN = tmp;
-    OFLOW |= E803_add(&E803_ONE,&ACC);
+    E803word tmp;
+
+    tmp = cpu->ACC;
+    cpu->ACC = cpu->STORE_CHAIN;
+    cpu->STORE_CHAIN = tmp;
+    cpu->OFLOW |= E803_add(&E803_ONE,&cpu->ACC);
 }
 
 // a' = a & n   n' = a
-void fn13(void)
+void fn13(E803Machine *cpu)
 {
-    tmp = ACC;
-    ACC = STORE_CHAIN;
-    STORE_CHAIN = tmp;
-    E803_and(&STORE_CHAIN,&ACC);
+    E803word tmp;
+
+    tmp = cpu->ACC;
+    cpu->ACC = cpu->STORE_CHAIN;
+    cpu->STORE_CHAIN = tmp;
+    E803_and(&cpu->STORE_CHAIN,&cpu->ACC);
 }
 
 // a' = a + n   n' = a
-void fn14(void)
+void fn14(E803Machine *cpu)
 {
-    tmp = ACC;
-    ACC = STORE_CHAIN;
-    STORE_CHAIN = tmp;
-    OFLOW |= E803_add(&STORE_CHAIN,&ACC);
+    E803word tmp;
+
+    tmp = cpu->ACC;
+    cpu->ACC = cpu->STORE_CHAIN;
+    cpu->STORE_CHAIN = tmp;
+    cpu->OFLOW |= E803_add(&cpu->STORE_CHAIN,&cpu->ACC);
 }
 
 // a' = a - n   n' = a
-void fn15(void)
+void fn15(E803Machine *cpu)
 {
-    tmp = STORE_CHAIN;
-    STORE_CHAIN = ACC;
-    E803_sub(&tmp,&ACC);
+    E803word tmp;
+
+    tmp = cpu->STORE_CHAIN;
+    cpu->STORE_CHAIN = cpu->ACC;
+    E803_sub(&tmp,&cpu->ACC);
 }
 
 // a' = 0   n' = a
-void fn16(void)
+void fn16(E803Machine *cpu)
 {
-    STORE_CHAIN = ACC;
-    ACC = E803_ZERO;
+    cpu->STORE_CHAIN = cpu->ACC;
+    cpu->ACC = E803_ZERO;
 }
 
 // a' = n-a   n' = a
-void fn17(void)
+void fn17(E803Machine *cpu)
 {
-    tmp = STORE_CHAIN;;
-    STORE_CHAIN = ACC;
-    OFLOW |= E803_neg_add(&tmp,&ACC);
+    E803word tmp;
+
+    tmp = cpu->STORE_CHAIN;;
+    cpu->STORE_CHAIN = cpu->ACC;
+    cpu->OFLOW |= E803_neg_add(&tmp,&cpu->ACC);
 }
 
 // a' = a'   n' = a
-void fn20(void)
+void fn20(E803Machine *cpu)
 {
-    STORE_CHAIN = ACC;
+    cpu->STORE_CHAIN = cpu->ACC;
 }
 
 // a' = a'   n' = -a
-void fn21(void)
+void fn21(E803Machine *cpu)
 {
-    OFLOW |= E803_neg(&ACC,&STORE_CHAIN);  
+    cpu->OFLOW |= E803_neg(&cpu->ACC,&cpu->STORE_CHAIN);  
 }
 
 // a' = a'   n' = n + 1
-void fn22(void)
+void fn22(E803Machine *cpu)
 {
-    OFLOW |= E803_add(&E803_ONE,&STORE_CHAIN); 
+    cpu->OFLOW |= E803_add(&E803_ONE,&cpu->STORE_CHAIN); 
 }
 
 // a' = a'   n' =  a & n
-void fn23(void)
+void fn23(E803Machine *cpu)
 {
-    E803_and(&ACC,&STORE_CHAIN); 
+    E803_and(&cpu->ACC,&cpu->STORE_CHAIN); 
 }
 
 // a' = a'   n' = a + n
-void fn24(void)
+void fn24(E803Machine *cpu)
 {
-    OFLOW |= E803_add(&ACC,&STORE_CHAIN); 
+    cpu->OFLOW |= E803_add(&cpu->ACC,&cpu->STORE_CHAIN); 
 }
 
 // a' = a'   n' = a - n
-void fn25(void)
+void fn25(E803Machine *cpu)
 {
-    OFLOW |= E803_neg_add(&ACC,&STORE_CHAIN); 
+    cpu->OFLOW |= E803_neg_add(&cpu->ACC,&cpu->STORE_CHAIN); 
 }
 
 // a' = a'   n' = 0
-void fn26(void)
+void fn26(E803Machine *cpu)
 {
-    STORE_CHAIN = E803_ZERO;
+    cpu->STORE_CHAIN = E803_ZERO;
 }
 
 // a' = a'   n' = n - a
-void fn27(void)
+void fn27(E803Machine *cpu)
 {
-    OFLOW |= E803_sub(&ACC,&STORE_CHAIN); 
+    cpu->OFLOW |= E803_sub(&cpu->ACC,&cpu->STORE_CHAIN); 
 }
 
 // a' = n   n' = n
-void fn30(void)
+void fn30(E803Machine *cpu)
 {
-    ACC = STORE_CHAIN;
+    cpu->ACC = cpu->STORE_CHAIN;
 }
 
 // a' = n   n' = -a
-void fn31(void)
+void fn31(E803Machine *cpu)
 {
-    ACC = STORE_CHAIN;
-    OFLOW |= E803_neg(&STORE_CHAIN,&STORE_CHAIN);
+    cpu->ACC = cpu->STORE_CHAIN;
+    cpu->OFLOW |= E803_neg(&cpu->STORE_CHAIN,&cpu->STORE_CHAIN);
 }
 
 // a' = n   n' = n + 1
-void fn32(void)
+void fn32(E803Machine *cpu)
 {
-    ACC = STORE_CHAIN;
-    OFLOW |= E803_add(&E803_ONE,&STORE_CHAIN);
+    cpu->ACC = cpu->STORE_CHAIN;
+    cpu->OFLOW |= E803_add(&E803_ONE,&cpu->STORE_CHAIN);
 }
 
 // a' = n   n' = a & n
-void fn33(void)
+void fn33(E803Machine *cpu)
 {
-    tmp = STORE_CHAIN;
-    E803_and(&ACC,&STORE_CHAIN);
-    ACC = tmp;
+    E803word tmp;
+
+    tmp = cpu->STORE_CHAIN;
+    E803_and(&cpu->ACC,&cpu->STORE_CHAIN);
+    cpu->ACC = tmp;
 }
 
 // a' = n   n' = a + n
-void fn34(void)
+void fn34(E803Machine *cpu)
 {
-    tmp = STORE_CHAIN;
-    OFLOW |= E803_add(&ACC,&STORE_CHAIN);
-    ACC = tmp;
+    E803word tmp;
+
+    tmp = cpu->STORE_CHAIN;
+    cpu->OFLOW |= E803_add(&cpu->ACC,&cpu->STORE_CHAIN);
+    cpu->ACC = tmp;
 }
 
 // a' = n   n' = a - n
-void fn35(void)
+void fn35(E803Machine *cpu)
 {
-    tmp = STORE_CHAIN;
-    OFLOW |= E803_neg_add(&ACC,&STORE_CHAIN);
-    ACC = tmp;
+    E803word tmp;
+
+    tmp = cpu->STORE_CHAIN;
+    cpu->OFLOW |= E803_neg_add(&cpu->ACC,&cpu->STORE_CHAIN);
+    cpu->ACC = tmp;
 }
 
 // a' = n   n' = 0
-void fn36(void)
+void fn36(E803Machine *cpu)
 {
-    ACC = STORE_CHAIN;
-    STORE_CHAIN = E803_ZERO;
+    cpu->ACC = cpu->STORE_CHAIN;
+    cpu->STORE_CHAIN = E803_ZERO;
 }
 
 // a' = n   n' = n - a
-void fn37(void)
+void fn37(E803Machine *cpu)
 {
-    tmp = STORE_CHAIN;
-    OFLOW |= E803_sub(&ACC,&STORE_CHAIN);
-    ACC = tmp;
+    E803word tmp;
+
+    tmp = cpu->STORE_CHAIN;
+    cpu->OFLOW |= E803_sub(&cpu->ACC,&cpu->STORE_CHAIN);
+    cpu->ACC = tmp;
 }
 
 
 // Jumps are handled in the fetch/emulate loop as they
 // don't have an execute beat.
-void fn40(void)
+void fn40(__attribute__((unused)) E803Machine *cpu)
 {
 }
 
-void fn41(void)
+void fn41(__attribute__((unused)) E803Machine *cpu)
 {
 }
 
-void fn42(void)
+void fn42(__attribute__((unused)) E803Machine *cpu)
 {
 }
 
-void fn43(void)
+void fn43(__attribute__((unused)) E803Machine *cpu)
 {
 }
 
-void fn44(void)
+void fn44(__attribute__((unused)) E803Machine *cpu)
 {
 }
 
-void fn45(void)
+void fn45(__attribute__((unused)) E803Machine *cpu)
 {
 }
 
-void fn46(void)
+void fn46(__attribute__((unused)) E803Machine *cpu)
 {
 }
 
-void fn47(void)
+void fn47(__attribute__((unused)) E803Machine *cpu)
 {
 }
 
 // Double length arithmetic shift right
-void fn50(void)
+void fn50(E803Machine *cpu)
 {
-    if(!L)
+    if(!cpu->L)
     {  /* First word */
-	L = true;
-	T = (IR & 127) - 1;
+	cpu->L = true;
+	cpu->T = (cpu->IR & 127) - 1;
     }
 
-    if(T--< 0)
+    if(cpu->T--< 0)
     { /* Last Word */
-	L = false;
+	cpu->L = false;
     }
     else
     {
-	E803_signed_shift_right(&ACC,&AR);
+	E803_signed_shift_right(&cpu->ACC,&cpu->AR);
     }
 }
 
 
 // Single length right shift. Clear AR
-void fn51(void)
+void fn51(E803Machine *cpu)
 {
-    if(!L)
+    if(!cpu->L)
     {  /* First word */
-	L = true;
-	T = (IR & 127) - 1;
+	cpu->L = true;
+	cpu->T = (cpu->IR & 127) - 1;
     }
 
-    if(T--< 0)
+    if(cpu->T--< 0)
     { /* Last Word */
-	L = false;
-	AR = E803_ZERO;
+	cpu->L = false;
+	cpu->AR = E803_ZERO;
     }
     else
     {
-	E803_unsigned_shift_right(&ACC);
+	E803_unsigned_shift_right(&cpu->ACC);
     }
 
 }
 
 //Double length mutiply
-void fn52(void)
+void fn52(E803Machine *cpu)
 {
     int m,n,action;
 
 
-    if(!L)
+    if(!cpu->L)
     {  /* First Word time */
 
-	L = true;
-	MREG = STORE_CHAIN;
-	E803_Double_M(&MREG);    /* shift one bit left so that M.bytes[0] &
+	cpu->L = true;
+	cpu->MREG = cpu->STORE_CHAIN;
+	E803_Double_M(&cpu->MREG);    /* shift one bit left so that M.bytes[0] &
 				    3 gives the action code */
-	E803_Acc_to_Q(&ACC,&QACC,&QAR);
+	E803_Acc_to_Q(&cpu->ACC,&cpu->QACC,&cpu->QAR);
       
-	ACC = AR = E803_ZERO;
+	cpu->ACC = cpu->AR = E803_ZERO;
 	return;
     }
 
-    action = MREG & 3;
+    action = cpu->MREG & 3;
     switch(action)
     {
 	case 0:   break;
 
 	case 1:   /* Add */
-	    OFLOW |= E803_dadd(&QACC,&QAR,&ACC,&AR);
+	    cpu->OFLOW |= E803_dadd(&cpu->QACC,&cpu->QAR,&cpu->ACC,&cpu->AR);
 	    break;
 
 	case 2:   /* Subtract */
-	    OFLOW |= E803_dsub(&QACC,&QAR,&ACC,&AR);
+	    cpu->OFLOW |= E803_dsub(&cpu->QACC,&cpu->QAR,&cpu->ACC,&cpu->AR);
 	    break;
 		
 	case 3:   break;
     }
 
-    E803_shift_left(&QACC,&QAR);
-    n = E803_Shift_M_Right(&MREG);
+    E803_shift_left(&cpu->QACC,&cpu->QAR);
+    n = E803_Shift_M_Right(&cpu->MREG);
     m = (n >> 8) & 0xFF;
     n = n & 0xFF;
 
     if( (n == 0xFF) || (m == 0x00) )
     {
-	L = false;
+	cpu->L = false;
     }
 }
 
 // Single length multiply.  Clear AR
-void fn53(void)
+void fn53(E803Machine *cpu)
 {
     int m,n,action;
 
 
-    if(!L)
+    if(!cpu->L)
     {  /* First Word time */
 
-	L = true;
-	MREG = STORE_CHAIN;
-	E803_Double_M(&MREG);    /* shift one bit left so that M.bytes[0] &
+	cpu->L = true;
+	cpu->MREG = cpu->STORE_CHAIN;
+	E803_Double_M(&cpu->MREG);    /* shift one bit left so that M.bytes[0] &
 				    3 gives the action code */
-	E803_Acc_to_Q(&ACC,&QACC,&QAR);
+	E803_Acc_to_Q(&cpu->ACC,&cpu->QACC,&cpu->QAR);
       
-	ACC = AR = E803_ZERO;
+	cpu->ACC = cpu->AR = E803_ZERO;
 	return;
     }
 
-    if(LW)
+    if(cpu->LW)
     {
-	L = LW = false;
-	OFLOW |= E803_dadd(&E803_ZERO,&E803_AR_MSB,&ACC,&AR);
-	AR = E803_ZERO;
+	cpu->L = cpu->LW = false;
+	cpu->OFLOW |= E803_dadd(&E803_ZERO,&E803_AR_MSB,&cpu->ACC,&cpu->AR);
+	cpu->AR = E803_ZERO;
     }
     else
     {
-	action = MREG & 3;
+	action = cpu->MREG & 3;
 	switch(action)
 	{
 	    case 0:   break;
 		   
 	    case 1:   /* Add */
-		OFLOW |= E803_dadd(&QACC,&QAR,&ACC,&AR);
+		cpu->OFLOW |= E803_dadd(&cpu->QACC,&cpu->QAR,&cpu->ACC,&cpu->AR);
 		break;
 
 	    case 2:   /* Subtract */
-		OFLOW |= E803_dsub(&QACC,&QAR,&ACC,&AR);
+		cpu->OFLOW |= E803_dsub(&cpu->QACC,&cpu->QAR,&cpu->ACC,&cpu->AR);
 		break;
 		
 	    case 3:   break;
 	}
 
-	E803_shift_left(&QACC,&QAR);
-	n = E803_Shift_M_Right(&MREG);
+	E803_shift_left(&cpu->QACC,&cpu->QAR);
+	n = E803_Shift_M_Right(&cpu->MREG);
 	m = (n >> 8) & 0xFF;
 	n = n & 0xFF;
 
 	if( (n == 0xFF) || (m == 0x00) )
 	{
-	    LW = true;
+	    cpu->LW = true;
 	}
     }
 }
 
 // Double length arithmetic shift left 
-void fn54(void)
+void fn54(E803Machine *cpu)
 {
-    if(!L)
+    if(!cpu->L)
     {  /* First word */
-	L = true;
-	T = (IR & 127) - 1;
+	cpu->L = true;
+	cpu->T = (cpu->IR & 127) - 1;
     }
 
     /* Note first and last words can be the same word for 0 bit shift */
   
-    if(T-- < 0)
+    if(cpu->T-- < 0)
     {   /* Last Word */
-	L = false;
+	cpu->L = false;
     }
     else
     {
-	OFLOW |= E803_shift_left(&ACC,&AR);
+	cpu->OFLOW |= E803_shift_left(&cpu->ACC,&cpu->AR);
     }
 }
 
 // Single length sift left.  Clear AR
-void fn55(void)
+void fn55(E803Machine *cpu)
 {
-    if(!L)
+    if(!cpu->L)
     {  /* First word */
-	L = true;
-	T = (IR & 127) - 1;
-	AR = E803_ZERO;   /* This is not quite what happens on a real 803.
+	cpu->L = true;
+	cpu->T = (cpu->IR & 127) - 1;
+	cpu->AR = E803_ZERO;   /* This is not quite what happens on a real 803.
 			     The AR should be cleared during LW, but clearing
 			     it here allows the use of the normal double
 			     length left shift function */
@@ -874,32 +1689,31 @@ void fn55(void)
 
     /* Note first and last words can be the same word for 0 bit shift */
   
-    if(T-- < 0)
+    if(cpu->T-- < 0)
     {   /* Last Word */
-	L = false;
-	AR = E803_ZERO;
+	cpu->L = false;
+	cpu->AR = E803_ZERO;
     }
     else
     {
-	OFLOW |= E803_shift_left(&ACC,&AR);
+	cpu->OFLOW |= E803_shift_left(&cpu->ACC,&cpu->AR);
     }
 }
 
 
 // Double length divide, sinlge length answer.  Clear AR
-void fn56(void)
+void fn56(E803Machine *cpu)
 {
-    static E803word M_sign;
     E803word ACC_sign;
 
-    if(!L)
+    if(!cpu->L)
     {  /* First Word time */
 	uint64_t *m,mm,n;
 
     
 
-	L = true;
-	MREG = STORE_CHAIN;
+	cpu->L = true;
+	cpu->MREG = cpu->STORE_CHAIN;
 
 	/* Bug fixed 11/4/2010   The remainder needs an extra bit so
 	   MREG and ACC/AR are sign extended to 40 bits and special 
@@ -908,7 +1722,7 @@ void fn56(void)
 	   code to shift these values one place right. 
 	*/
 
-	m =  &MREG;
+	m =  &cpu->MREG;
 	mm = n = *m;
 	n  &= 0x4000000000LL;   // Sign bit
 	mm &= 0x7FFFFFFFFFLL;   // 39 bits
@@ -916,7 +1730,7 @@ void fn56(void)
 	n *= 6; // Two duplicate sign bits
 	*m =mm | n;
 	
-	m =  &ACC;
+	m =  &cpu->ACC;
 	mm = n = *m;
 	n  &= 0x4000000000LL;   // Sign bit
 	mm &= 0x7FFFFFFFFFLL;   // 39 bits
@@ -924,11 +1738,11 @@ void fn56(void)
 	n *= 6; // Two duplicate sign bits
 	*m =mm | n;
 	
-	M_sign = MREG;
+	cpu->M_sign = cpu->MREG;
        
-	T = 40;   /* ? */
+	cpu->T = 40;   /* ? */
 
-	QAR = QACC = E803_ZERO;  /* Clear QAR so I can use the double
+	cpu->QAR = cpu->QACC = E803_ZERO;  /* Clear QAR so I can use the double
 				    length left shift on QACC */
 	/*printf("  ");       
 	  dumpACCAR();
@@ -939,71 +1753,46 @@ void fn56(void)
 
     ACC_sign = 0;
    
-    if(T--)
+    if(cpu->T--)
     {
-#if TRACE
-	if(traceChannel != NULL)
-	{
-	    g_string_truncate(traceText,0);	
-	    g_string_printf(traceText,"\n%s T=%d\nMREG=",__FUNCTION__,T);
-	    dumpWord(traceText,&MREG);
-	    g_string_append_printf(traceText,"\nACC =");
-	    dumpWord(traceText,&ACC);
-	    g_string_append_printf(traceText,"\nAR  =");
-	    dumpWord(traceText,&AR);
-	    g_string_append_printf(traceText,"\nQACC=");
-	    dumpWord(traceText,&QACC);
-      }
-#endif
-	if(T == 39)
+	if(cpu->T == 39)
 	{  /* Second word */
-	    ACC_sign = ACC;
+	    ACC_sign = cpu->ACC;
 	}
        
-	E803_shift_left(&QACC,&QAR);
-	if((ACC ^ M_sign) & 0x8000000000)
+	E803_shift_left(&cpu->QACC,&cpu->QAR);
+	if((cpu->ACC ^ cpu->M_sign) & 0x8000000000)
 	{  /* Signs different , so add */
-	    E803_add56(&MREG,&ACC);
+	    E803_add56(&cpu->MREG,&cpu->ACC);
 	}
 	else
 	{  /* Signs same, so subtract */
-	    E803_sub56(&MREG,&ACC);
-	    if(T != 39) QACC |= 1;
-	}
-#if TRACE
-	if(traceChannel != NULL)
-	{
-	  g_string_append_printf(traceText,"\nACC2=");
-	  dumpWord(traceText,&ACC);
-	  g_string_append_printf(traceText,"\nAR2 =");
-	  dumpWord(traceText,&AR);
-	  g_string_append_c(traceText, '\n');
-	  g_io_channel_write_chars(traceChannel,traceText->str,-1,NULL,NULL);	  
+	    E803_sub56(&cpu->MREG,&cpu->ACC);
+	    if(cpu->T != 39) cpu->QACC |= 1;
 	}
-#endif
 
-	if(T == 39)
+	if(cpu->T == 39)
 	{
-	    if(( (ACC ^ ACC_sign) & 0x8000000000) == 0)
+	    if(( (cpu->ACC ^ ACC_sign) & 0x8000000000) == 0)
 	    {
-		OFLOW |= true;
+		cpu->OFLOW |= true;
 	    }
 	}
-	E803_shift_left56(&ACC,&AR);
+	E803_shift_left56(&cpu->ACC,&cpu->AR);
     }
     else
     {   /* Last word */
-	ACC = QACC;
-	AR = E803_ZERO;
-	L = false;
+	cpu->ACC = cpu->QACC;
+	cpu->AR = E803_ZERO;
+	cpu->L = false;
     }
 }
 
 // 6/3/10  BUG FIXED.  Fn 57 does NOT clear the AR as it is not 
 // a long instruction so LW is not up.
-void fn57(void)
+void fn57(E803Machine *cpu)
 {
-    E803_AR_to_ACC(&ACC,&AR);
+    E803_AR_to_ACC(&cpu->ACC,&cpu->AR);
 }
 
 /* NOTE on Gp 6 timings.
@@ -1035,27 +1824,27 @@ n = extra mantisa bits held during calculations
 
 
 
-static void fn6X(int FN)
+static void fn6X(E803Machine *cpu,int FN)
 {
     int ACCexp,STOREexp,diff,negdiff,RightShift,LeftShift,NED,NED16,NEDBAR16,K;
     int oflw,round;
     E803word ACCmant,STOREmant,VDin,TMPmant;
   
-    if(!L)
+    if(!cpu->L)
     {  /* First Word time */
-	L = true;
+	cpu->L = true;
 	round = 0;
 
 	if(FN != 062)
 	{
-	    ACCexp   = E803_fp_split(&ACC,&ACCmant);
-	    STOREexp = E803_fp_split(&STORE_CHAIN,&STOREmant);
+	    ACCexp   = E803_fp_split(&cpu->ACC,&ACCmant);
+	    STOREexp = E803_fp_split(&cpu->STORE_CHAIN,&STOREmant);
 	}
 	else
 	{
 	    /* Just reverse the input parameters */
-	    ACCexp   = E803_fp_split(&STORE_CHAIN,&ACCmant);
-	    STOREexp = E803_fp_split(&ACC,&STOREmant);
+	    ACCexp   = E803_fp_split(&cpu->STORE_CHAIN,&ACCmant);
+	    STOREexp = E803_fp_split(&cpu->ACC,&STOREmant);
 	}
 /*
 	if(trace != NULL)
@@ -1186,8 +1975,8 @@ static void fn6X(int FN)
 
 	if(ACCexp > 511)
 	{
-	    S = true;
-	    FPO = true;
+	    cpu->S = true;
+	    cpu->FPO = true;
 	}
 
 	if( ACCmant & 0x80) round = 1;
@@ -1204,7 +1993,7 @@ static void fn6X(int FN)
 	    fprintf(trace," ACCexp%d\n",ACCexp);
 	}
 */
-	E803_fp_join(&ACCmant,&ACCexp,&ACC);
+	E803_fp_join(&ACCmant,&ACCexp,&cpu->ACC);
 /*
 	if(trace != NULL)
 	{
@@ -1216,13 +2005,13 @@ static void fn6X(int FN)
     }
     else
     {  /* Second word time */
-	L = false;
-	AR = E803_ZERO;
+	cpu->L = false;
+	cpu->AR = E803_ZERO;
     }
     return;
 }
 
-#if TRACE
+#if 0
 static
 void dumpWordFile(FILE *fp,E803word *wp)
 {
@@ -1245,308 +2034,303 @@ void dumpWordFile(FILE *fp,E803word *wp)
 #endif
 
 // a' = a + n
-void fn60(void)
+void fn60(E803Machine *cpu)
 {
-    fn6X(060);
+    fn6X(cpu,060);
 }
 
 // a' = a - n
-void fn61(void)
+void fn61(E803Machine *cpu)
 {
-    fn6X(061);
+    fn6X(cpu,061);
 }
 
 // a' = n - a
-void fn62(void)
+void fn62(E803Machine *cpu)
 {
-    fn6X(062);
+    fn6X(cpu,062);
 }
 
 // a' = a * n
-void fn63(void)
+void fn63(E803Machine *cpu)
 {
     int ACCexp,STOREexp,op,oflw,LeftShift;
     E803word TMPmant;
-    static E803word ACCmant;
-    static int round; 
    
-    if(!L)
+    if(!cpu->L)
     {  /* First Word time */
-	L = true;
-	T = 16 ; /* ? */
-	round = 0;
+	cpu->L = true;
+	cpu->T = 16 ; /* ? */
+	cpu->mulRound = 0;
 
-	ACCexp = E803_fp_split(&ACC,&ACCmant);
+	ACCexp = E803_fp_split(&cpu->ACC,&cpu->mulACCmant);
 
 	/* Multiplier mantissa to MREG */
-	STOREexp = E803_fp_split(&STORE_CHAIN,&MREG);
+	STOREexp = E803_fp_split(&cpu->STORE_CHAIN,&cpu->MREG);
 
-	EXPREG = ACCexp + STOREexp;
+	cpu->EXPREG = ACCexp + STOREexp;
       
-	MANTREG = E803_ZERO;
+	cpu->MANTREG = E803_ZERO;
     }
 
-    op = (*((int *) &MREG) >> 7) & 0x7;
+    op = (int) (cpu->MREG >> 7) & 0x7;
   
-    round += E803_mant_shift_right(&MANTREG,2,6);  /* Note 2 extra bits */  
+    cpu->mulRound += E803_mant_shift_right(&cpu->MANTREG,2,6);  /* Note 2 extra bits */  
     switch(op)
     {
 	case 0:
 	    break;
 	case 1:
 	case 2:
-	    E803_mant_add(&ACCmant,&MANTREG);
+	    E803_mant_add(&cpu->mulACCmant,&cpu->MANTREG);
 	    break;
 	case 3:
-	    E803_mant_add(&ACCmant,&MANTREG);
-	    E803_mant_add(&ACCmant,&MANTREG);
+	    E803_mant_add(&cpu->mulACCmant,&cpu->MANTREG);
+	    E803_mant_add(&cpu->mulACCmant,&cpu->MANTREG);
 	    break;
 	    
 	case 4:
-	    E803_mant_sub(&ACCmant,&MANTREG);
-	    E803_mant_sub(&ACCmant,&MANTREG);
+	    E803_mant_sub(&cpu->mulACCmant,&cpu->MANTREG);
+	    E803_mant_sub(&cpu->mulACCmant,&cpu->MANTREG);
 	    break;
 	case 5:
 	case 6:
-	    E803_mant_sub(&ACCmant,&MANTREG);
+	    E803_mant_sub(&cpu->mulACCmant,&cpu->MANTREG);
 	    break;
 	case 7:
 	    break;
     }
 
-    E803_mant_shift_right(&MREG,2,1);
+    E803_mant_shift_right(&cpu->MREG,2,1);
 
-    T -= 1;
-    if( T == 1)
+    cpu->T -= 1;
+    if( cpu->T == 1)
     {  /* This is the word time when "end" is set */
-	MREG = E803_ZERO;
+	cpu->MREG = E803_ZERO;
     }
 
-    if(T == 0)
+    if(cpu->T == 0)
     {  /* This is the AS & FR & SD word times combined */
-	L = 0;
+	cpu->L = 0;
 	oflw = 0;
 	LeftShift = 0;
-	TMPmant = MANTREG;
+	TMPmant = cpu->MANTREG;
 	if(E803_mant_shift_right(&TMPmant,31,7) == 0)
 	{
 	    ACCexp = 0;
-	    ACCmant = E803_ZERO; 	
+	    cpu->mulACCmant = E803_ZERO; 	
 	    /* Bug fixed 27/3/05   Multiply by zero was NOT giving zero result!
 	       The next to lines were needed */
-	    EXPREG = 0;
-	    MANTREG = E803_ZERO;
+	    cpu->EXPREG = 0;
+	    cpu->MANTREG = E803_ZERO;
 	}
 	else
 	{
 	    while( !oflw )
 	    {
-		TMPmant = MANTREG;
-		oflw = E803_mant_add(&TMPmant,&MANTREG);
+		TMPmant = cpu->MANTREG;
+		oflw = E803_mant_add(&TMPmant,&cpu->MANTREG);
 		LeftShift += 1;
 	    }
 	    LeftShift -= 1;
-	    MANTREG = TMPmant;
+	    cpu->MANTREG = TMPmant;
   
-	    EXPREG -= (255 + LeftShift);
+	    cpu->EXPREG -= (255 + LeftShift);
 
-	    if(EXPREG < 0)
+	    if(cpu->EXPREG < 0)
 	    {
 		/* Exp underflow !! */
-		EXPREG = 0;
-		MANTREG = E803_ZERO;
-		round = 0;
+		cpu->EXPREG = 0;
+		cpu->MANTREG = E803_ZERO;
+		cpu->mulRound = 0;
 	    }
        
-	    if(EXPREG > 511)
+	    if(cpu->EXPREG > 511)
 	    {
-		S = true;
-		FPO = true;
+		cpu->S = true;
+		cpu->FPO = true;
 	    }
       
 	    /* Do I need to check the MANTREG for bits which should set
 	       round ?   I think I do.... */
 
-	    TMPmant = MANTREG;
-	    round |= E803_mant_shift_right(&TMPmant,2,6);
+	    TMPmant = cpu->MANTREG;
+	    cpu->mulRound |= E803_mant_shift_right(&TMPmant,2,6);
       
-	    if(round)
+	    if(cpu->mulRound)
 	    {   /* Force the rounding bit */
-		MANTREG |= 0x100;
+		cpu->MANTREG |= 0x100;
 	    }
 	}
 
-	E803_fp_join(&MANTREG,&EXPREG,&ACC);
-	AR = E803_ZERO;
+	E803_fp_join(&cpu->MANTREG,&cpu->EXPREG,&cpu->ACC);
+	cpu->AR = E803_ZERO;
     }
     return;
 }
 
   
 // a' =  a / n
-void fn64(void)
+void fn64(E803Machine *cpu)
 {
     static E803word TBIT =  0x1000000000; 
     static E803word TsignBit = 0xE000000000;
-    static E803word TshiftBit,TBit;
-    static E803word ACCmant;
     int MantZ,Same,oflw,LeftShift,STOREexp,ACCexp;
-    static int firstbit,exact;
     E803word TMPmant;
     bool DivByZero;
 
-    if(!L)
+    if(!cpu->L)
     {
 	/* First word time */
-	TBit = E803_ZERO;     /* To ignore the first bit in the answer */
-	TshiftBit = TBIT;
-	firstbit = true;
-	T = 0;   /* 31 bits of quotient to form */
-	L = true;
+	cpu->divTBit = E803_ZERO;     /* To ignore the first bit in the answer */
+	cpu->divTshiftBit = TBIT;
+	cpu->divFirstbit = true;
+	cpu->T = 0;   /* 31 bits of quotient to form */
+	cpu->L = true;
 	
-	exact = false;
+	cpu->divExact = false;
        
 	/* divisor  mantissa from store  to MREG */
-	STOREexp = E803_fp_split(&STORE_CHAIN,&MREG);
+	STOREexp = E803_fp_split(&cpu->STORE_CHAIN,&cpu->MREG);
 
 	/* Split the dividend */
-	ACCexp = E803_fp_split(&ACC,&ACCmant);
+	ACCexp = E803_fp_split(&cpu->ACC,&cpu->divACCmant);
 
-	EXPREG = ACCexp - STOREexp;
+	cpu->EXPREG = ACCexp - STOREexp;
       
-	MANTREG = E803_ZERO;   /* Form result in here */
-	QACC = E803_ZERO;
+	cpu->MANTREG = E803_ZERO;   /* Form result in here */
+	cpu->QACC = E803_ZERO;
       
-	E803_mant_shift_right(&ACCmant,1,1); 
+	E803_mant_shift_right(&cpu->divACCmant,1,1); 
 
-	DivByZero = ((STORE_CHAIN & Bits40) != 0)  ? false : true;
+	DivByZero = ((cpu->STORE_CHAIN & Bits40) != 0)  ? false : true;
 	
 	if(DivByZero)
 	{
-	    S = true;
-	    FPO = true;
+	    cpu->S = true;
+	    cpu->FPO = true;
 	}
     }
     else
     {
-	Same = !((ACCmant ^ MREG) & 0x8000000000);
-	MantZ = ((ACCmant & Bits40) != 0) ? false : true;
+	Same = !((cpu->divACCmant ^ cpu->MREG) & 0x8000000000);
+	MantZ = ((cpu->divACCmant & Bits40) != 0) ? false : true;
 
-	if(MantZ) exact = true;
+	if(MantZ) cpu->divExact = true;
 
 	if(MantZ || Same)
 	{
-	    E803_mant_sub(&MREG,&ACCmant);
-	    E803_mant_add(&TBit,&MANTREG);
+	    E803_mant_sub(&cpu->MREG,&cpu->divACCmant);
+	    E803_mant_add(&cpu->divTBit,&cpu->MANTREG);
 	}
 	else
 	{
-	    E803_mant_add(&MREG,&ACCmant);
+	    E803_mant_add(&cpu->MREG,&cpu->divACCmant);
 	}
 
-	E803_mant_add(&ACCmant,&ACCmant);
+	E803_mant_add(&cpu->divACCmant,&cpu->divACCmant);
 
-	if(firstbit)
+	if(cpu->divFirstbit)
 	{
-	    TBit = TsignBit;
-	    firstbit = false;
+	    cpu->divTBit = TsignBit;
+	    cpu->divFirstbit = false;
 	}
 	else
 	{
-	    TBit = TshiftBit;
-	    E803_mant_shift_right(&TshiftBit,1,1);
+	    cpu->divTBit = cpu->divTshiftBit;
+	    E803_mant_shift_right(&cpu->divTshiftBit,1,1);
 	}
 
-#if TRACE
-	printf("T=%d \n    TBit=",T);
-	dumpWordFile(stdout,&TBit);
+#if 0
+	printf("T=%d \n    TBit=",cpu->T);
+	dumpWordFile(stdout,&cpu->divTBit);
 	printf("\n    MREG=");
-	dumpWordFile(stdout,&MREG);
+	dumpWordFile(stdout,&cpu->MREG);
 	printf("\n ACCmant=");
-	dumpWordFile(stdout,&ACCmant);
+	dumpWordFile(stdout,&cpu->divACCmant);
 	printf("\n");
 #endif
-	T += 1;
+	cpu->T += 1;
 
-	if( (T == 32) || (MantZ))
+	if( (cpu->T == 32) || (MantZ))
 	{
 
-	    L = 0;
+	    cpu->L = 0;
 
 	    oflw = 0;
 	    LeftShift = 0;
 
-	    MantZ = ((MANTREG & Bits40) != 0) ? false : true;
+	    MantZ = ((cpu->MANTREG & Bits40) != 0) ? false : true;
 
 	    if(MantZ)
 	    {
-		EXPREG = 0;
-		exact = true;
+		cpu->EXPREG = 0;
+		cpu->divExact = true;
 	    }
 	    else
 	    {
-		TMPmant = MANTREG;
+		TMPmant = cpu->MANTREG;
 		while( !oflw )
 		{
-		    TMPmant = MANTREG;
-		    oflw = E803_mant_add(&TMPmant,&MANTREG);
+		    TMPmant = cpu->MANTREG;
+		    oflw = E803_mant_add(&TMPmant,&cpu->MANTREG);
 
 		    if(!oflw) LeftShift += 1;
 		}
-		MANTREG = TMPmant;
-		EXPREG += (257 - LeftShift);
+		cpu->MANTREG = TMPmant;
+		cpu->EXPREG += (257 - LeftShift);
 	    }
 
-	    if(!exact)
+	    if(!cpu->divExact)
 	    {   /* Force the rounding bit */
-		MANTREG |= 0x100;
+		cpu->MANTREG |= 0x100;
 	    }
        
-	    if(EXPREG < 0)
+	    if(cpu->EXPREG < 0)
 	    {
 		/* Exp underflow !! */
-		EXPREG = 0;
-		MANTREG = E803_ZERO;
+		cpu->EXPREG = 0;
+		cpu->MANTREG = E803_ZERO;
 	    }
-     	    if(EXPREG > 511)
+     	    if(cpu->EXPREG > 511)
 	    {
-		S = true;
-		FPO = true;
+		cpu->S = true;
+		cpu->FPO = true;
 	    }  
-	    E803_fp_join(&MANTREG,&EXPREG,&ACC);
-	    AR = E803_ZERO;
+	    E803_fp_join(&cpu->MANTREG,&cpu->EXPREG,&cpu->ACC);
+	    cpu->AR = E803_ZERO;
 	}
     }
 }
 
 // Floating point standardise OR fast rotate left
-void fn65(void)
+void fn65(E803Machine *cpu)
 {
     int count,EXP,oflw,*ip;
     E803word temp;
 
-    if((IR & 8191) < 4096)
+    if((cpu->IR & 8191) < 4096)
     {   /* Shift */
-      count = IR & 63;
+      count = cpu->IR & 63;
       //count = IR & 0x2F;   // Simulate the fault on TNMOC's 803 on 4/4/2010
 
 	if(count == 0) return;
       
 	if(count <= 39)
 	{
-	    E803_rotate_left(&ACC,&count);
+	    E803_rotate_left(&cpu->ACC,&count);
 	}
 	else
 	{
 	    count -= 39;
-	    E803_shift_left_F65(&ACC,&count);
+	    E803_shift_left_F65(&cpu->ACC,&count);
 	}
     }
     else
     {   /* Fp standardisation */
-	AR = E803_ZERO;
+	cpu->AR = E803_ZERO;
 
-	EXP = ((ACC & Bits40) != 0) ? false : true;
+	EXP = ((cpu->ACC & Bits40) != 0) ? false : true;
 	if(EXP) return;
       
 	oflw = false;
@@ -1555,15 +2339,15 @@ void fn65(void)
       
 	while(1)
 	{
-	    temp = ACC;
-	    oflw = E803_shift_left(&ACC,&AR);
+	    temp = cpu->ACC;
+	    oflw = E803_shift_left(&cpu->ACC,&cpu->AR);
 	    if(oflw) break;
 	
 	    EXP -= 1;
 	}
 
-	ACC = temp;
-	ip = (int *) &ACC;
+	cpu->ACC = temp;
+	ip = (int *) &cpu->ACC;
       
 	if(*ip & 511) *ip |= 512;
       
@@ -1578,74 +2362,72 @@ void fn65(void)
 
 // Fast integer divide giving 13 bit result.
 // AR not cleared 
-void fn66(void)
+void fn66(__attribute__((unused)) E803Machine *cpu)
 {
   
 }
 
 // Integer square root of accumulator giving 13 bit result.
 // AR not cleared
-void fn67(void)
+void fn67(__attribute__((unused)) E803Machine *cpu)
 {
 
 }
 
 // a' = word generator
-void fn70(void)
+void fn70(E803Machine *cpu)
 {
-    WI = B = (WG_ControlButtons & WG_manual_data) ? true : false;
+    cpu->WI = cpu->B = (cpu->WG_ControlButtons & WG_manual_data) ? true : false;
   
-    if(B) 
+    if(cpu->B) 
     {
-	if(SS3)
+	if(cpu->SS3)
 	{
-	    B = false;
-	    WI = false;
-	    SS3 = false;
-	    ACC = WG;
+	    cpu->B = false;
+	    cpu->WI = false;
+	    cpu->SS3 = false;
+	    cpu->ACC = cpu->WG;
 	}
     }
     else
     {
-	B = false;
-	WI = false;
-	SS3 = false;
-	ACC = WG;
+	cpu->B = false;
+	cpu->WI = false;
+	cpu->SS3 = false;
+	cpu->ACC = cpu->WG;
     }
 }
 
 
-static bool Ready = false;
-static unsigned int TRLines = 0;
-
 static void setReady(unsigned int value)
 {
-    Ready = (value != 0);
+    WiredMachine->Ready = (value != 0);
 }
 
 static void setTRLines(unsigned int value)
 {
-    TRLines = value;
+    WiredMachine->TRLines = value;
 }
 
 
 // Read character from tape reader
-void fn71(void)
+void fn71(E803Machine *cpu)
 {
-    wiring(CLINES,IR&8191);
-    wiring(F71,1);    // Send F71 to PTS.  This will set READY if appropriate
+    cpu->wire(cpu,CLINES,cpu->IR&8191);
+    cpu->wire(cpu,F71,1);    // Send F71 to PTS.  This will set READY if appropriate
 
-    if(Ready)
+    if(cpu->Ready)
     {
-	wiring(ACT,1);
-	ACC |= TRLines & 0x1F;
-	wiring(ACT,0);
-	wiring(F71,0);
-	B = false;
+	if(cpu->Rewind != NULL) rewindBarrier(cpu->Rewind,cpu);
+	cpu->wire(cpu,ACT,1);
+	cpu->ACC |= cpu->TRLines & 0x1F;
+	cpu->wire(cpu,ACT,0);
+	cpu->wire(cpu,F71,0);
+	cpu->B = false;
     }
     else
     {
-	B = true;
+	cpu->B = true;
     }
     return;
 }    
@@ -1656,30 +2438,31 @@ void fn71(void)
 
 int plotterAct = 0;
 // Output to channel 2
-void fn72(void)
+void fn72(E803Machine *cpu)
 {
-    wiring(CLINES,IR&8191);
-    wiring(F72,1);
+    cpu->wire(cpu,CLINES,cpu->IR&8191);
+    cpu->wire(cpu,F72,1);
 
-    if(Ready)
+    if(cpu->Ready)
     {
-	wiring(ACT,1);
-	wiring(ACT,0);
-	wiring(F72,0);
-	B = false;
+	if(cpu->Rewind != NULL) rewindBarrier(cpu->Rewind,cpu);
+	cpu->wire(cpu,ACT,1);
+	cpu->wire(cpu,ACT,0);
+	cpu->wire(cpu,F72,0);
+	cpu->B = false;
     }
     else
     {
-	B = true;
+	cpu->B = true;
     }
 
 }
 
 
 // n' = sequence control register.  (link)
-void fn73(void)
+void fn73(E803Machine *cpu)
 {
-    E803_SCR_to_STORE(&SCR,&STORE_CHAIN);
+    E803_SCR_to_STORE(&cpu->SCR,&cpu->STORE_CHAIN);
 }
 
 /* Speed is now controlled using the polling techniques developed 
@@ -1688,98 +2471,84 @@ void fn73(void)
 
 int F74punchAt;
 // Output tp PTS (punches or teleprinter)
-void fn74(void)
+void fn74(E803Machine *cpu)
 {
-    wiring(CLINES,IR&8191);
-    wiring(F74,1);
+    cpu->wire(cpu,CLINES,cpu->IR&8191);
+    cpu->wire(cpu,F74,1);
 
-    if(Ready)
+    if(cpu->Ready)
     {
-	wiring(ACT,1);
-	wiring(ACT,0);
-	wiring(F74,0);
-	B = false;
+	if(cpu->Rewind != NULL) rewindBarrier(cpu->Rewind,cpu);
+	cpu->wire(cpu,ACT,1);
+	cpu->wire(cpu,ACT,0);
+	cpu->wire(cpu,F74,0);
+	cpu->B = false;
     }
     else
     {
-	B = true;
+	cpu->B = true;
     }
 }
 
 
 
-void fn75(void)
+void fn75(E803Machine *cpu)
 {
-    B = true;
+    cpu->B = true;
 }
 
 
 
 
-void fn76(void)
+void fn76(E803Machine *cpu)
 {
-    B = true;
+    cpu->B = true;
 }
 
 
 
-void fn77(void)
+void fn77(E803Machine *cpu)
 {
-    L = true;
+    cpu->L = true;
 }
 
 
 
 static void cpuPowerOn(__attribute__((unused)) unsigned int dummy)
 {
-    CpuRunning = true;
-    S = PARITY = true;
+    WiredMachine->CpuRunning = true;
+    WiredMachine->S = WiredMachine->PARITY = true;
     wiring(UPDATE_DISPLAYS,0);
 }
 
 static void cpuPowerOff(__attribute__((unused)) unsigned int dummy)
 {
-    CpuRunning = false;
-    PARITY = false;
+    WiredMachine->CpuRunning = false;
+    WiredMachine->PARITY = false;
     wiring(UPDATE_DISPLAYS,0);
 }
 
-#if TRACE
-static
-void dumpWord(E803word word)
-{
-    unsigned int f1,n1,b,f2,n2;
-    
-    f1 = (word >> 33) & 077;
-    n1 = (word >> 20) & 017777;
-    b =  (word >> 19) & 01;
-    f2 = (word >> 13) & 077;
-    n2 = word & 017777;
-
-    printf("%02o %4d%c%02o %4d\n",f1,n1,b?'/':':',f2,n2);
-    
-}
-#endif
 
 // Initial instructions
 const char *T1[4] = {"264:060","224/163","555:710","431:402"};
 
-// Called from CpuInit
-void StartEmulate(char *coreImage)
+/* Set up a machine with the power off and the initial instructions
+   in the bottom of the store.  If coreStore is NULL a clear store is
+   allocated.  The machine is not connected to anything. */
+void InitMachine(E803Machine *cpu,E803word *coreStore)
 {
     uint64_t f1,n1,f2,n2,bbit;
     char b;
     E803word II;
     int n;
 
-    if(coreImage == NULL)
-    {
-	CoreStore = (E803word *) calloc(8194,sizeof(E803word));  //8194 ???
-    }
-    else
+    memset(cpu,0,sizeof(E803Machine));
+
+    if(coreStore == NULL)
     {
-	CoreStore = (E803word *) coreImage;
+	coreStore = (E803word *) calloc(8194,sizeof(E803word));  //8194 ???
     }
+    cpu->CoreStore = coreStore;
 
     for(n=0;n<4;n++)
     {
@@ -1787,13 +2556,123 @@ void StartEmulate(char *coreImage)
 	sscanf(T1[n],"%2" SCNo64 "%" SCNu64 "%c %2" SCNo64 "%" SCNu64,&f1,&n1,&b,&f2,&n2);
 	bbit = (b == '/')?1:0 ;
 	II = (f1 << 33) | (n1 << 20) | (bbit << 19) | (f2 << 13) | n2;
-	CoreStore[n] = II;
+	cpu->CoreStore[n] = II;
     }
+#if DECODE_CACHE
+    cpu->DecodedStore = (DecodedWord *) calloc(8192,sizeof(DecodedWord));
+#endif
+    cpu->ChainEpoch = 1;
+    cpu->handler = functions[0];   // R starts clear so the first word time executes
+    cpu->CPUVolume = 0x100;
+    cpu->PeripheralEventAt = -1;
+    cpu->wire = noWires;
+    cpu->sound = NULL;
+}
+
+// Frees the decoded store.  The core store belongs to the caller.
+void FreeMachine(E803Machine *cpu)
+{
+#if DECODE_CACHE
+    freeChains(cpu);
+#endif
+    free(cpu->DecodedStore);
+    cpu->DecodedStore = NULL;
+}
+
+/* Put the state of a machine saved in a snapshot into cpu.  What cpu is
+   connected to, its store, its engine and the operator's buttons and
+   volume knob are left as they are.  The store is restored separately
+   and the decoded store must then be flushed. */
+void RestoreMachine(E803Machine *cpu,const E803Machine *saved)
+{
+    E803Machine now = *cpu;
+
+    *cpu = *saved;
+
+    cpu->WG = now.WG;
+    cpu->WG_ControlButtons = now.WG_ControlButtons;
+    cpu->WG_operate_pressed = now.WG_operate_pressed;
+    cpu->CPUVolume = now.CPUVolume;
+    cpu->wire = now.wire;
+    cpu->wireData = now.wireData;
+    cpu->sound = now.sound;
+    cpu->CoreStore = now.CoreStore;
+    cpu->DecodedStore = now.DecodedStore;
+    cpu->ThreadedEngine = now.ThreadedEngine;
+    cpu->ChainEpoch = now.ChainEpoch;
+    cpu->Profile = now.Profile;
+    cpu->Trace = now.Trace;
+    cpu->Breakpoints = now.Breakpoints;
+    cpu->Rewind = now.Rewind;
+    cpu->Scheduler = now.Scheduler;
+
+    // Events stay as far ahead as they were
+    if(cpu->Scheduler != NULL)
+	SchedulerShift(cpu->Scheduler,cpu->CPU_word_time_count - now.CPU_word_time_count);
+
+    cpu->fn &= 077;
+    cpu->handler = functions[cpu->fn];
+}
+
+/* The fields that are the state of the 803 itself, in the order they
+   are saved in snapshots.  The host's pointers, the engine, the
+   operator's buttons and whatever the machine is connected to are left
+   out, and so is the padding between fields. */
+#define MACHINE_FIELD(name) SNAPSHOT_FIELD(E803Machine,name)
+
+static const SnapshotField MachineFields[] = {
+    MACHINE_FIELD(ACC),MACHINE_FIELD(AR),MACHINE_FIELD(MREG),MACHINE_FIELD(STORE_CHAIN),
+    MACHINE_FIELD(QACC),MACHINE_FIELD(QAR),MACHINE_FIELD(MANTREG),MACHINE_FIELD(T),
+    MACHINE_FIELD(EXPREG),MACHINE_FIELD(BREG),MACHINE_FIELD(IR),MACHINE_FIELD(SCR),
+    MACHINE_FIELD(STORE_MS),MACHINE_FIELD(STORE_LS),MACHINE_FIELD(IR_saved),
+    MACHINE_FIELD(S),MACHINE_FIELD(SS25),MACHINE_FIELD(WI),MACHINE_FIELD(SS2),
+    MACHINE_FIELD(SS3),MACHINE_FIELD(R),MACHINE_FIELD(FPO),MACHINE_FIELD(OFLOW),
+    MACHINE_FIELD(PARITY),MACHINE_FIELD(L),MACHINE_FIELD(LW),MACHINE_FIELD(B),
+    MACHINE_FIELD(M),MACHINE_FIELD(N),MACHINE_FIELD(NEGA),MACHINE_FIELD(Z),
+    MACHINE_FIELD(GPFOUR),MACHINE_FIELD(TC),MACHINE_FIELD(J),
+    MACHINE_FIELD(M_sign),MACHINE_FIELD(mulACCmant),MACHINE_FIELD(mulRound),
+    MACHINE_FIELD(divTshiftBit),MACHINE_FIELD(divTBit),MACHINE_FIELD(divACCmant),
+    MACHINE_FIELD(divFirstbit),MACHINE_FIELD(divExact),
+    MACHINE_FIELD(CpuRunning),MACHINE_FIELD(DM160s_bright),MACHINE_FIELD(PTSBusyBright),
+    MACHINE_FIELD(Ready),MACHINE_FIELD(TRLines),MACHINE_FIELD(PeripheralEventAt),
+    MACHINE_FIELD(CPU_word_time_count),MACHINE_FIELD(Looping),MACHINE_FIELD(Idle),
+    MACHINE_FIELD(ADDRESS),MACHINE_FIELD(fn)
+};
+
+// Append the state of the 803 to data, one field after another.
+void SaveMachineState(const E803Machine *cpu,GByteArray *data)
+{
+    SnapshotSaveFields(data,cpu,MachineFields,G_N_ELEMENTS(MachineFields));
+}
+
+/* Put back the state saved by SaveMachineState(), leaving everything
+   else as RestoreMachine() does.  False if length is wrong. */
+bool RestoreMachineState(E803Machine *cpu,const uint8_t *data,size_t length)
+{
+    E803Machine saved = *cpu;
+
+    if(length != SnapshotFieldsLength(MachineFields,G_N_ELEMENTS(MachineFields))) return false;
+
+    SnapshotRestoreFields(&saved,data,MachineFields,G_N_ELEMENTS(MachineFields));
+    RestoreMachine(cpu,&saved);
+    return true;
+}
+
+// Pass the machine's outputs on to the wiring bus.
+static void wireToBus(__attribute__((unused)) E803Machine *cpu,
+		      enum WiringEvent event,unsigned int value)
+{
+    wiring(event,value);
+}
+
+// Called from CpuInit
+void StartEmulate(char *coreImage)
+{
+    InitMachine(WiredMachine,(E803word *) coreImage);
+    WiredMachine->wire = wireToBus;
 
     connectWires(SUPPLIES_ON,cpuPowerOn);
     connectWires(SUPPLIES_OFF,cpuPowerOff);
     connectWires(READY,setReady);
     connectWires(TRLINES,setTRLines);
 }
-
-
@@ -8,13 +8,125 @@
 #pragma once
 /* variables in the emulator that are used by network event handlers */
 
+#include <stdint.h>
+#include <stdbool.h>
+#include "E803-types.h"
+#include "Wiring.h"
+
 #define UPDATE_RATE 5
 //float channel1charTime,channel2charTime,channel3charTime;
 
-void Emulate(int wordTimesToEmulate);
-void PreEmulate(bool updateFlag);
-void PostEmulate(bool updateFlag);
+/* Everything about one 803.  Nothing in Emulate.c is kept anywhere
+   else, so any number of machines can be run, each from one thread
+   at a time. */
+typedef struct _e803Machine E803Machine;
+
+struct _e803Machine
+{
+    /* Various 803 registers */
+    E803word ACC;           // The Accumulator
+    E803word AR;            // Auxillary register used in double length working
+    E803word MREG;          // Multipler
+    E803word STORE_CHAIN;   // Data read from and written back into store
+    E803word WG;            // value on the Word Generator buttons
+    E803word QACC,QAR;      // Q register for double length multiply  
+    E803word MANTREG;       // Mantissa and Exponents in fp maths 
+    int T;                  // Number of places to shift in Gp 5 
+    int EXPREG;
+
+    /* Short values */
+    int32_t BREG;       // For B modification 
+    int32_t IR;         // Instruction register 
+    int32_t SCR;        // Sequence Control Register 
+    int32_t STORE_MS;   // Top half on store chain 
+    int32_t STORE_LS;   // Bottom half on store chain 
+    int32_t IR_saved;
+
+    /* Various 803 internal sisnals */
+    bool S;
+    bool SS25;
+    bool WI;         // Something to do with manual data
+    bool SS2,SS3;    // Timing for operate to clear busy on Fn70
+    bool R;          //  Beat counter (R=Fetch,!R=Execute)
+    bool FPO;        // Gp6 / floating point overflow 
+    bool OFLOW;      // Integer overflow flag
+    bool PARITY;
+    bool L;          // Long function, prolongs R-bar (execute) phase
+    bool LW;         // Last word time in some long functions */
+    bool B;          // Busy
+    bool M;          // B Modifier flag
+    bool N;          // Read Button
+    bool NEGA,Z;
+    bool GPFOUR;     // surpresses execute phase for jumps 
+    bool TC;         // Transfer Contol for jumps
+    bool J;          // Interrrupt request (unused) 
+
+    /* Kept from one word time to the next by long functions */
+    E803word M_sign;                 // Sign of the divisor in fn56
+    E803word mulACCmant;             // fn63
+    int mulRound;
+    E803word divTshiftBit,divTBit;   // fn64
+    E803word divACCmant;
+    int divFirstbit,divExact;
+
+    /* Control panel */
+    unsigned int WG_ControlButtons;    // State of the buttons like Reset etc 
+    bool WG_operate_pressed;
+    bool CpuRunning;
+    int DM160s_bright[7];
+    int PTSBusyBright;
+    int16_t CPUVolume;
+
+    /* Peripherals.  READY and TRLINES come back in Ready and TRLines.
+       PeripheralEventAt is the word time at which a peripheral that has
+       just refused READY will accept, or -1 if that depends on
+       something outside the emulation and can wait for the next call
+       to Emulate(). */
+    void (*wire)(E803Machine *cpu,enum WiringEvent event,unsigned int value);
+    void *wireData;
+    bool Ready;
+    unsigned int TRLines;
+    int64_t PeripheralEventAt;
+
+    /* Where the CPU sound goes, or NULL */
+    struct _e803CpuSound *sound;
+
+    /* Emulation variables.  The word time count is 64 bits so that it
+       never wraps, 32 would only last for a week. */
+    int64_t CPU_word_time_count;
+    E803word *CoreStore;
+    struct _decodedWord *DecodedStore;
+    bool ThreadedEngine;
+    uint64_t ChainEpoch;  // Goes up when a word in a threaded code chain is written
+    bool Looping;     // Last fetch was a jump to itself
+    bool Idle;        // Waiting for something outside the CPU
+    struct _e803Profile *Profile;   // Execution counters, or NULL when not profiling
+    struct _e803Trace *Trace;       // Instruction trace ring, or NULL when not tracing
+    struct _e803Breakpoints *Breakpoints;   // Breakpoints and watchpoints, or NULL
+    struct _e803Rewind *Rewind;     // Checkpoints for going backwards, or NULL
+    struct _e803Scheduler *Scheduler;   // Events at given word times, or NULL
+
+    /* Current instruction */
+    int ADDRESS,fn;
+    void (*handler)(E803Machine *cpu);
+};
+
+// The machine on the wiring bus, driven by the GUI and ALSA.
+extern E803Machine *WiredMachine;
+
+void InitMachine(E803Machine *cpu,E803word *coreStore);
+void FreeMachine(E803Machine *cpu);
+void RestoreMachine(E803Machine *cpu,const E803Machine *saved);
+void SaveMachineState(const E803Machine *cpu,GByteArray *data);
+bool RestoreMachineState(E803Machine *cpu,const uint8_t *data,size_t length);
+
+void Emulate(E803Machine *cpu,int wordTimesToEmulate);
+void PreEmulate(E803Machine *cpu,bool updateFlag);
+void PostEmulate(E803Machine *cpu,bool updateFlag);
 void StartEmulate(char *coreFileName);
+void flushDecodedStore(E803Machine *cpu);
+void setThreadedEngine(E803Machine *cpu,bool threaded);
+bool emulatorIdle(E803Machine *cpu);
 
 void ReadFileToBuffer(char *filename);
 int getComputer_on_state(void);
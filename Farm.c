@@ -0,0 +1,415 @@
+/*  This file is part of the Elliott 803 emulator.
+
+    Copyright © 2020  Peter Onion
+
+    See LICENCE file. 
+*/
+
+/* Headless farm for running lots of 803 programs at once.  Each job is
+   a core image, a tape for the reader and a budget of word times.  Jobs
+   are run a quantum of word times at a time by a pool of worker
+   threads.  Each worker has its own deque of jobs, taking its next job
+   from the tail and putting a part run job back there, so it keeps on
+   with the job it has warmed its cache up with.  When it runs out it
+   steals from the heads of the other workers' deques, the end that
+   their owners never touch. */
+
+#define G_LOG_USE_STRUCTURED
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+
+#include "E803-types.h"
+#include "Emulate.h"
+#include "Cpu.h"
+#include "FilePTS.h"
+
+typedef struct _farmJob
+{
+    int number;
+    gchar *coreFileName;        // NULL for a clear store
+    gchar *tapeFileName;        // NULL for no tape
+    gint64 budget;              // Word times to run for
+    int startAddress;
+    gint64 wordTimesRun;
+    gboolean started;
+    gboolean failed;            // The core or tape could not be loaded
+    const char *result;         // Why the job finished
+    E803Machine cpu;
+    FilePTS pts;
+} FarmJob;
+
+typedef struct _farmWorker
+{
+    int id;
+    GMutex lock;
+    GQueue jobs;
+    GThread *thread;
+    unsigned int quanta;
+    unsigned int steals;
+} FarmWorker;
+
+static gint threadCount = 0;
+static gint quantum = 100000;
+static gchar *outputDirectory = NULL;
+static gboolean threadedEngine = FALSE;
+
+static FarmWorker *Workers = NULL;
+static gint JobsLeft = 0;
+static gint JobsFailed = 0;
+
+// Command line options
+static GOptionEntry entries[] =
+{
+    { "threads", 'j', 0, G_OPTION_ARG_INT, &threadCount, "Number of worker threads (default one per processor).", "N" },
+    { "quantum", 'q', 0, G_OPTION_ARG_INT, &quantum, "Word times to run a job for before moving on to another.", "N" },
+    { "output", 'o', 0, G_OPTION_ARG_FILENAME, &outputDirectory, "Directory for the punched tapes and core images.", "DIR" },
+    { "threaded", 't' , 0,  G_OPTION_ARG_NONE, &threadedEngine, "Use the threaded code execution engine.",NULL},
+    { NULL }
+};
+
+/* Add the jobs in a job list to jobs.  Each line is
+       core-image tape-file word-times [start-address]
+   with "-" for a clear store or an empty reader.  Everything after
+   a '#' is ignored. */
+static gboolean readJobList(const gchar *fileName,GPtrArray *jobs)
+{
+    gchar *contents,**lines,**fields,*hash;
+    const gchar *words[4];
+    GError *error = NULL;
+    FarmJob *job;
+    int lineNumber,count;
+    gboolean ok = TRUE;
+
+    if(!g_file_get_contents(fileName,&contents,NULL,&error))
+    {
+	g_warning("Failed to read job list %s (%s)\n",fileName,error->message);
+	g_error_free(error);
+	return FALSE;
+    }
+
+    lines = g_strsplit(contents,"\n",-1);
+    g_free(contents);
+
+    for(lineNumber = 0; lines[lineNumber] != NULL; lineNumber++)
+    {
+	if((hash = strchr(lines[lineNumber],'#')) != NULL) *hash = '\0';
+
+	fields = g_strsplit_set(lines[lineNumber]," \t\r",-1);
+	count = 0;
+	for(int n = 0; fields[n] != NULL; n++)
+	{
+	    if(fields[n][0] == '\0') continue;
+	    if(count < 4) words[count] = fields[n];
+	    count += 1;
+	}
+
+	if(count != 0)
+	{
+	    if((count < 3) || (count > 4))
+	    {
+		g_warning("%s:%d: expected core-image tape-file word-times [start-address]\n",
+			  fileName,lineNumber+1);
+		ok = FALSE;
+	    }
+	    else
+	    {
+		job = g_new0(FarmJob,1);
+		job->number = (int) jobs->len + 1;
+		job->coreFileName = strcmp(words[0],"-") ? g_strdup(words[0]) : NULL;
+		job->tapeFileName = strcmp(words[1],"-") ? g_strdup(words[1]) : NULL;
+		job->budget = g_ascii_strtoll(words[2],NULL,0);
+		job->startAddress = (count == 4) ? (int) g_ascii_strtoll(words[3],NULL,0) : 0;
+
+		if((job->budget <= 0) || (job->startAddress < 0) || (job->startAddress > 8191))
+		{
+		    g_warning("%s:%d: bad word-times or start-address\n",fileName,lineNumber+1);
+		    g_free(job->coreFileName);
+		    g_free(job->tapeFileName);
+		    g_free(job);
+		    ok = FALSE;
+		}
+		else
+		{
+		    g_ptr_array_add(jobs,job);
+		}
+	    }
+	}
+	g_strfreev(fields);
+    }
+    g_strfreev(lines);
+    return ok;
+}
+
+// Load the core and tape, then start the machine from startAddress.
+static gboolean startJob(FarmJob *job)
+{
+    E803word *core = NULL;
+    GError *error = NULL;
+
+    job->started = TRUE;
+
+    if(job->coreFileName != NULL)
+    {
+	core = LoadCoreImage(job->coreFileName,&error);
+	if(core == NULL)
+	{
+	    g_warning("Job %d: failed to open core file %s (%s)\n",
+		      job->number,job->coreFileName,error->message);
+	    g_error_free(error);
+	    job->result = "no core image";
+	    job->failed = TRUE;
+	    return FALSE;
+	}
+    }
+    else
+    {
+	core = (E803word *) calloc(8194,sizeof(E803word));
+    }
+
+    InitMachine(&job->cpu,core);
+    FilePTSInit(&job->pts);
+    FilePTSConnect(&job->pts,&job->cpu);
+    setThreadedEngine(&job->cpu,threadedEngine ? true : false);
+
+    if(job->tapeFileName != NULL)
+    {
+	if(!FilePTSLoadTape(&job->pts,job->tapeFileName,&error))
+	{
+	    g_warning("Job %d: failed to open tape file %s (%s)\n",
+		      job->number,job->tapeFileName,error->message);
+	    g_error_free(error);
+	    job->result = "no tape";
+	    job->failed = TRUE;
+	    return FALSE;
+	}
+    }
+
+    // As if the supplies had been turned on and the operator had
+    // obeyed a jump to the start address.
+    job->cpu.CpuRunning = true;
+    job->cpu.S = false;
+    job->cpu.R = true;
+    job->cpu.SCR = job->startAddress << 1;
+    job->cpu.IR = job->startAddress;
+    return TRUE;
+}
+
+// Run one quantum.  Returns TRUE when the job has finished.
+static gboolean runQuantum(FarmJob *job)
+{
+    gint64 wordTimes;
+    E803Machine *cpu = &job->cpu;
+
+    if(!job->started && !startJob(job))
+    {
+	return TRUE;
+    }
+
+    wordTimes = job->budget - job->wordTimesRun;
+    if(wordTimes > quantum) wordTimes = quantum;
+
+    Emulate(cpu,(int) wordTimes);
+    job->wordTimesRun += wordTimes;
+
+    if(cpu->S)
+	job->result = "stopped";
+    else if(cpu->R && cpu->Looping)
+	job->result = "dynamic stop";
+    else if(FilePTSReaderEmpty(&job->pts,cpu))
+	job->result = "tape ran out";
+    else if(job->wordTimesRun >= job->budget)
+	job->result = "word times used up";
+    else
+	return FALSE;
+
+    return TRUE;
+}
+
+static void finishJob(FarmJob *job)
+{
+    GError *error = NULL;
+    gchar *fileName;
+
+    if(job->failed)
+    {
+	g_print("job %d: %s\n",job->number,job->result);
+	g_atomic_int_inc(&JobsFailed);
+    }
+    else
+    {
+	fileName = g_strdup_printf("%s/job%04d.punch",outputDirectory,job->number);
+	if(!FilePTSSavePunched(&job->pts,fileName,&error))
+	{
+	    g_warning("Job %d: %s\n",job->number,error->message);
+	    g_clear_error(&error);
+	}
+	g_free(fileName);
+
+	fileName = g_strdup_printf("%s/job%04d.core",outputDirectory,job->number);
+	if(!SaveCoreImage(fileName,job->cpu.CoreStore,&error))
+	{
+	    g_warning("Job %d: %s\n",job->number,error->message);
+	    g_clear_error(&error);
+	}
+	g_free(fileName);
+
+	g_print("job %d: %s after %" G_GINT64_FORMAT " word times, %u characters punched\n",
+		job->number,job->result,job->wordTimesRun,job->pts.punched->len);
+    }
+
+    if(job->cpu.CoreStore != NULL)
+    {
+	free(job->cpu.CoreStore);
+	FreeMachine(&job->cpu);
+	FilePTSTidy(&job->pts);
+    }
+}
+
+// Take the job another worker would have got to last.
+static FarmJob *stealJob(FarmWorker *self)
+{
+    FarmWorker *victim;
+    FarmJob *job;
+
+    for(int n = 1; n < threadCount; n++)
+    {
+	victim = &Workers[(self->id + n) % threadCount];
+	g_mutex_lock(&victim->lock);
+	job = g_queue_pop_head(&victim->jobs);
+	g_mutex_unlock(&victim->lock);
+	if(job != NULL)
+	{
+	    self->steals += 1;
+	    return job;
+	}
+    }
+    return NULL;
+}
+
+static gpointer farmWorker(gpointer data)
+{
+    FarmWorker *self = (FarmWorker *) data;
+    FarmJob *job;
+
+    while(g_atomic_int_get(&JobsLeft) > 0)
+    {
+	g_mutex_lock(&self->lock);
+	job = g_queue_pop_tail(&self->jobs);
+	g_mutex_unlock(&self->lock);
+
+	if(job == NULL) job = stealJob(self);
+
+	if(job == NULL)
+	{   // Everything left is being run by other workers.
+	    g_usleep(1000);
+	    continue;
+	}
+
+	self->quanta += 1;
+	if(runQuantum(job))
+	{
+	    finishJob(job);
+	    g_atomic_int_add(&JobsLeft,-1);
+	}
+	else
+	{
+	    g_mutex_lock(&self->lock);
+	    g_queue_push_tail(&self->jobs,job);
+	    g_mutex_unlock(&self->lock);
+	}
+    }
+    return NULL;
+}
+
+int main(int argc,char **argv)
+{
+    GOptionContext *context;
+    GError *error = NULL;
+    GPtrArray *jobs;
+    gboolean jobListsOk = TRUE;
+    gint64 started,wordTimes;
+    double elapsed;
+    FarmJob *job;
+
+    context = g_option_context_new ("JOBLIST... - Elliott 803 batch farm");
+    g_option_context_set_summary(context,
+				 "Each line of a job list is\n"
+				 "  core-image tape-file word-times [start-address]\n"
+				 "with - for a clear store or an empty reader.  Jobs start by\n"
+				 "jumping to start-address, which defaults to the initial instructions.");
+    g_option_context_add_main_entries (context, entries, NULL);
+    if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_print ("option parsing failed: %s\n", error->message);
+      exit (1);
+    }
+
+    if(argc < 2)
+    {
+	g_print("No job lists given.\n");
+	exit(1);
+    }
+
+    if(threadCount <= 0) threadCount = (gint) g_get_num_processors();
+    if(quantum <= 0) quantum = 100000;
+    if(outputDirectory == NULL) outputDirectory = g_strdup(".");
+
+    if(g_mkdir_with_parents(outputDirectory,0755) != 0)
+    {
+	g_error("Could not create output directory %s\n",outputDirectory);
+    }
+
+    jobs = g_ptr_array_new();
+    for(int n = 1; n < argc; n++)
+    {
+	jobListsOk &= readJobList(argv[n],jobs);
+    }
+
+    if(!jobListsOk || (jobs->len == 0))
+    {
+	g_print("Nothing to do.\n");
+	exit(1);
+    }
+
+    // Deal the jobs out to the workers.
+    Workers = g_new0(FarmWorker,threadCount);
+    for(int n = 0; n < threadCount; n++)
+    {
+	Workers[n].id = n;
+	g_mutex_init(&Workers[n].lock);
+	g_queue_init(&Workers[n].jobs);
+    }
+    for(guint n = 0; n < jobs->len; n++)
+    {
+	g_queue_push_tail(&Workers[n % (guint) threadCount].jobs,g_ptr_array_index(jobs,n));
+    }
+    JobsLeft = (gint) jobs->len;
+
+    started = g_get_monotonic_time();
+    for(int n = 0; n < threadCount; n++)
+    {
+	Workers[n].thread = g_thread_new("Farm worker",farmWorker,&Workers[n]);
+    }
+    for(int n = 0; n < threadCount; n++)
+    {
+	g_thread_join(Workers[n].thread);
+	g_debug("Worker %d ran %u quanta and stole %u jobs\n",n,Workers[n].quanta,Workers[n].steals);
+    }
+    elapsed = (double) (g_get_monotonic_time() - started) / 1.0E6;
+
+    wordTimes = 0;
+    for(guint n = 0; n < jobs->len; n++)
+    {
+	job = g_ptr_array_index(jobs,n);
+	wordTimes += job->wordTimesRun;
+    }
+    g_print("%u jobs, %" G_GINT64_FORMAT " word times in %.3f seconds (%.1f times real time)\n",
+	    jobs->len,wordTimes,elapsed,
+	    (elapsed > 0.0) ? ((double) wordTimes * 288.0E-6) / elapsed : 0.0);
+
+    return (JobsFailed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
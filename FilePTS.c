@@ -0,0 +1,199 @@
+/*  This file is part of the Elliott 803 emulator.
+
+    Copyright © 2020  Peter Onion
+
+    See LICENCE file. 
+*/
+
+// PTS for headless machines.  Tapes are files, one row per byte.
+#define G_LOG_USE_STRUCTURED
+
+#include <stdbool.h>
+#include <string.h>
+#include <glib.h>
+#include "FilePTS.h"
+#include "Wiring.h"
+#include "Emulate.h"
+#include "Snapshot.h"
+
+void FilePTSInit(FilePTS *pts)
+{
+    TapeInit(&pts->tape);
+    pts->tapeRunOut = FALSE;
+    pts->punched = g_byte_array_new();
+    pts->CLines = pts->TRlines = 0;
+    pts->F71 = pts->F74 = FALSE;
+    pts->F74BusyUntil = 0;
+}
+
+// Put a tape in the reader.
+gboolean FilePTSLoadTape(FilePTS *pts,const gchar *fileName,GError **error)
+{
+    if(!TapeMap(&pts->tape,fileName,error))
+    {
+	return FALSE;
+    }
+    pts->tapeRunOut = FALSE;
+    return TRUE;
+}
+
+gboolean FilePTSSavePunched(FilePTS *pts,const gchar *fileName,GError **error)
+{
+    return g_file_set_contents(fileName,(const gchar *) pts->punched->data,
+			       (gssize) pts->punched->len,error);
+}
+
+// The same protocol as the PTS on the wiring bus, but talking
+// straight to one machine.
+static void filePTSWire(E803Machine *cpu,enum WiringEvent event,unsigned int value)
+{
+    FilePTS *pts = (FilePTS *) cpu->wireData;
+    guint8 character;
+
+    switch(event)
+    {
+	case CLINES:
+	    pts->CLines = value;
+	    break;
+
+	case F71:
+	    pts->F71 = (value == 1);
+	    if(pts->F71)
+	    {
+		if(TapeRead(&pts->tape,&character))
+		{
+		    pts->TRlines = character & 0x3F;
+		    cpu->Ready = true;
+		}
+		else
+		{
+		    pts->tapeRunOut = TRUE;
+		}
+	    }
+	    break;
+
+	case F74:
+	    pts->F74 = (value == 1);
+	    if(pts->F74)
+	    {
+		if(cpu->CPU_word_time_count >= pts->F74BusyUntil)
+		{
+		    pts->F74BusyUntil = cpu->CPU_word_time_count + 347;
+		    cpu->Ready = true;
+		}
+		else
+		{
+		    // Let the CPU skip ahead to when the punch is free
+		    cpu->PeripheralEventAt = pts->F74BusyUntil;
+		}
+	    }
+	    break;
+
+	case ACT:
+	    if(value == 1)
+	    {
+		if(pts->F71)
+		{
+		    cpu->TRLines = pts->TRlines & 0x1F;
+		    cpu->Ready = false;
+		}
+		if(pts->F74)
+		{
+		    character = (guint8) (pts->CLines & 0x1F);
+		    g_byte_array_append(pts->punched,&character,1);
+		    cpu->Ready = false;
+		}
+	    }
+	    else
+	    {
+		if(pts->F71)
+		    cpu->TRLines = 0;
+	    }
+	    break;
+
+	default:
+	    break;
+    }
+}
+
+// TRUE if the CPU is held in F71 waiting for tape that isn't there.
+gboolean FilePTSReaderEmpty(FilePTS *pts,E803Machine *cpu)
+{
+    return (cpu->B && pts->F71 && pts->tapeRunOut) ? TRUE : FALSE;
+}
+
+void FilePTSConnect(FilePTS *pts,E803Machine *cpu)
+{
+    cpu->wire = filePTSWire;
+    cpu->wireData = pts;
+}
+
+/* Snapshots hold what is left of the tape and everything punched so
+   far, so a restored machine carries on from the same character. */
+typedef struct
+{
+    gsize tapeLength;
+    guint punchedLength;
+    unsigned int CLines,TRlines;
+    gboolean tapeRunOut,F71,F74;
+    int64_t F74BusyUntil;
+} FilePTSState;
+
+#define FILE_PTS_FIELD(name) SNAPSHOT_FIELD(FilePTSState,name)
+
+static const SnapshotField FilePTSFields[] = {
+    FILE_PTS_FIELD(tapeLength),FILE_PTS_FIELD(punchedLength),FILE_PTS_FIELD(CLines),
+    FILE_PTS_FIELD(TRlines),FILE_PTS_FIELD(tapeRunOut),FILE_PTS_FIELD(F71),FILE_PTS_FIELD(F74),
+    FILE_PTS_FIELD(F74BusyUntil)
+};
+
+void FilePTSSnapshotSave(FilePTS *pts,GByteArray *data)
+{
+    FilePTSState saved;
+
+    saved.tapeLength = TapeUnread(&pts->tape);
+    saved.punchedLength = pts->punched->len;
+    saved.CLines = pts->CLines;
+    saved.TRlines = pts->TRlines;
+    saved.tapeRunOut = pts->tapeRunOut;
+    saved.F71 = pts->F71;
+    saved.F74 = pts->F74;
+    saved.F74BusyUntil = pts->F74BusyUntil;
+
+    SnapshotSaveFields(data,&saved,FilePTSFields,G_N_ELEMENTS(FilePTSFields));
+    TapeSaveUnread(&pts->tape,data);
+    g_byte_array_append(data,pts->punched->data,pts->punched->len);
+}
+
+gboolean FilePTSSnapshotRestore(FilePTS *pts,const guint8 *data,gsize length)
+{
+    FilePTSState saved;
+    gsize fieldsLength = SnapshotFieldsLength(FilePTSFields,G_N_ELEMENTS(FilePTSFields));
+
+    if(length < fieldsLength) return FALSE;
+    data = SnapshotRestoreFields(&saved,data,FilePTSFields,G_N_ELEMENTS(FilePTSFields));
+    if(((length - fieldsLength) < saved.tapeLength) ||
+       ((length - fieldsLength - saved.tapeLength) != saved.punchedLength))
+	return FALSE;
+
+    TapeHold(&pts->tape,data,saved.tapeLength);
+    data += saved.tapeLength;
+
+    g_byte_array_set_size(pts->punched,0);
+    g_byte_array_append(pts->punched,data,saved.punchedLength);
+
+    pts->CLines = saved.CLines;
+    pts->TRlines = saved.TRlines;
+    pts->tapeRunOut = saved.tapeRunOut;
+    pts->F71 = saved.F71;
+    pts->F74 = saved.F74;
+    pts->F74BusyUntil = saved.F74BusyUntil;
+    return TRUE;
+}
+
+void FilePTSTidy(FilePTS *pts)
+{
+    TapeTidy(&pts->tape);
+    g_byte_array_unref(pts->punched);
+    pts->punched = NULL;
+}
@@ -0,0 +1,34 @@
+/*  This file is part of the Elliott 803 emulator.
+
+    Copyright © 2020  Peter Onion
+
+    See LICENCE file. 
+*/
+
+#pragma once
+/* A paper tape station for machines that are not on the wiring bus.
+   The reader is fed from a tape file and everything punched is kept
+   in memory until it is written out. */
+
+#include <glib.h>
+#include "Emulate.h"
+#include "Tape.h"
+
+typedef struct _filePTS
+{
+    E803Tape tape;              // Tape in the reader
+    gboolean tapeRunOut;        // F71 when there was no tape left
+    GByteArray *punched;        // Characters sent to the punch
+    unsigned int CLines,TRlines;
+    gboolean F71,F74;
+    int64_t F74BusyUntil;
+} FilePTS;
+
+void FilePTSInit(FilePTS *pts);
+gboolean FilePTSLoadTape(FilePTS *pts,const gchar *fileName,GError **error);
+gboolean FilePTSSavePunched(FilePTS *pts,const gchar *fileName,GError **error);
+void FilePTSConnect(FilePTS *pts,E803Machine *cpu);
+gboolean FilePTSReaderEmpty(FilePTS *pts,E803Machine *cpu);
+void FilePTSSnapshotSave(FilePTS *pts,GByteArray *data);
+gboolean FilePTSSnapshotRestore(FilePTS *pts,const guint8 *data,gsize length);
+void FilePTSTidy(FilePTS *pts);
@@ -25,6 +25,7 @@
 #include "Wiring.h"
 #include "Logging.h"
 #include "Common.h"
+#include "Cpu.h"
 
 extern void FrontOffset2(HandInfo *hand);
 
@@ -398,6 +399,26 @@ gboolean on_eventBox_key_press_event(__attribute__((unused))GtkWidget *widget,
 	gtk_main_quit();
 	break;
 
+    case GDK_KEY_p:
+	// Start profiling, or stop and write it to the config directory
+	CpuProfileToggle();
+	break;
+
+    case GDK_KEY_t:
+	// The same for the instruction trace
+	CpuTraceToggle();
+	break;
+
+    case GDK_KEY_s:
+	// Snapshot the whole emulator into the config directory
+	CpuSnapshotSave();
+	break;
+
+    case GDK_KEY_r:
+	// And go back to it
+	CpuSnapshotRestore();
+	break;
+
 
     case GDK_KEY_z:
 	if((!shiftPressed) && (!controlPressed))
@@ -0,0 +1,408 @@
+/*  This file is part of the Elliott 803 emulator.
+
+    Copyright © 2020  Peter Onion
+
+    See LICENCE file. 
+*/
+
+/* Recording and playing back journals.  A recording machine has its
+   wire wrapped so that transfers are seen after the peripheral has
+   answered, and the rest comes from the wiring monitor.  Playing back
+   wraps the wire again so that the reader is answered from the journal
+   instead, while the punch and plotter still get their characters. */
+
+#define G_LOG_USE_STRUCTURED
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "Journal.h"
+#include "Snapshot.h"
+#include "wg-definitions.h"
+
+// The journals the wiring bus is being recorded into or played back from
+static E803Journal *Recording = NULL;
+static E803Journal *Replaying = NULL;
+
+static void addRecord(E803Journal *journal,enum WiringEvent event,unsigned int value)
+{
+    E803JournalRecord record;
+
+    record.wordTime = (uint64_t) journal->cpu->CPU_word_time_count;
+    record.event = event;
+    record.value = value;
+    g_array_append_val(journal->records,record);
+}
+
+// Only the wires that change the machine, the rest follow from them.
+static void monitor(enum WiringEvent event,unsigned int values)
+{
+    switch(event)
+    {
+    case SUPPLIES_ON:
+    case SUPPLIES_OFF:
+    case F1WIRES:
+    case N1WIRES:
+    case F2WIRES:
+    case N2WIRES:
+    case RONWIRES:
+    case MDWIRE:
+    case RESETWIRE:
+    case CSWIRE:
+    case SSWIRE:
+    case OPERATEWIRE:
+	addRecord(Recording,event,values);
+	break;
+    default:
+	break;
+    }
+}
+
+// Pass everything on, then note what was transferred.
+static void recordWire(E803Machine *cpu,enum WiringEvent event,unsigned int value)
+{
+    E803Journal *journal = Recording;
+
+    (journal->wire)(cpu,event,value);
+
+    if(((event == F71) || (event == F72) || (event == F74)) && (value == 1))
+    {
+	journal->asked = event;
+    }
+    else if((event == ACT) && (value == 1))
+    {
+	addRecord(journal,journal->asked,(journal->asked == F71) ? cpu->TRLines : 0);
+    }
+}
+
+static void startRecording(E803Journal *journal)
+{
+    E803Machine *cpu = journal->cpu;
+
+    g_array_set_size(journal->records,0);
+    if(journal->snapshot != NULL) g_byte_array_unref(journal->snapshot);
+    journal->snapshot = SnapshotTake();
+    journal->WG = cpu->WG;
+    journal->buttons = cpu->WG_ControlButtons;
+}
+
+/* Start recording what reaches cpu, which must be the machine on the
+   wiring bus with its peripherals already connected.  Only one journal
+   can record at a time. */
+E803Journal *JournalRecord(E803Machine *cpu)
+{
+    E803Journal *journal;
+
+    journal = (E803Journal *) calloc(1,sizeof(E803Journal));
+    journal->records = g_array_sized_new(FALSE,FALSE,sizeof(E803JournalRecord),4096);
+    journal->cpu = cpu;
+    startRecording(journal);
+
+    journal->wire = cpu->wire;
+    cpu->wire = recordWire;
+    Recording = journal;
+    monitorWiring(monitor);
+    return journal;
+}
+
+// Start again from now, after something that can't be recorded.
+void JournalRestart(E803Journal *journal)
+{
+    startRecording(journal);
+}
+
+void JournalStop(E803Journal *journal)
+{
+    if(Recording != journal) return;
+
+    monitorWiring(NULL);
+    Recording = NULL;
+    journal->cpu->wire = journal->wire;
+    journal->endWordTime = (uint64_t) journal->cpu->CPU_word_time_count;
+    journal->check = JournalCheck(journal->cpu);
+}
+
+gboolean JournalSave(E803Journal *journal,const gchar *fileName,GError **error)
+{
+    E803JournalHeader header;
+    GByteArray *data;
+    gboolean ok;
+
+    memset(&header,0,sizeof(header));
+    memcpy(header.magic,JOURNAL_MAGIC,sizeof(header.magic));
+    header.recordSize = sizeof(E803JournalRecord);
+    header.recordCount = journal->records->len;
+    header.snapshotLength = journal->snapshot->len;
+    header.endWordTime = journal->endWordTime;
+    header.WG = journal->WG;
+    header.buttons = journal->buttons;
+    header.check = journal->check;
+
+    data = g_byte_array_sized_new((guint) sizeof(header) + journal->snapshot->len +
+				  journal->records->len * (guint) sizeof(E803JournalRecord));
+    g_byte_array_append(data,(const guint8 *) &header,sizeof(header));
+    g_byte_array_append(data,journal->snapshot->data,journal->snapshot->len);
+    g_byte_array_append(data,(const guint8 *) journal->records->data,
+			journal->records->len * (guint) sizeof(E803JournalRecord));
+
+    ok = g_file_set_contents(fileName,(const gchar *) data->data,(gssize) data->len,error);
+    g_byte_array_unref(data);
+    return ok;
+}
+
+E803Journal *JournalLoad(const gchar *fileName,GError **error)
+{
+    E803JournalHeader header;
+    E803Journal *journal;
+    gchar *contents;
+    gsize length;
+
+    if(!g_file_get_contents(fileName,&contents,&length,error))
+    {
+	return NULL;
+    }
+
+    if(length >= sizeof(header)) memcpy(&header,contents,sizeof(header));
+    if((length < sizeof(header)) ||
+       (memcmp(header.magic,JOURNAL_MAGIC,sizeof(header.magic)) != 0) ||
+       (header.recordSize != sizeof(E803JournalRecord)) ||
+       (length != (sizeof(header) + header.snapshotLength +
+		   (gsize) header.recordCount * sizeof(E803JournalRecord))))
+    {
+	g_set_error(error,G_FILE_ERROR,G_FILE_ERROR_INVAL,"Not a journal");
+	g_free(contents);
+	return NULL;
+    }
+
+    journal = (E803Journal *) calloc(1,sizeof(E803Journal));
+    journal->snapshot = g_byte_array_new();
+    g_byte_array_append(journal->snapshot,(const guint8 *) contents + sizeof(header),header.snapshotLength);
+    journal->records = g_array_sized_new(FALSE,FALSE,sizeof(E803JournalRecord),header.recordCount);
+    g_array_append_vals(journal->records,contents + sizeof(header) + header.snapshotLength,header.recordCount);
+    journal->WG = header.WG;
+    journal->buttons = header.buttons;
+    journal->endWordTime = header.endWordTime;
+    journal->check = header.check;
+
+    g_free(contents);
+    return journal;
+}
+
+static E803JournalRecord *record(E803Journal *journal,guint n)
+{
+    return (n < journal->records->len) ? &g_array_index(journal->records,E803JournalRecord,n) : NULL;
+}
+
+static bool isTransfer(const E803JournalRecord *r)
+{
+    return (r->event == F71) || (r->event == F72) || (r->event == F74);
+}
+
+static void skipTo(E803Journal *journal,guint *next,bool transfers)
+{
+    E803JournalRecord *r;
+
+    while(((r = record(journal,*next)) != NULL) && (isTransfer(r) != transfers))
+    {
+	*next += 1;
+    }
+}
+
+static void goneAstray(E803Journal *journal,const char *why)
+{
+    if(!journal->astray)
+    {
+	g_warning("Playback differs from the recording at word time %" G_GINT64_FORMAT " (%s)\n",
+		  journal->cpu->CPU_word_time_count,why);
+	journal->astray = true;
+    }
+}
+
+/* Whether the peripheral was ready at this word time when recording.
+   If not and it was later, the CPU can skip ahead to then. */
+static void answer(E803Journal *journal,E803Machine *cpu,enum WiringEvent event)
+{
+    E803JournalRecord *r = record(journal,journal->nextTransfer);
+    uint64_t now = (uint64_t) cpu->CPU_word_time_count;
+
+    cpu->Ready = false;
+    cpu->PeripheralEventAt = -1;
+    if(r == NULL) return;
+
+    if(r->wordTime < now)
+    {
+	goneAstray(journal,"a transfer was missed");
+    }
+    else if(r->event == event)
+    {
+	if(r->wordTime == now)
+	{
+	    cpu->Ready = true;
+	    journal->asked = event;
+	}
+	else
+	{
+	    cpu->PeripheralEventAt = (int64_t) r->wordTime;
+	}
+    }
+}
+
+/* The reader is the journal, the punch and plotter are whatever the
+   machine was connected to. */
+static void replayWire(E803Machine *cpu,enum WiringEvent event,unsigned int value)
+{
+    E803Journal *journal = Replaying;
+    E803JournalRecord *r;
+
+    switch(event)
+    {
+    case F71:
+	if(value == 1) answer(journal,cpu,F71);
+	break;
+
+    case F72:
+    case F74:
+	(journal->wire)(cpu,event,value);
+	if(value == 1) answer(journal,cpu,event);
+	break;
+
+    case ACT:
+	if(journal->asked == F71)
+	{
+	    if(value == 1)
+	    {
+		r = record(journal,journal->nextTransfer);
+		cpu->TRLines = r->value & 0x1F;
+		cpu->Ready = false;
+	    }
+	    else
+	    {
+		cpu->TRLines = 0;
+	    }
+	}
+	else
+	{
+	    (journal->wire)(cpu,event,value);
+	}
+	if(value == 1)
+	{
+	    journal->nextTransfer += 1;
+	    skipTo(journal,&journal->nextTransfer,true);
+	}
+	else
+	{
+	    journal->asked = 0;
+	}
+	break;
+
+    default:
+	(journal->wire)(cpu,event,value);
+	break;
+    }
+}
+
+/* Put cpu, which must be the machine on the wiring bus with its
+   peripherals connected, back as it was when recording started and
+   connect the reader to the journal.  Only one journal can be played
+   back at a time. */
+gboolean JournalReplay(E803Journal *journal,E803Machine *cpu,GError **error)
+{
+    if(!SnapshotRestore(journal->snapshot->data,journal->snapshot->len,error))
+    {
+	return FALSE;
+    }
+    cpu->WG = journal->WG;
+    cpu->WG_ControlButtons = journal->buttons;
+
+    journal->cpu = cpu;
+    journal->replaying = true;
+    journal->asked = 0;
+    journal->astray = false;
+    journal->nextWire = journal->nextTransfer = 0;
+    skipTo(journal,&journal->nextWire,false);
+    skipTo(journal,&journal->nextTransfer,true);
+
+    journal->wire = cpu->wire;
+    cpu->wire = replayWire;
+    Replaying = journal;
+    return TRUE;
+}
+
+/* Put the wires due now on the bus.  Call between calls to Emulate().
+   Returns the word times until the next are due or the journal ends,
+   zero once it has. */
+int JournalInject(E803Journal *journal)
+{
+    E803Machine *cpu = journal->cpu;
+    E803JournalRecord *r;
+    uint64_t now = (uint64_t) cpu->CPU_word_time_count;
+    uint64_t until;
+
+    while(((r = record(journal,journal->nextWire)) != NULL) && (r->wordTime <= now))
+    {
+	if(r->wordTime < now) goneAstray(journal,"the operator was late");
+	wiring((enum WiringEvent) r->event,r->value);
+	journal->nextWire += 1;
+	skipTo(journal,&journal->nextWire,false);
+    }
+
+    until = (r != NULL) ? MIN(r->wordTime,journal->endWordTime) : journal->endWordTime;
+    if(until <= now) return 0;
+    return (int) MIN(until - now,(uint64_t) G_MAXINT);
+}
+
+/* Disconnect the journal once it has been played back.  FALSE if the
+   machine didn't end up as it was when recording stopped. */
+gboolean JournalReplayed(E803Journal *journal)
+{
+    E803Machine *cpu = journal->cpu;
+
+    cpu->wire = journal->wire;
+    Replaying = NULL;
+    journal->replaying = false;
+
+    if(record(journal,journal->nextTransfer) != NULL)
+    {
+	goneAstray(journal,"transfers were left over");
+    }
+    if(JournalCheck(cpu) != journal->check)
+    {
+	goneAstray(journal,"the store or registers are different");
+    }
+    return !journal->astray;
+}
+
+void JournalFree(E803Journal *journal)
+{
+    JournalStop(journal);
+    g_array_free(journal->records,TRUE);
+    if(journal->snapshot != NULL) g_byte_array_unref(journal->snapshot);
+    free(journal);
+}
+
+// FNV-1a of the store and the main registers, to compare runs by.
+uint64_t JournalCheck(E803Machine *cpu)
+{
+    uint64_t hash = 0xCBF29CE484222325ULL;
+    E803word words[5];
+    const uint8_t *bytes;
+
+    words[0] = cpu->ACC;
+    words[1] = cpu->AR;
+    words[2] = (E803word) cpu->SCR;
+    words[3] = (E803word) cpu->IR;
+    words[4] = (E803word) cpu->CPU_word_time_count;
+
+    bytes = (const uint8_t *) cpu->CoreStore;
+    for(gsize n = 0; n < (8192 * sizeof(E803word)); n++)
+    {
+	hash = (hash ^ bytes[n]) * 0x100000001B3ULL;
+    }
+    bytes = (const uint8_t *) words;
+    for(gsize n = 0; n < sizeof(words); n++)
+    {
+	hash = (hash ^ bytes[n]) * 0x100000001B3ULL;
+    }
+    return hash;
+}
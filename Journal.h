@@ -0,0 +1,86 @@
+/*  This file is part of the Elliott 803 emulator.
+
+    Copyright © 2020  Peter Onion
+
+    See LICENCE file. 
+*/
+
+#pragma once
+/* Recording everything that reaches a machine from outside so that a
+   run can be played back exactly.  While recording, the wires from the
+   operator and the power supplies are seen through monitorWiring() and
+   each character read, punched or plotted through the machine's wire.
+   All are kept against the word time they happened at.
+
+   A journal file is a header, a snapshot of the whole emulator taken
+   when recording started and then the records, in the byte order of
+   the machine that wrote them.  The batch runner plays one back with
+   the wires from the journal put on the bus at the same word times and
+   the reader's characters handed over at the same word times, with no
+   GUI or PLTS connected.
+
+   The debugger is not recorded, so changing a register or the store or
+   going backwards while recording will make the playback differ. */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <glib.h>
+#include "E803-types.h"
+#include "Emulate.h"
+#include "Wiring.h"
+
+#define JOURNAL_MAGIC "E803JNL2"
+
+/* A wire from outside, or with event F71, F72 or F74 a transfer of the
+   character in value (TRLINES for the reader) */
+typedef struct _e803JournalRecord
+{
+    uint64_t wordTime;     // CPU_word_time_count when it happened
+    uint32_t event;
+    uint32_t value;
+} E803JournalRecord;
+
+typedef struct _e803JournalHeader
+{
+    char magic[8];
+    uint32_t recordSize;
+    uint32_t recordCount;
+    uint32_t snapshotLength;
+    uint32_t buttons;        // The buttons and word generator when it started
+    E803word WG;
+    uint64_t endWordTime;    // When recording stopped
+    uint64_t check;          // JournalCheck() when recording stopped
+} E803JournalHeader;
+
+typedef struct _e803Journal
+{
+    GArray *records;
+    GByteArray *snapshot;    // As recording started
+    E803word WG;
+    unsigned int buttons;
+    uint64_t endWordTime;
+    uint64_t check;
+
+    // The machine and what its wire was before recording or playing back
+    E803Machine *cpu;
+    void (*wire)(E803Machine *cpu,enum WiringEvent event,unsigned int value);
+
+    bool replaying;
+    enum WiringEvent asked;  // F71, F72 or F74 that is waiting for ACT
+    guint nextWire;          // Next records to play back of each kind
+    guint nextTransfer;
+    bool astray;             // The machine has done something different
+} E803Journal;
+
+E803Journal *JournalRecord(E803Machine *cpu);
+void JournalRestart(E803Journal *journal);
+void JournalStop(E803Journal *journal);
+gboolean JournalSave(E803Journal *journal,const gchar *fileName,GError **error);
+
+E803Journal *JournalLoad(const gchar *fileName,GError **error);
+gboolean JournalReplay(E803Journal *journal,E803Machine *cpu,GError **error);
+int JournalInject(E803Journal *journal);
+gboolean JournalReplayed(E803Journal *journal);
+
+void JournalFree(E803Journal *journal);
+uint64_t JournalCheck(E803Machine *cpu);
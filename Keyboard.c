@@ -28,6 +28,8 @@
 #include "Wiring.h"
 #include "Common.h"
 #include "Parse.h"
+#include "Panel.h"
+#include "Snapshot.h"
 
 static GLenum e;
 #define CHECK(n) if((e=glGetError())!=0){printf("%d Error %s %x\n",__LINE__,n,e);} 
@@ -853,19 +855,18 @@ static void WgTopMotionHandler(vec4 PointerXYZ,HandInfo *MovingHand,guint time)
 	    {
 		if(MovingHand->fingersPressed != 0)
 		{
-		    ButtonEvent *be;
+		    ButtonEvent be;
 		    
 		    volAngle += 2.0f * (PointerXYZ[2] - volumeZ) ;
 		    volAngle = fminf(volAngle,0.93f);
 		    volAngle = fmaxf(volAngle,-0.25f);
 
-		    be = (ButtonEvent *) malloc(sizeof(ButtonEvent));
-		    be->press = TRUE;
-		    be->rowId = VOLUME;
-		    be->value = (guint)(2560.0f * ((volAngle + 0.25f)/1.18f));
-		    be->time  = time;
+		    be.press = TRUE;
+		    be.rowId = VOLUME;
+		    be.value = (guint)(2560.0f * ((volAngle + 0.25f)/1.18f));
+		    be.time  = time;
 
-		    g_async_queue_push(ButtonEventQueue,(gpointer) be);
+		    RingPush(ButtonEventRing,&be);
 		}
 
 		volumeZ = PointerXYZ[2];
@@ -1126,8 +1127,8 @@ enum WgZones XYZtoZone(vec4 XYZ)
 }
 
 /*
-Called in the worker thread, so put events on the queue to turn 
-the console light on and off.
+Called in the worker thread, so publish the console light for the
+GUI to pick up.
 */
 
 static gboolean MainsOn = FALSE;
@@ -1135,13 +1136,7 @@ static gboolean PowerOn = FALSE;
 
 static void lampOn(gboolean on)
 {
-    LampsEvent *le;
-
-    le = (LampsEvent *) malloc(sizeof(LampsEvent));
-    le->lampId = 0;
-    le->on = on;
-
-    g_async_queue_push(LampsEventQueue,(gpointer) le);
+    PanelConsoleLamp(on);
 }
 
 static void mainsOn(__attribute__((unused)) unsigned int dummy)
@@ -1174,6 +1169,28 @@ static void powerOff(__attribute__((unused)) unsigned int dummy)
     lampOn(FALSE);
 }
 
+// Snapshots only need to know whether the console light is on.
+static void saveLamp(GByteArray *data)
+{
+    gboolean saved[2] = {MainsOn,PowerOn};
+
+    g_byte_array_append(data,(const guint8 *) saved,sizeof(saved));
+}
+
+/* Restored on the emulation thread, where the wires that change these
+   are set too, and the lamp reaches the GUI through the panel. */
+static gboolean restoreLamp(const guint8 *data,gsize length)
+{
+    gboolean saved[2];
+
+    if(length != sizeof(saved)) return FALSE;
+    memcpy(saved,data,sizeof(saved));
+    MainsOn = saved[0];
+    PowerOn = saved[1];
+    lampOn(MainsOn && PowerOn);
+    return TRUE;
+}
+
 /****************************************************************/
 
 
@@ -1219,7 +1236,7 @@ gboolean KeyboardInit(  GString *sharedPath,
 {
     vec4 offset =  {0.0f,0.12f,0.0f,0.0f};
     WGButton *buttonp;
-    ButtonEvent *be;
+    ButtonEvent be;
     GString *directory;
 
     directory = g_string_new(sharedPath->str);
@@ -1243,13 +1260,12 @@ gboolean KeyboardInit(  GString *sharedPath,
     
     while(buttonp->objectId != 0)
     {
-	be = (ButtonEvent *) malloc(sizeof(ButtonEvent));
-	be->press = buttonp->state;
-	be->rowId = buttonp->rowId;
-	be->value = buttonp->value;
-	be->time  = 0;
+	be.press = buttonp->state;
+	be.rowId = buttonp->rowId;
+	be.value = buttonp->value;
+	be.time  = 0;
 
-	g_async_queue_push(ButtonEventQueue,(gpointer) be);
+	RingPush(ButtonEventRing,&be);
 
 	buttonp++;
     }
@@ -1262,6 +1278,8 @@ gboolean KeyboardInit(  GString *sharedPath,
     connectWires(MAINS_SUPPLY_OFF,mainsOff);
     connectWires(SUPPLIES_ON, powerOn);
     connectWires(SUPPLIES_OFF,powerOff);
+
+    SnapshotRegister("KBD ",saveLamp,restoreLamp);
     
     return TRUE;
 }
@@ -1888,23 +1906,13 @@ void PointerOverKeyboard(vec4 PointerXYZ,__attribute__((unused)) vec4 MouseXY,gu
 
 void KeyboardTimerTick2(void)
 {
-    LampsEvent *le;
+    E803Panel panel;
     
-    if(LampsEventQueue != NULL)
+    if(PanelLatest(&panel))
     {	
-	while((le = (LampsEvent *) g_async_queue_try_pop(LampsEventQueue)) != NULL)
-	{
-		if(le->lampId == 0)
-		{
-		    WGLampOnObject->hidden  = !le->on;
-		    WGLampOffObject->hidden =  le->on;
-		}
-		else
-		{
-		    lampsBright[le->lampId - 1] = le->brightness;
-		}
-		free(le);
-	    }
+	WGLampOnObject->hidden  = !panel.consoleLamp;
+	WGLampOffObject->hidden =  panel.consoleLamp;
+	memcpy(lampsBright,panel.DM160s,sizeof(lampsBright));
     }
 }
 
@@ -0,0 +1,217 @@
+/*  This file is part of the Elliott 803 emulator.
+
+    Copyright © 2020  Peter Onion
+
+    See LICENCE file. 
+*/
+
+/* Checks the long functions done in one go against doing them a word
+   time at a time.  It is built twice, as 803-longtest and as
+   803-longtest-wordtimes with BULK_LONG_FUNCTIONS 0.  Each runs the
+   same shifts, multiplies and divides, every shift count and random
+   operands, in batches of random length and prints the registers and
+   lamp counts at the end of every batch.  With --compare the first runs
+   the second and fails if anything printed differs.  --threaded uses
+   the threaded code engine for this run but not for the one compared
+   with. */
+
+#define G_LOG_USE_STRUCTURED
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+#include <glib.h>
+
+#include "E803-types.h"
+#include "Emulate.h"
+
+#define WORD_MASK ((1ULL << 39) - 1)
+#define AR_MASK ((1ULL << 38) - 1)
+
+static gint cases = 20000;
+static gint seed = 803;
+static gchar *compareWith = NULL;
+static gboolean threadedEngine = FALSE;
+
+static GOptionEntry entries[] =
+{
+    { "cases", 'n', 0, G_OPTION_ARG_INT, &cases, "Random multiplies and divides to run.", "N" },
+    { "seed", 's', 0, G_OPTION_ARG_INT, &seed, "Seed for the random operands.", "N" },
+    { "compare", 'c', 0, G_OPTION_ARG_FILENAME, &compareWith, "Run this build of the test as well and compare.", "PROGRAM" },
+    { "threaded", 't' , 0,  G_OPTION_ARG_NONE, &threadedEngine, "Use the threaded code execution engine.",NULL},
+    { NULL }
+};
+
+static const unsigned int longFunctions[] = {050,051,052,053,054,055,056};
+
+// One word of two instructions, function codes in octal.
+static E803word instructions(unsigned int f1,unsigned int n1,unsigned int f2,unsigned int n2)
+{
+    return ((E803word) f1 << 33) | ((E803word) n1 << 20) | ((E803word) f2 << 13) | n2;
+}
+
+// Mostly random words, with the awkward ones turning up often.
+static E803word operand(GRand *rand)
+{
+    static const E803word awkward[] =
+	{0,1,WORD_MASK,1ULL << 38,(1ULL << 38) - 1,(1ULL << 38) + 1,1ULL << 37};
+
+    if(g_rand_int_range(rand,0,4) == 0)
+	return awkward[g_rand_int_range(rand,0,G_N_ELEMENTS(awkward))];
+    return (((E803word) g_rand_int(rand) << 32) | g_rand_int(rand)) & WORD_MASK;
+}
+
+static void report(GString *out,E803Machine *cpu)
+{
+    g_string_append_printf(out,"%" PRId64 " %d %d %d %d %d %010" PRIx64 " %010" PRIx64 " %010" PRIx64
+			   " %010" PRIx64 " %010" PRIx64 " %d",
+			   cpu->CPU_word_time_count,cpu->SCR,cpu->IR,cpu->L,cpu->LW,cpu->T,
+			   cpu->ACC,cpu->AR,cpu->QACC,cpu->QAR,cpu->MREG,cpu->OFLOW);
+    for(int n = 0; n < 7; n++)
+	g_string_append_printf(out," %d",cpu->DM160s_bright[n]);
+    g_string_append_c(out,'\n');
+}
+
+/* "30 100 : fn n" followed by a dynamic stop, run for 200 word times in
+   batches of random length. */
+static void runCase(GString *out,GRand *rand,unsigned int fn,unsigned int n,E803word acc,E803word ar,
+		    E803word store,gboolean oflow)
+{
+    E803Machine cpu;
+    E803word *core;
+    int wordTimes;
+
+    core = (E803word *) calloc(8194,sizeof(E803word));
+    core[4] = instructions(030,100,fn,n);
+    core[5] = instructions(040,5,040,5);
+    core[100] = acc;
+    core[101] = store;
+
+    InitMachine(&cpu,core);
+    setThreadedEngine(&cpu,threadedEngine ? true : false);
+    cpu.CpuRunning = true;
+    cpu.S = false;
+    cpu.R = true;
+    cpu.SCR = 4 << 1;
+    cpu.IR = 4;
+    cpu.AR = ar;
+    cpu.OFLOW = oflow ? true : false;
+
+    g_string_append_printf(out,"%02o %u\n",fn,n);
+    while(cpu.CPU_word_time_count < 200)
+    {
+	wordTimes = g_rand_int_range(rand,1,120);
+	Emulate(&cpu,wordTimes);
+	report(out,&cpu);
+    }
+    FreeMachine(&cpu);
+    free(core);
+}
+
+static GString *runCases(void)
+{
+    GString *out = g_string_new(NULL);
+    GRand *rand = g_rand_new_with_seed((guint32) seed);
+    unsigned int fn;
+
+    // Every shift count of every shift
+    for(int f = 0; f < 4; f++)
+    {
+	fn = (f < 2) ? 050 + (unsigned int) f : 054 + (unsigned int) (f - 2);
+	for(unsigned int n = 0; n < 128; n++)
+	{
+	    runCase(out,rand,fn,n,operand(rand),operand(rand) & AR_MASK,0,g_rand_boolean(rand));
+	}
+    }
+
+    // And random operands for all of them
+    for(int c = 0; c < cases; c++)
+    {
+	fn = longFunctions[g_rand_int_range(rand,0,G_N_ELEMENTS(longFunctions))];
+	if((fn == 052) || (fn == 053) || (fn == 056))
+	    runCase(out,rand,fn,101,operand(rand),operand(rand) & AR_MASK,operand(rand),g_rand_boolean(rand));
+	else
+	    runCase(out,rand,fn,(unsigned int) g_rand_int_range(rand,0,128),operand(rand),
+		    operand(rand) & AR_MASK,0,g_rand_boolean(rand));
+    }
+
+    g_rand_free(rand);
+    return out;
+}
+
+// Run the other build with the same cases and compare line by line.
+static int compare(GString *ours)
+{
+    static gchar casesFlag[] = "-n",seedFlag[] = "-s";
+    gchar *argv[6];
+    gchar casesText[16],seedText[16];
+    gchar *theirs = NULL;
+    gint status;
+    GError *error = NULL;
+    gchar **a,**b;
+    int line,result = 0;
+
+    g_snprintf(casesText,sizeof(casesText),"%d",cases);
+    g_snprintf(seedText,sizeof(seedText),"%d",seed);
+    argv[0] = compareWith;
+    argv[1] = casesFlag;
+    argv[2] = casesText;
+    argv[3] = seedFlag;
+    argv[4] = seedText;
+    argv[5] = NULL;
+
+    if(!g_spawn_sync(NULL,argv,NULL,G_SPAWN_DEFAULT,NULL,NULL,&theirs,NULL,&status,&error))
+    {
+	g_print("Failed to run %s (%s)\n",compareWith,error->message);
+	g_error_free(error);
+	return 1;
+    }
+
+    a = g_strsplit(ours->str,"\n",-1);
+    b = g_strsplit(theirs,"\n",-1);
+    for(line = 0; (a[line] != NULL) && (b[line] != NULL); line++)
+    {
+	if(strcmp(a[line],b[line]) != 0) break;
+    }
+    if((a[line] != NULL) || (b[line] != NULL))
+    {
+	g_print("Differs at line %d:\n  in one go:     %s\n  word by word:  %s\n",
+		line + 1,a[line] ? a[line] : "(end)",b[line] ? b[line] : "(end)");
+	result = 1;
+    }
+    else
+    {
+	g_print("%d lines match\n",line);
+    }
+
+    g_strfreev(a);
+    g_strfreev(b);
+    g_free(theirs);
+    return result;
+}
+
+int main(int argc,char **argv)
+{
+    GOptionContext *context;
+    GError *error = NULL;
+    GString *out;
+    int result = 0;
+
+    context = g_option_context_new ("- check long functions done in one go");
+    g_option_context_add_main_entries (context, entries, NULL);
+    if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+	g_print ("option parsing failed: %s\n", error->message);
+	exit (1);
+    }
+
+    out = runCases();
+    if(compareWith != NULL)
+	result = compare(out);
+    else
+	fputs(out->str,stdout);
+
+    g_string_free(out,TRUE);
+    return result;
+}
@@ -29,6 +29,7 @@
 #include "Logging.h"
 #include "Keyboard.h"
 #include "Hands.h"
+#include "Debugger.h"
 
 #include <glib.h>
 
@@ -40,6 +41,17 @@ static gchar *loadCoreFileName =  NULL;
 static gchar *saveCoreFileName =  NULL;
 static gchar *windowSize = NULL;
 static gchar *alsaName = NULL;
+static gint turboFactor = 1;
+static gboolean threadedEngine = FALSE;
+static gboolean profileFromStart = FALSE;
+static gint traceLength = 0;
+static gint debugPort = 0;
+static gboolean resume = FALSE;
+static gint rewindMegabytes = 0;
+static gint rewindInterval = 0;
+static gchar *recordFileName = NULL;
+static gchar *tapeFileName = NULL;
+static gboolean realSpeedReader = FALSE;
 
 gboolean oldHandSwap = FALSE;
 
@@ -51,14 +63,22 @@ static GOptionEntry entries[] =
     { "windowsize", 'w', 0, G_OPTION_ARG_STRING, &windowSize, "Window size as widthxheight.", NULL },
     { "handswap", 'h' , 0, G_OPTION_ARG_NONE, &oldHandSwap, "Use old (right click) hand swap method.",NULL },
     { "device", 'D' , 0,  G_OPTION_ARG_STRING, &alsaName, "Select ALSA output device.",NULL},
+    { "turbo", 'T' , 0,  G_OPTION_ARG_INT, &turboFactor, "Run N times faster than real time (0 = as fast as possible).","N"},
+    { "threaded", 't' , 0,  G_OPTION_ARG_NONE, &threadedEngine, "Use the threaded code execution engine.",NULL},
+    { "profile", 'P' , 0,  G_OPTION_ARG_NONE, &profileFromStart, "Profile programs from the start (p toggles profiling).",NULL},
+    { "trace", 'R' , 0,  G_OPTION_ARG_INT, &traceLength, "Trace the last N instructions from the start (t toggles tracing).","N"},
+    { "debugport", 'd' , 0,  G_OPTION_ARG_INT, &debugPort, "Listen for a debugger on localhost port N (8039 is suggested).","N"},
+    { "resume", 'r' , 0,  G_OPTION_ARG_NONE, &resume, "Carry on from the snapshot saved when the emulator last stopped.",NULL},
+    { "rewind", 'b' , 0,  G_OPTION_ARG_INT, &rewindMegabytes, "Keep N MB of checkpoints so the debugger can go backwards.","N"},
+    { "rewindinterval", 'B' , 0,  G_OPTION_ARG_INT, &rewindInterval, "Word times between checkpoints (default 10000).","N"},
+    { "record", 'j' , 0,  G_OPTION_ARG_FILENAME, &recordFileName, "Record the buttons and tapes to a journal for 803-batch --replay.","FILE"},
+    { "tape", 'p' , 0,  G_OPTION_ARG_FILENAME, &tapeFileName, "Put a tape in the reader, from the tapes directory if not found as given.","FILE"},
+    { "realspeedreader", 'S' , 0,  G_OPTION_ARG_NONE, &realSpeedReader, "Read tapes at 500 characters a second rather than as fast as possible.",NULL},
     { NULL }
 };
 
 extern int callCount;
 
-GMutex SoundEffectsQueueMutex;
-GMutex ButtonEventMutex;
-GMutex LampsEventMutex;
 gboolean Running = TRUE; 
 
 int main(int argc,char **argv)
@@ -261,11 +281,23 @@ int main(int argc,char **argv)
 	
     }
 
+    if(turboFactor != 1)
+    {
+	setTurbo(turboFactor);
+    }
+
+    CpuThreadedEngine(threadedEngine);
+    CpuProfileFromStart(profileFromStart);
+    CpuTraceFromStart(traceLength > 0,(guint) MAX(traceLength,0));
+    CpuRewind((guint) MAX(rewindMegabytes,0),(guint) MAX(rewindInterval,0));
+    PTSReaderRealSpeed(realSpeedReader);
+    PTSRealTime(turboFactor == 1);
+
     
     // Initialise queues so that they can be used in initialisation code
     // to restore CPU state.
-    LampsEventQueue = g_async_queue_new();
-    ButtonEventQueue = g_async_queue_new();
+    ButtonEventRing = RingNew(BUTTON_EVENTS,sizeof(ButtonEvent));
+    SoundInit();
     
     if(GtkInit(sharedPath,&argc, &argv))
     {
@@ -281,6 +313,9 @@ int main(int argc,char **argv)
 	// initPLTS can fail but should not stop emualtor starting.
 	PTSInit(sharedPath,configPath);
 
+	// The debugger is optional and so is not critical either
+	if(debugPort > 0) DebuggerInit(debugPort);
+
 	// This can fail but isn't critical
 	LoadScene(sharedPath,configPath);
 
@@ -289,6 +324,11 @@ int main(int argc,char **argv)
 
 	loadTextures1(sharedPath,configPath);
 
+	// Everything has registered its snapshot sections by now
+	if(resume) CpuResume();
+	if(tapeFileName != NULL) PTSLoadTape(tapeFileName);
+	if(recordFileName != NULL) CpuRecord(recordFileName);
+
 	// Start up the machine emulation in a separate thread
 	EmulationThread = g_thread_new ("Emulation Code",
 					worker,
@@ -301,6 +341,7 @@ int main(int argc,char **argv)
 	Running = FALSE;
 
 	g_thread_join(EmulationThread);
+	RingReport(ButtonEventRing,"Button event");
 
 	CpuTidy(configPath,saveCoreFileName);
 
@@ -0,0 +1,284 @@
+/*  This file is part of the Elliott 803 emulator.
+
+    Copyright © 2020  Peter Onion
+
+    See LICENCE file. 
+*/
+
+#define G_LOG_USE_STRUCTURED
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <glib.h>
+
+#include "PLTS.h"
+
+void PLTSInit(E803PLTS *plts,E803Tape *tape,PLTSCommand command)
+{
+    memset(plts,0,sizeof(E803PLTS));
+    plts->tape = tape;
+    plts->command = command;
+}
+
+static void acknowledge(E803PLTS *plts)
+{
+    gsize written;
+
+    g_io_channel_write_chars(plts->channel,"\x81",1,&written,NULL);
+    g_io_channel_flush(plts->channel,NULL);
+}
+
+// Acknowledge all the blocks taken so far in one go.
+static void acknowledgeBlocks(E803PLTS *plts)
+{
+    gchar reply[2];
+    gsize written;
+    int count;
+
+    while(plts->rx.unacknowledged > 0)
+    {
+	count = MIN(plts->rx.unacknowledged,255);
+	reply[0] = '\x8C';
+	reply[1] = (gchar) count;
+	g_io_channel_write_chars(plts->channel,reply,2,&written,NULL);
+	plts->rx.unacknowledged -= count;
+    }
+    g_io_channel_flush(plts->channel,NULL);
+}
+
+// A whole block has been taken.
+static void blockTaken(E803PLTS *plts)
+{
+    plts->rx.state = PLTS_COMMAND;
+    if(plts->rx.windowed)
+	plts->rx.unacknowledged += 1;
+    else
+	acknowledge(plts);
+}
+
+// A command byte
+static void plts_command(E803PLTS *plts,guint8 command)
+{
+    plts->rx.command = command;
+    plts->rx.argumentsHad = 0;
+    switch(command)
+    {
+    case 0x80:
+	plts->rx.argumentsWanted = 2;
+	plts->rx.state = PLTS_ARGUMENTS;
+	break;
+    case 0x81:
+    case 0x8A:
+    case 0x8B:
+	plts->rx.argumentsWanted = 1;
+	plts->rx.state = PLTS_ARGUMENTS;
+	break;
+    case 0x8C:
+	// Only a PLTS that knows about 0x8C acknowledgements sends these
+	plts->rx.windowed = TRUE;
+	plts->rx.argumentsWanted = 2;
+	plts->rx.state = PLTS_ARGUMENTS;
+	break;
+    case 0x82:
+	// Read the tape again
+	if(!TapeRewind(plts->tape))
+	    g_warning("PLTS tape is too long for the reader to go back to its start\n");
+	break;
+    default:
+	(plts->command)(command,0);
+	break;
+    }
+}
+
+// A command's arguments have all arrived.
+static void plts_arguments(E803PLTS *plts)
+{
+    plts->rx.state = PLTS_COMMAND;
+    switch(plts->rx.command)
+    {
+    case 0x80:
+	TapeStart(plts->tape);
+	acknowledge(plts);
+	break;
+    case 0x81:
+	plts->rx.blockLeft = (plts->rx.arguments[0] != 0) ? plts->rx.arguments[0] : 256;
+	plts->rx.state = PLTS_BLOCK;
+	break;
+    case 0x8A:
+	(plts->command)(plts->rx.command,plts->rx.arguments[0]);
+	break;
+    case 0x8B:
+    {
+	gchar reply[2];
+	gsize written;
+
+	reply[0] = '\x8B';
+	reply[1] = (gchar) MAX(MIN(plts->rx.arguments[0],PLTS_WINDOW),1);
+	g_io_channel_write_chars(plts->channel,reply,2,&written,NULL);
+	g_io_channel_flush(plts->channel,NULL);
+	plts->rx.windowed = TRUE;
+	g_info("PLTS sending tape with up to %d blocks outstanding\n",reply[1]);
+	break;
+    }
+    case 0x8C:
+	plts->rx.blockLeft = ((gsize) plts->rx.arguments[0] << 8) | plts->rx.arguments[1];
+	if(plts->rx.blockLeft != 0)
+	    plts->rx.state = PLTS_BLOCK;
+	else
+	    blockTaken(plts);
+	break;
+    }
+}
+
+// Where the next bytes of a block go and how many will fit
+static gsize tapeSpace(E803PLTS *plts,guint8 **to)
+{
+    // A block with no 0x80 before it
+    if(plts->tape->ring == NULL) TapeStart(plts->tape);
+    return MIN(TapeSpace(plts->tape,to),plts->rx.blockLeft);
+}
+
+// Count bytes of a block that have been put in the tape.
+static void plts_block(E803PLTS *plts,gsize length)
+{
+    TapeWritten(plts->tape,length);
+    plts->rx.blockLeft -= length;
+    if(plts->rx.blockLeft == 0) blockTaken(plts);
+}
+
+/* Take apart what is in rx.  Anything left when the tape is full stays
+   there for next time. */
+static void plts_parse(E803PLTS *plts)
+{
+    gsize length;
+    guint8 *to;
+
+    while(plts->rx.start < plts->rx.end)
+    {
+	switch(plts->rx.state)
+	{
+	case PLTS_COMMAND:
+	    plts_command(plts,plts->rx.buffer[plts->rx.start++]);
+	    break;
+	case PLTS_ARGUMENTS:
+	    plts->rx.arguments[plts->rx.argumentsHad++] = plts->rx.buffer[plts->rx.start++];
+	    if(plts->rx.argumentsHad == plts->rx.argumentsWanted) plts_arguments(plts);
+	    break;
+	case PLTS_BLOCK:
+	    length = MIN(tapeSpace(plts,&to),plts->rx.end - plts->rx.start);
+	    if(length == 0) return;
+	    memcpy(to,&plts->rx.buffer[plts->rx.start],length);
+	    plts->rx.start += length;
+	    plts_block(plts,length);
+	    break;
+	}
+    }
+    plts->rx.start = plts->rx.end = 0;
+}
+
+/* Read whatever has arrived without waiting for more.  FALSE when the
+   PLTS has gone. */
+static gboolean plts_read(int fd,guint8 *to,gsize size,gsize *length)
+{
+    ssize_t got;
+
+    got = recv(fd,to,size,MSG_DONTWAIT);
+    if(got > 0)
+    {
+	*length = (gsize) got;
+	return TRUE;
+    }
+    *length = 0;
+    if(got == 0) return FALSE;
+#if EWOULDBLOCK != EAGAIN
+    if(errno == EWOULDBLOCK) return TRUE;
+#endif
+    return (errno == EAGAIN) || (errno == EINTR);
+}
+
+static gboolean plts_retry(gpointer data);
+
+/* The tape is full, so stop watching the PLTS and look again later.
+   Returns FALSE to remove the watch. */
+static gboolean plts_stall(E803PLTS *plts)
+{
+    if(plts->rx.unacknowledged > 0) acknowledgeBlocks(plts);
+    plts->retry = g_timeout_add(PLTS_RETRY,plts_retry,plts);
+    return FALSE;
+}
+
+// Don't look at a connection that has gone or been replaced.
+static void plts_stopRetry(E803PLTS *plts)
+{
+    if(plts->retry != 0)
+    {
+	g_source_remove(plts->retry);
+	plts->retry = 0;
+    }
+}
+
+static gboolean  process_message(GIOChannel *source,
+				 __attribute__((unused))GIOCondition condition,
+				 gpointer data)
+{
+    E803PLTS *plts = (E803PLTS *) data;
+    int fd = g_io_channel_unix_get_fd(source);
+    gsize length,space;
+    guint8 *to;
+
+    do
+    {
+	if(plts->rx.start < plts->rx.end)
+	{
+	    // Left from when the tape was last full
+	    plts_parse(plts);
+	    if(plts->rx.start < plts->rx.end) return plts_stall(plts);
+	}
+
+	if(plts->rx.state == PLTS_BLOCK)
+	{
+	    // Straight into the tape
+	    if((space = tapeSpace(plts,&to)) == 0) return plts_stall(plts);
+	    if(!plts_read(fd,to,space,&length)) break;
+	    if(length != 0) plts_block(plts,length);
+	}
+	else
+	{
+	    if(!plts_read(fd,plts->rx.buffer,sizeof(plts->rx.buffer),&length)) break;
+	    plts->rx.end = length;
+	    plts_parse(plts);
+	}
+	if(length == 0)
+	{
+	    if(plts->rx.unacknowledged > 0) acknowledgeBlocks(plts);
+	    return TRUE;
+	}
+    } while(TRUE);
+
+    if(source == plts->channel) plts_stopRetry(plts);
+    g_io_channel_shutdown(source,FALSE,NULL);
+    g_info("Disconnect from PLTS\n");
+    return FALSE;
+}
+
+// Watch the PLTS again once there is room on the tape.
+static gboolean plts_retry(gpointer data)
+{
+    E803PLTS *plts = (E803PLTS *) data;
+
+    plts->retry = 0;
+    if(process_message(plts->channel,G_IO_IN,plts))
+	g_io_add_watch(plts->channel,G_IO_IN,process_message,plts);
+    return FALSE;
+}
+
+// Start taking apart what arrives on channel, a new connection.
+void PLTSConnect(E803PLTS *plts,GIOChannel *channel)
+{
+    plts_stopRetry(plts);
+    memset(&plts->rx,0,sizeof(plts->rx));
+    plts->channel = channel;
+    g_io_add_watch(channel,G_IO_IN,process_message,plts);
+}
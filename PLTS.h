@@ -0,0 +1,73 @@
+/*  This file is part of the Elliott 803 emulator.
+
+    Copyright © 2020  Peter Onion
+
+    See LICENCE file. 
+*/
+
+#pragma once
+/* The stream a PLTS sends, taken apart into tape blocks for a reader
+   and commands for the PTS.  It is read in bulk into rx and taken
+   apart from there, except that the bytes of a tape block go straight
+   into the tape when nothing is waiting in rx.  Commands 0x80, 0x81 and
+   0x8A have arguments, 0x81's being the length of the block that
+   follows.
+
+   Each 0x81 block is acknowledged with 0x81 before the PLTS sends the
+   next.  A PLTS that knows better can send 0x8B with the number of
+   blocks it would like to have outstanding, and is answered with 0x8B
+   and the number it may have.  After that blocks are not answered one
+   by one.  Instead, whenever the emulator has read all that has arrived
+   it sends 0x8C and the number of blocks it has taken since the last
+   0x8C, which may be repeated for more than 255.  The PLTS may also
+   send blocks of up to 65535 bytes as 0x8C, the high byte of the length
+   and the low byte, followed by the bytes.  An empty block is taken
+   and acknowledged like any other.  A PLTS that sends 0x8C without
+   having sent 0x8B gets its blocks acknowledged with 0x8C too, as if
+   it had.  PLTSs that send neither see the original protocol.
+
+   0x80 starts a new tape, which streams into the reader as it arrives,
+   so the machine can start reading it straight away.  When the reader's
+   ring is full the PLTS is left unread, and so unacknowledged, until
+   the machine has made room.  0x82 rewinds the tape so that it is read
+   again from the start, as long as the reader's ring still holds all of
+   it, which it does for tapes of up to TAPE_RING characters.
+
+   Everything here runs on the thread whose main loop watches the
+   connection, and that thread is the writer of the tape. */
+
+#include <glib.h>
+#include "Tape.h"
+
+#define PLTS_RX_BUFFER 4096
+#define PLTS_WINDOW 64
+#define PLTS_RETRY 20        // Milliseconds between looks at a full tape
+
+enum PLTSState {PLTS_COMMAND,PLTS_ARGUMENTS,PLTS_BLOCK};
+
+// Commands that are not about the tape, with their argument if any.
+typedef void (*PLTSCommand)(guint8 command,guint8 argument);
+
+typedef struct _e803PLTS
+{
+    E803Tape *tape;          // Where tape blocks go
+    PLTSCommand command;     // Where everything else goes
+    GIOChannel *channel;     // The PLTS, or NULL
+    guint retry;             // Timeout to look at a full tape again, or 0
+
+    struct
+    {
+	guint8 buffer[PLTS_RX_BUFFER];
+	gsize start,end;         // Bytes not yet taken apart
+	enum PLTSState state;
+	guint8 command;
+	guint8 arguments[2];
+	gsize argumentsWanted,argumentsHad;
+	gsize blockLeft;         // Bytes of the tape block still to come
+	gboolean windowed;       // 0x8B has been seen
+	int unacknowledged;      // Blocks taken since the last 0x8C was sent
+    } rx;
+} E803PLTS;
+
+void PLTSInit(E803PLTS *plts,E803Tape *tape,PLTSCommand command);
+void PLTSConnect(E803PLTS *plts,GIOChannel *channel);
@@ -0,0 +1,331 @@
+/*  This file is part of the Elliott 803 emulator.
+
+    Copyright © 2020  Peter Onion
+
+    See LICENCE file. 
+*/
+
+/* Sends a tape to PLTS.c the way a windowed PLTS does, over a socket
+   pair, and checks that every byte arrives in order and every block is
+   acknowledged.  The blocks are a mixture of 0x81 and 0x8C ones, some
+   of them empty, and the tape is longer than the reader's ring so that
+   the sender has to wait for the reader to make room.  After that a
+   short tape is sent and rewound with 0x82, and must be read twice.
+   Last a new connection sends a 0x8C block without sending 0x8B first,
+   which must be acknowledged with 0x8C. */
+
+#define G_LOG_USE_STRUCTURED
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <glib.h>
+
+#include "Tape.h"
+#include "PLTS.h"
+
+#define TEST_BLOCKS 300
+#define TEST_WINDOW 8
+#define TEST_TIMEOUT 30      // Seconds
+#define TEST_REWOUND 1000    // Characters on the tape that is rewound
+
+static E803Tape tape;
+static E803PLTS plts;
+static GMainLoop *loop;
+static gsize sent = 0,received = 0;
+static gint sendingDone = 0;
+static int blocksAcknowledged = 0;
+static gboolean failed = FALSE;
+
+// The character at position on the tape
+static guint8 tapeCharacter(gsize position)
+{
+    return (guint8) ((position * 7) + (position >> 8));
+}
+
+static void onCommand(guint8 command,__attribute__((unused)) guint8 argument)
+{
+    g_print("Unexpected PLTS command 0x%02x\n",command);
+    failed = TRUE;
+}
+
+static gboolean sendAll(int fd,const guint8 *data,gsize length)
+{
+    ssize_t done;
+
+    while(length > 0)
+    {
+	done = write(fd,data,length);
+	if(done <= 0) return FALSE;
+	data += done;
+	length -= (gsize) done;
+    }
+    return TRUE;
+}
+
+static gboolean receiveAll(int fd,guint8 *data,gsize length)
+{
+    ssize_t done;
+
+    while(length > 0)
+    {
+	done = read(fd,data,length);
+	if(done <= 0) return FALSE;
+	data += done;
+	length -= (gsize) done;
+    }
+    return TRUE;
+}
+
+// Wait for a 0x8C and take off the blocks it acknowledges.
+static gboolean waitForAcknowledgement(int fd,int *outstanding)
+{
+    guint8 reply[2];
+
+    if(!receiveAll(fd,reply,2) || (reply[0] != 0x8C)) return FALSE;
+    *outstanding -= reply[1];
+    blocksAcknowledged += reply[1];
+    return TRUE;
+}
+
+// The PLTS's side, on its own thread.
+static gpointer sender(gpointer data)
+{
+    int fd = GPOINTER_TO_INT(data);
+    guint8 block[3 + 4000];
+    guint8 reply[2];
+    GRand *rand = g_rand_new_with_seed(803);
+    int outstanding = 0,window;
+    gsize length,header;
+
+    block[0] = 0x8B;
+    block[1] = 32;
+    if(!sendAll(fd,block,2) || !receiveAll(fd,reply,2) || (reply[0] != 0x8B)) goto fail;
+    window = MIN(reply[1],TEST_WINDOW);
+
+    block[0] = 0x80;
+    block[1] = block[2] = 0;
+    if(!sendAll(fd,block,3) || !receiveAll(fd,reply,1) || (reply[0] != 0x81)) goto fail;
+
+    for(int n = 0; n < TEST_BLOCKS; n++)
+    {
+	while(outstanding >= window)
+	    if(!waitForAcknowledgement(fd,&outstanding)) goto fail;
+
+	if((n % 17) == 5)
+	{   // Empty
+	    block[0] = 0x8C;
+	    block[1] = block[2] = 0;
+	    length = 0;
+	    header = 3;
+	}
+	else if((n % 3) == 0)
+	{   // The old sort, 0 meaning 256
+	    length = (gsize) g_rand_int_range(rand,1,257);
+	    block[0] = 0x81;
+	    block[1] = (guint8) length;
+	    header = 2;
+	}
+	else
+	{
+	    length = (gsize) g_rand_int_range(rand,1,4001);
+	    block[0] = 0x8C;
+	    block[1] = (guint8) (length >> 8);
+	    block[2] = (guint8) length;
+	    header = 3;
+	}
+	for(gsize i = 0; i < length; i++) block[header + i] = tapeCharacter(sent + i);
+	if(!sendAll(fd,block,header + length)) goto fail;
+	sent += length;
+	outstanding += 1;
+    }
+
+    while(outstanding > 0)
+	if(!waitForAcknowledgement(fd,&outstanding)) goto fail;
+
+    g_rand_free(rand);
+    g_atomic_int_set(&sendingDone,1);
+    return NULL;
+
+fail:
+    g_print("PLTS side failed after %" G_GSIZE_FORMAT " bytes\n",sent);
+    g_rand_free(rand);
+    g_atomic_int_set(&sendingDone,-1);
+    return NULL;
+}
+
+// The reader's side, a few thousand characters at a time.
+static gboolean readTape(__attribute__((unused)) gpointer data)
+{
+    guint8 character;
+
+    for(int n = 0; (n < 4096) && TapeRead(&tape,&character); n++)
+    {
+	if(character != tapeCharacter(received))
+	{
+	    g_print("Character %" G_GSIZE_FORMAT " is %d not %d\n",received,character,tapeCharacter(received));
+	    failed = TRUE;
+	    g_main_loop_quit(loop);
+	    return G_SOURCE_REMOVE;
+	}
+	received += 1;
+    }
+
+    if(g_atomic_int_get(&sendingDone) != 0)
+    {
+	if((g_atomic_int_get(&sendingDone) < 0) || (TapeUnread(&tape) == 0))
+	{
+	    g_main_loop_quit(loop);
+	    return G_SOURCE_REMOVE;
+	}
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+// Let PLTS.c take what has been sent until the tape has characters on it.
+static gboolean waitForTape(void)
+{
+    gint64 until = g_get_monotonic_time() + TEST_TIMEOUT * G_USEC_PER_SEC;
+
+    while(TapeUnread(&tape) == 0)
+    {
+	if(g_get_monotonic_time() > until) return FALSE;
+	g_main_context_iteration(NULL,FALSE);
+	g_usleep(1000);
+    }
+    return TRUE;
+}
+
+// Read the short tape from its start, all of it.
+static gboolean readRewound(void)
+{
+    guint8 character;
+    gsize n;
+
+    if(!waitForTape()) return FALSE;
+    for(n = 0; TapeRead(&tape,&character); n++)
+	if((n >= TEST_REWOUND) || (character != tapeCharacter(n))) return FALSE;
+    return n == TEST_REWOUND;
+}
+
+// A short tape, read, rewound with 0x82 and read again.
+static gboolean rewindTest(int fd)
+{
+    guint8 block[3 + TEST_REWOUND];
+    guint8 reply[2];
+
+    block[0] = 0x80;
+    block[1] = block[2] = 0;
+    if(!sendAll(fd,block,3)) return FALSE;
+    block[0] = 0x8C;
+    block[1] = (guint8) (TEST_REWOUND >> 8);
+    block[2] = (guint8) TEST_REWOUND;
+    for(gsize i = 0; i < TEST_REWOUND; i++) block[3 + i] = tapeCharacter(i);
+    if(!sendAll(fd,block,3 + TEST_REWOUND)) return FALSE;
+
+    if(!readRewound()) return FALSE;
+    if(!receiveAll(fd,reply,1) || (reply[0] != 0x81)) return FALSE;
+    if(!receiveAll(fd,reply,2) || (reply[0] != 0x8C) || (reply[1] != 1)) return FALSE;
+
+    block[0] = 0x82;
+    if(!sendAll(fd,block,1)) return FALSE;
+    return readRewound();
+}
+
+// A new PLTS that sends a 0x8C block without asking for a window.
+static gboolean unaskedTest(void)
+{
+    int fds[2];
+    struct timeval timeout = {TEST_TIMEOUT,0};
+    GIOChannel *channel;
+    guint8 block[3 + 10];
+    guint8 reply[2];
+    gboolean ok;
+
+    if(socketpair(AF_UNIX,SOCK_STREAM,0,fds) != 0) return FALSE;
+    // Fail rather than wait for a reply that is never coming
+    setsockopt(fds[1],SOL_SOCKET,SO_RCVTIMEO,&timeout,sizeof(timeout));
+    channel = g_io_channel_unix_new(fds[0]);
+    g_io_channel_set_encoding(channel,NULL,NULL);
+    PLTSConnect(&plts,channel);
+
+    block[0] = 0x80;
+    block[1] = block[2] = 0;
+    ok = sendAll(fds[1],block,3);
+    block[0] = 0x8C;
+    block[1] = 0;
+    block[2] = 10;
+    for(gsize i = 0; i < 10; i++) block[3 + i] = tapeCharacter(i);
+    ok = ok && sendAll(fds[1],block,3 + 10) && waitForTape();
+    ok = ok && receiveAll(fds[1],reply,1) && (reply[0] == 0x81);
+    ok = ok && receiveAll(fds[1],reply,2) && (reply[0] == 0x8C) && (reply[1] == 1);
+
+    close(fds[1]);
+    return ok;
+}
+
+static gboolean timedOut(__attribute__((unused)) gpointer data)
+{
+    g_print("Timed out\n");
+    failed = TRUE;
+    g_main_loop_quit(loop);
+    return G_SOURCE_REMOVE;
+}
+
+int main(void)
+{
+    int fds[2];
+    GIOChannel *channel;
+    GThread *thread;
+
+    if(socketpair(AF_UNIX,SOCK_STREAM,0,fds) != 0)
+    {
+	perror("socketpair");
+	return 1;
+    }
+
+    TapeInit(&tape);
+    PLTSInit(&plts,&tape,onCommand);
+    channel = g_io_channel_unix_new(fds[0]);
+    g_io_channel_set_encoding(channel,NULL,NULL);
+    PLTSConnect(&plts,channel);
+
+    loop = g_main_loop_new(NULL,FALSE);
+    g_timeout_add(1,readTape,NULL);
+    g_timeout_add_seconds(TEST_TIMEOUT,timedOut,NULL);
+    thread = g_thread_new("PLTS",sender,GINT_TO_POINTER(fds[1]));
+    g_main_loop_run(loop);
+
+    if(g_atomic_int_get(&sendingDone) < 0) failed = TRUE;
+    if(!failed) g_thread_join(thread);
+
+    if(!failed && (received != sent))
+    {
+	g_print("%" G_GSIZE_FORMAT " characters read but %" G_GSIZE_FORMAT " sent\n",received,sent);
+	failed = TRUE;
+    }
+    if(!failed && (blocksAcknowledged != TEST_BLOCKS))
+    {
+	g_print("%d blocks acknowledged but %d sent\n",blocksAcknowledged,TEST_BLOCKS);
+	failed = TRUE;
+    }
+
+    if(!failed && !rewindTest(fds[1]))
+    {
+	g_print("Rewound tape not read again\n");
+	failed = TRUE;
+    }
+    if(!failed && !unaskedTest())
+    {
+	g_print("0x8C block without 0x8B not acknowledged with 0x8C\n");
+	failed = TRUE;
+    }
+
+    if(!failed)
+	g_print("%d blocks, %" G_GSIZE_FORMAT " characters read and acknowledged\n",TEST_BLOCKS,received);
+    TapeTidy(&tape);
+    return failed ? 1 : 0;
+}
@@ -12,22 +12,53 @@
 #include "PTS.h"
 #include "Wiring.h"
 #include "Logging.h"
+#include "Emulate.h"
+#include "Snapshot.h"
+#include "Tape.h"
+#include "PLTS.h"
+
+/* The PTS is on the wiring bus, and the bus (Wires[] in Wiring.c) is
+   shared by the whole process, so there is only ever one of it and it
+   serves WiredMachine alone.  Its state, the busy times included, is
+   kept here rather than in an E803Machine for that reason, and is saved
+   and restored with WiredMachine's snapshots.  Machines that are not on
+   the bus, such as those in 803-batch and 803-farm, have a FilePTS each
+   with the same state in it. */
 
 static gboolean initPLTS(void);
+static void pltsCommand(guint8 command,guint8 argument);
 static gboolean PLTSReaderOnline = FALSE;
 static unsigned int CLines,TRlines;
 static int onlineWr = 0;
+static int onlineRd = 0;
 static gchar onlineBuffer[32];
-static unsigned char tapeRxBuffer[65536];
-static gsize  tapeRxBufferLength = 0;
-static gsize PLTStapePosition;
+static E803Tape reader;         // Written by the PLTS, read by F71
+static E803PLTS Plts;            // Takes apart what the PLTS sends
+static GString *TapesPath = NULL;   // The user's tape directory
+
+/* The real reader managed 500 characters a second, one every 2ms or
+   just under 7 word times.  Otherwise a character is there as soon as
+   F71 asks for it. */
+#define READER_WORD_TIMES 7
+static gboolean ReaderRealSpeed = FALSE;
+static int64_t F71BusyUntil = 0;
+static gboolean RealTime = TRUE;   // Paced by the ALSA period clock, not turbo
 
 static gboolean PTSF71 = FALSE;    // F71 and F74 signals in the PTS. 
 static gboolean PTSF74 = FALSE;
+static int64_t F74BusyUntil = 0;
+
+/* Nothing to read yet.  In real time F71 looks again every word time,
+   as it did before idle word times were skipped, so tape arriving from
+   the PLTS part way through a period is picked up at the same word
+   time.  In turbo mode it waits for the next batch. */
+static void readerWaiting(void)
+{
+    if(RealTime) WiredMachine->PeripheralEventAt = WiredMachine->CPU_word_time_count + 1;
+}
 
 static void F71changed(unsigned int value)
 {
-    static int onlineRd = 0;
     if(value == 1)
     {
 	PTSF71 = TRUE;
@@ -55,16 +86,32 @@ static void F71changed(unsigned int value)
 		    onlineRd &= 0x1F;
 		    wiring(READY,1);
 		}
+		else
+		{
+		    readerWaiting();
+		}
 	    }
 	}
 	else
 	{
-	    if(PLTStapePosition < tapeRxBufferLength)
+	    guint8 character;
+
+	    if(ReaderRealSpeed && (WiredMachine->CPU_word_time_count < F71BusyUntil))
+	    {
+		// Let the CPU skip ahead to when the next character is read
+		WiredMachine->PeripheralEventAt = F71BusyUntil;
+	    }
+	    else if(TapeRead(&reader,&character))
 	    {
 		// Changed to "& 0x3F" so that EDSAC chars with extra 6th bit can be echoed.
-		TRlines =  (unsigned int) tapeRxBuffer[PLTStapePosition++]  & 0x3F; 
+		TRlines =  (unsigned int) character  & 0x3F; 
+		F71BusyUntil = WiredMachine->CPU_word_time_count + READER_WORD_TIMES;
 		wiring(READY,1);
 	    }
+	    else
+	    {
+		readerWaiting();
+	    }
 	}
     }
     else
@@ -73,21 +120,23 @@ static void F71changed(unsigned int value)
     }
 }
 
-extern int CPU_word_time_count;
-
 static void F74changed(unsigned int value)
 {
-    static int F74BusyUntil = 0;
     if(value == 1)
     {
 	PTSF74 = TRUE;
 
-	if(CPU_word_time_count >= F74BusyUntil)
+	if(WiredMachine->CPU_word_time_count >= F74BusyUntil)
 	{
-	    F74BusyUntil = CPU_word_time_count + 347;
+	    F74BusyUntil = WiredMachine->CPU_word_time_count + 347;
 	
 	    wiring(READY,1);
 	}
+	else
+	{
+	    // Let the CPU skip ahead to when the punch is free
+	    WiredMachine->PeripheralEventAt = F74BusyUntil;
+	}
     }
     else
     {
@@ -163,9 +212,151 @@ static void chargerDisconnected(__attribute__((unused)) unsigned int state)
     wiring(PTS24VOLTSON,MainsOn && ChargerConnected); 
 }
 
+/* What is left of the tape in the reader, so that a snapshot carries on
+   from the same character.  A tape still arriving from the PLTS is
+   saved as far as it has got. */
+typedef struct
+{
+    gsize tapeLength;
+    unsigned int CLines,TRlines;
+    int onlineWr,onlineRd;
+    gchar onlineBuffer[32];
+    int64_t F71BusyUntil,F74BusyUntil;
+    gboolean readerOnline,readerEcho,F71,F74,mainsOn,chargerConnected;
+} PTSState;
+
+#define PTS_FIELD(name) SNAPSHOT_FIELD(PTSState,name)
+
+static const SnapshotField PTSFields[] = {
+    PTS_FIELD(tapeLength),PTS_FIELD(CLines),PTS_FIELD(TRlines),PTS_FIELD(onlineWr),
+    PTS_FIELD(onlineRd),PTS_FIELD(onlineBuffer),PTS_FIELD(F71BusyUntil),PTS_FIELD(F74BusyUntil),
+    PTS_FIELD(readerOnline),PTS_FIELD(readerEcho),PTS_FIELD(F71),PTS_FIELD(F74),
+    PTS_FIELD(mainsOn),PTS_FIELD(chargerConnected)
+};
+
+static void savePTS(GByteArray *data)
+{
+    PTSState saved;
+
+    saved.tapeLength = TapeUnread(&reader);
+    saved.CLines = CLines;
+    saved.TRlines = TRlines;
+    saved.onlineWr = onlineWr;
+    saved.onlineRd = onlineRd;
+    memcpy(saved.onlineBuffer,onlineBuffer,sizeof(onlineBuffer));
+    saved.F71BusyUntil = F71BusyUntil;
+    saved.F74BusyUntil = F74BusyUntil;
+    saved.readerOnline = PLTSReaderOnline;
+    saved.readerEcho = PLTSReaderEcho;
+    saved.F71 = PTSF71;
+    saved.F74 = PTSF74;
+    saved.mainsOn = MainsOn;
+    saved.chargerConnected = ChargerConnected;
+
+    SnapshotSaveFields(data,&saved,PTSFields,G_N_ELEMENTS(PTSFields));
+    TapeSaveUnread(&reader,data);
+}
+
+/* The PLTS's side of a restored snapshot, passed to the GUI thread as
+   the PLTS handlers run there and own these. */
+typedef struct
+{
+    gboolean readerOnline,readerEcho;
+    int unread;
+    gchar characters[32];
+} PLTSRestore;
+
+static gboolean restorePLTS(gpointer data)
+{
+    PLTSRestore *restore = (PLTSRestore *) data;
+
+    PLTSReaderOnline = restore->readerOnline;
+    PLTSReaderEcho = restore->readerEcho;
+    for(int n = 0; n < restore->unread; n++)
+    {
+	onlineBuffer[onlineWr++] = restore->characters[n];
+	onlineWr &= 0x1F;
+    }
+    g_free(restore);
+    return G_SOURCE_REMOVE;
+}
+
+/* Called on the emulation thread, so only what belongs to it is put
+   back here.  The online characters that had not been read are thrown
+   away and sent again by the GUI thread along with the PLTS settings. */
+static gboolean restorePTS(const guint8 *data,gsize length)
+{
+    PTSState saved;
+    PLTSRestore *restore;
+    gsize fieldsLength = SnapshotFieldsLength(PTSFields,G_N_ELEMENTS(PTSFields));
+    int rd;
+
+    if(length < fieldsLength) return FALSE;
+    data = SnapshotRestoreFields(&saved,data,PTSFields,G_N_ELEMENTS(PTSFields));
+    if((length - fieldsLength) != saved.tapeLength) return FALSE;
+
+    TapeHold(&reader,data,saved.tapeLength);
+    CLines = saved.CLines;
+    TRlines = saved.TRlines;
+    F71BusyUntil = saved.F71BusyUntil;
+    F74BusyUntil = saved.F74BusyUntil;
+
+    restore = g_new0(PLTSRestore,1);
+    restore->readerOnline = saved.readerOnline;
+    restore->readerEcho = saved.readerEcho;
+    for(rd = saved.onlineRd & 0x1F; rd != (saved.onlineWr & 0x1F); rd = (rd + 1) & 0x1F)
+	restore->characters[restore->unread++] = saved.onlineBuffer[rd];
+    onlineRd = onlineWr;
+    g_idle_add(restorePLTS,restore);
+
+    PTSF71 = saved.F71;
+    PTSF74 = saved.F74;
+    MainsOn = saved.mainsOn;
+    ChargerConnected = saved.chargerConnected;
+    return TRUE;
+}
+
+void PTSReaderRealSpeed(gboolean realSpeed)
+{
+    ReaderRealSpeed = realSpeed;
+}
+
+void PTSRealTime(gboolean realTime)
+{
+    RealTime = realTime;
+}
+
+/* Put a tape file in the reader, in place of whatever the PLTS sent.
+   Names that aren't found as they are are looked for in the user's
+   tapes directory.  Called before the emulation thread starts, as the
+   reader belongs to it after that. */
+gboolean PTSLoadTape(const gchar *fileName)
+{
+    GString *path;
+    GError *error = NULL;
+    gboolean ok;
+
+    path = g_string_new(fileName);
+    if(!g_path_is_absolute(fileName) && !g_file_test(fileName,G_FILE_TEST_EXISTS))
+	g_string_prepend(path,TapesPath->str);
+
+    ok = TapeMap(&reader,path->str,&error);
+    if(ok)
+    {
+	g_info("Tape %s is in the reader\n",path->str);
+    }
+    else
+    {
+	g_warning("Failed to open tape file %s (%s)\n",path->str,error->message);
+	g_error_free(error);
+    }
+    g_string_free(path,TRUE);
+    return ok;
+}
+
 __attribute__((used))
 void PTSInit( __attribute__((unused))  GString *sharedPath,
-	      __attribute__((unused))  GString *userPath)
+	      GString *userPath)
 {
     connectWires(F71, F71changed);
     connectWires(F74, F74changed);
@@ -176,6 +367,13 @@ void PTSInit( __attribute__((unused))  GString *sharedPath,
     connectWires(MAINS_SUPPLY_OFF,mainsOff);
     connectWires(CHARGER_CONNECTED,chargerConnected);
     connectWires(CHARGER_DISCONNECTED,chargerDisconnected);
+
+    TapeInit(&reader);
+    PLTSInit(&Plts,&reader,pltsCommand);
+    TapesPath = g_string_new(userPath->str);
+    g_string_append(TapesPath,"tapes/");
+
+    SnapshotRegister("PTS ",savePTS,restorePTS);
     initPLTS();
 }
 
@@ -185,160 +383,66 @@ void PTSInit( __attribute__((unused))  GString *sharedPath,
 #include <sys/socket.h> 
 #include <netinet/in.h> 
 #include <netdb.h>
+#include <errno.h>
 
 static GIOChannel *listening_channel;
-static gsize tapeRxBlockLength,tapeRxOffset;
 
-static gboolean  process_message(GIOChannel *source,
-				 __attribute__((unused))GIOCondition condition,
-				 __attribute__((unused))gpointer data)
+static void onlineCharacter(guint8 character)
 {
-    static gchar message[300];
-    gsize length,written;
-    GError *error = NULL;
-    GIOStatus status;
-    static gsize messageLength = 1;
-    static gsize offset = 0;
-    char value[3];
-    static unsigned char cmd = 0;
     static gchar onlineLS = 0;
+    gboolean setShift = FALSE;
 
-    status = g_io_channel_read_chars(source,&message[offset],messageLength,&length,&error);
-	
-    if(status != G_IO_STATUS_NORMAL)
+    // Test is "force shift" bit set
+    if((character & 0x80) == 0x80)
     {
-	g_io_channel_shutdown(source,FALSE,NULL);
-	g_info("Disconnect from PLTS\n");
-	return FALSE;
+	setShift = TRUE;
     }
-    else
+    // Test is "shift independent" bit set
+    else if((character & 0x40) == 0x00)
     {
-	messageLength -= length;
-	offset += length;
-
-	if(messageLength == 0)
+	// Test is shift has changed
+	if(((character ^ onlineLS) & 0x20) == 0x20)
 	{
-	    if(cmd == 0)
-	    {
-		//printf("Rx Command 0x%02x\n",message[0] & 0xFF);
-		switch(message[0] & 0xFF)
-		{
-		case 0x80:
-		    cmd = 0x80;
-		    messageLength = 2;
-		    break;
-		case 0x81:
-		    cmd = 0x81;
-		    messageLength = 1;
-		    break;
-		case 0x82:
-		    PLTStapePosition = 0;
-		    cmd = 0;
-		    offset = 0;
-		    tapeRxBufferLength = tapeRxOffset;
-		    messageLength = 1;
-		    break;
-		case 0x84:
-		    PLTSReaderEcho = TRUE;
-		    cmd = 0;
-		    messageLength = 1;
-		    offset = 0;
-		    break;
-		case 0x85:
-		    PLTSReaderEcho = FALSE;
-		    cmd = 0;
-		    messageLength = 1;
-		    offset = 0;
-		    break;
-		case 0x88:
-		    PLTSReaderOnline = TRUE;
-		    cmd = 0;
-		    messageLength = 1;
-		    offset = 0;
-		    break;
-		case 0x89:
-		    PLTSReaderOnline = FALSE;
-		    cmd = 0;
-		    messageLength = 1;
-		    offset = 0;
-		    break;
-		case 0x8A:
-		    cmd = 0x8A;
-		    messageLength = 1;
-		    break;	    
-		}
-	    }
-	    else
-	    {
-		switch(cmd)
-		{
-		case 0x80:
-		    value[0] = '\x81';
-		    g_io_channel_write_chars(source,value,1,&written,&error);
-		    g_io_channel_flush(source,NULL);
-		    cmd = 0;
-		    messageLength = 1;
-		    offset = 0;
-		    tapeRxOffset = 0;
-		    break;
-		case 0x81:
-		    cmd = 0xFF;
-		    messageLength = message[1] & 0xFF ;
-		    if(messageLength == 0) messageLength = 256;
-		    tapeRxBlockLength = messageLength;
-		    break;
-
-		case 0x8A:
-		{
-		    gboolean setShift = FALSE;
-
-		    // Test is "force shift" bit set
-		    if((message[1] & 0x80) == 0x80)
-		    {
-			setShift = TRUE;
-		    }
-		    // Test is "shift independent" bit set
-		    else if((message[1] & 0x40) == 0x00)
-		    {
-			// Test is shift has changed
-			if(((message[1] ^ onlineLS) & 0x20) == 0x20)
-			{
-			    setShift = TRUE;
-			}
-		    }
-
-		    if(setShift)
-		    {
-			onlineLS = (char) (0x1B + ((message[1] >> 3) & 0x4));
-			onlineBuffer[onlineWr++] = onlineLS;
-			onlineWr &= 0x1F;
-			onlineLS = message[1];
-		    }
-		    
-		    onlineBuffer[onlineWr++] =  message[1] & 0x3F;
-		    onlineWr &= 0x1F;
-
-		    cmd = 0;
-		    messageLength = 1;
-		    offset = 0;
-		    break;
-		}
-		    
-		case 0xFF:
-		    memcpy(&tapeRxBuffer[tapeRxOffset],&message[2],tapeRxBlockLength);
-		    tapeRxOffset += tapeRxBlockLength;
-		    value[0] = '\x81';
-		    g_io_channel_write_chars(source,value,1,&written,&error);
-		    g_io_channel_flush(source,NULL);
-		    cmd = 0;
-		    offset = 0;
-		    messageLength = 1;
-		    break;
-		}
-	    }
+	    setShift = TRUE;
 	}
-    }    
-    return TRUE;
+    }
+
+    if(setShift)
+    {
+	onlineLS = (char) (0x1B + ((character >> 3) & 0x4));
+	onlineBuffer[onlineWr++] = onlineLS;
+	onlineWr &= 0x1F;
+	onlineLS = (gchar) character;
+    }
+
+    onlineBuffer[onlineWr++] = (gchar) (character & 0x3F);
+    onlineWr &= 0x1F;
+}
+
+// The PLTS's commands that are not about the tape
+static void pltsCommand(guint8 command,guint8 argument)
+{
+    switch(command)
+    {
+    case 0x84:
+	PLTSReaderEcho = TRUE;
+	break;
+    case 0x85:
+	PLTSReaderEcho = FALSE;
+	break;
+    case 0x88:
+	PLTSReaderOnline = TRUE;
+	break;
+    case 0x89:
+	PLTSReaderOnline = FALSE;
+	break;
+    case 0x8A:
+	onlineCharacter(argument);
+	break;
+    default:
+	g_debug("Ignored PLTS command 0x%02x\n",command);
+	break;
+    }
 }
 
 
@@ -365,8 +469,8 @@ accept_new_connection(GIOChannel *source,
 	/* Add this as an channel as well */
 	peripheral_channel = g_io_channel_unix_new(peripheral_socket);
 
-	g_io_add_watch(peripheral_channel,G_IO_IN ,process_message,NULL);
 	g_io_channel_set_encoding(peripheral_channel,NULL,NULL);
+	PLTSConnect(&Plts,peripheral_channel);
 
 	hp = gethostbyaddr((char *) &from.sin_addr.s_addr,4,AF_INET);
 	if(hp != NULL)
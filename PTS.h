@@ -5,4 +5,7 @@
     See LICENCE file. 
 */
 void PTSInit( __attribute__((unused))  GString *sharedPath,
-	      __attribute__((unused))  GString *userPath);
+	      GString *userPath);
+void PTSReaderRealSpeed(gboolean realSpeed);
+void PTSRealTime(gboolean realTime);
+gboolean PTSLoadTape(const gchar *fileName);
@@ -0,0 +1,61 @@
+/*  This file is part of the Elliott 803 emulator.
+
+    Copyright © 2020  Peter Onion
+
+    See LICENCE file. 
+*/
+
+#define G_LOG_USE_STRUCTURED
+#include <stdio.h>
+#include <glib.h>
+
+#include "Panel.h"
+
+#define FRESH 4              // Set in Middle when it is newer than Front
+
+static E803Panel Buffers[3];
+static E803Panel Working;    // Emulation thread only
+static gint Back = 0;        // Emulation thread only
+static gint Front = 2;       // GUI only
+static volatile gint Middle = 1;
+
+static gint exchange(volatile gint *atomic,gint value)
+{
+    gint old;
+
+    do
+    {
+	old = g_atomic_int_get(atomic);
+    } while(!g_atomic_int_compare_and_exchange(atomic,old,value));
+    return old;
+}
+
+static void publish(void)
+{
+    Buffers[Back] = Working;
+    Back = exchange(&Middle,Back | FRESH) & 3;
+}
+
+void PanelDM160s(const int bright[7])
+{
+    for(int n = 0; n < 7; n++)
+    {
+	Working.DM160s[n] = (gfloat) bright[n];
+    }
+    publish();
+}
+
+void PanelConsoleLamp(gboolean on)
+{
+    Working.consoleLamp = on;
+    publish();
+}
+
+gboolean PanelLatest(E803Panel *panel)
+{
+    if((g_atomic_int_get(&Middle) & FRESH) == 0) return FALSE;
+
+    Front = exchange(&Middle,Front) & 3;
+    *panel = Buffers[Front];
+    return TRUE;
+}
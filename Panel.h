@@ -0,0 +1,30 @@
+/*  This file is part of the Elliott 803 emulator.
+
+    Copyright © 2020  Peter Onion
+
+    See LICENCE file. 
+*/
+
+#pragma once
+/* The state of the lamps on the console, published by the emulation
+   thread and drawn by the GUI.  They are passed through a triple
+   buffer: the emulation thread fills one, swaps it with the one in
+   the middle and marks that as new, and the GUI swaps the one it is
+   reading with the middle one when that is new.  Neither side ever
+   waits, the GUI always sees a whole consistent state and it only
+   ever sees the latest, however long it has been since it looked. */
+
+#include <glib.h>
+
+typedef struct _e803Panel
+{
+    gfloat DM160s[7];        // Brightness of the DM160s, [6] is full brightness
+    gboolean consoleLamp;    // The light on the console, mains and power both on
+} E803Panel;
+
+// Called by the emulation thread
+void PanelDM160s(const int bright[7]);
+void PanelConsoleLamp(gboolean on);
+
+// Called by the GUI.  FALSE if nothing has changed since the last call.
+gboolean PanelLatest(E803Panel *panel);
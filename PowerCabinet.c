@@ -12,6 +12,7 @@
 #include "Common.h"
 #include "Wiring.h"
 #include "PowerCabinet.h"
+#include "Snapshot.h"
 
 static gboolean SuppliesOn = FALSE;
 struct fsm PowerFSM;
@@ -196,6 +197,41 @@ static void checkVbat(__attribute__((unused)) unsigned int value)
 }
 
 
+// The sequencer's state, so a snapshot can be restored without powering up again.
+typedef struct
+{
+    int state;
+    int nextEvent;
+    gboolean suppliesOn;
+} PowerCabinetState;
+
+static const SnapshotField PowerCabinetFields[] = {
+    SNAPSHOT_FIELD(PowerCabinetState,state),SNAPSHOT_FIELD(PowerCabinetState,nextEvent),
+    SNAPSHOT_FIELD(PowerCabinetState,suppliesOn)
+};
+
+static void savePowerCabinet(GByteArray *data)
+{
+    PowerCabinetState saved;
+
+    saved.state = PowerFSM.state;
+    saved.nextEvent = PowerFSM.nextEvent;
+    saved.suppliesOn = SuppliesOn;
+    SnapshotSaveFields(data,&saved,PowerCabinetFields,G_N_ELEMENTS(PowerCabinetFields));
+}
+
+static gboolean restorePowerCabinet(const guint8 *data,gsize length)
+{
+    PowerCabinetState saved;
+
+    if(length != SnapshotFieldsLength(PowerCabinetFields,G_N_ELEMENTS(PowerCabinetFields))) return FALSE;
+    SnapshotRestoreFields(&saved,data,PowerCabinetFields,G_N_ELEMENTS(PowerCabinetFields));
+    PowerFSM.state = saved.state;
+    PowerFSM.nextEvent = saved.nextEvent;
+    SuppliesOn = saved.suppliesOn;
+    return TRUE;
+}
+
 // Wire up the power cabinet !
 
 void PowerCabinetInit(__attribute__((unused)) GString *sharedPath,
@@ -211,6 +247,8 @@ void PowerCabinetInit(__attribute__((unused)) GString *sharedPath,
     connectWires(BATTERY_OFF_PRESSED,PowerCabinetBatteryOff);
 		
     connectWires(TIMER100HZ,checkVbat);
+
+    SnapshotRegister("PWR ",savePowerCabinet,restorePowerCabinet);
 }
 
 void PowerCabinetTidy(__attribute__((unused)) GString *userPath)
@@ -0,0 +1,128 @@
+/*  This file is part of the Elliott 803 emulator.
+
+    Copyright © 2020  Peter Onion
+
+    See LICENCE file. 
+*/
+
+/* Execution profiles.  The counting is done by the inline functions in
+   Profile.h, this just makes them and writes them out as a listing. */
+
+#define G_LOG_USE_STRUCTURED
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <glib.h>
+
+#include "Profile.h"
+#include "Wiring.h"
+
+// Number of '*'s for the hottest address in the listing
+#define HOTTEST_STARS 20
+
+E803Profile *ProfileNew(void)
+{
+    E803Profile *profile;
+
+    profile = (E803Profile *) calloc(1,sizeof(E803Profile));
+    profile->lastFn = -1;
+    return profile;
+}
+
+void ProfileReset(E803Profile *profile)
+{
+    memset(profile,0,sizeof(E803Profile));
+    profile->lastFn = -1;
+}
+
+void ProfileFree(E803Profile *profile)
+{
+    free(profile);
+}
+
+static void appendInstruction(GString *text,E803word word)
+{
+    unsigned int f1,n1,b,f2,n2;
+
+    f1 = (unsigned int) (word >> 33) & 077;
+    n1 = (unsigned int) (word >> 20) & 017777;
+    b =  (unsigned int) (word >> 19) & 01;
+    f2 = (unsigned int) (word >> 13) & 077;
+    n2 = (unsigned int) word & 017777;
+
+    g_string_append_printf(text,"%02o %4u%c%02o %4u",f1,n1,b?'/':':',f2,n2);
+}
+
+/* Write the profile as a table of functions followed by a listing of
+   the store.  Every word that was obeyed or isn't zero is listed with
+   the counts for both halves and a bar of '*'s showing how hot it is.
+   Runs of unused zero words are left out. */
+gboolean ProfileDump(E803Profile *profile,E803word *core,const gchar *fileName,GError **error)
+{
+    GString *text;
+    uint64_t instructions = 0,wordTimes = 0,hottest = 0,count;
+    int address,stars;
+    gboolean skipped = FALSE,ok;
+
+    for(int fn = 0; fn < 64; fn++)
+    {
+	instructions += profile->fnCount[fn];
+	wordTimes += profile->fnWordTimes[fn];
+    }
+    for(int scr = 0; scr < 16384; scr += 2)
+    {
+	count = profile->scrCount[scr] + profile->scrCount[scr+1];
+	if(count > hottest) hottest = count;
+    }
+
+    text = g_string_new(NULL);
+    g_string_append_printf(text,"%" PRIu64 " instructions in %" PRIu64 " word times\n\n",
+			   instructions,wordTimes);
+    g_string_append(text,"Fn         Count   Word times  % time\n");
+    for(int fn = 0; fn < 64; fn++)
+    {
+	if(profile->fnCount[fn] == 0) continue;
+	g_string_append_printf(text,"%02o %13" PRIu64 " %12" PRIu64 " %6.2f\n",fn,
+			       profile->fnCount[fn],profile->fnWordTimes[fn],
+			       (wordTimes != 0) ? (100.0 * (double) profile->fnWordTimes[fn]) / (double) wordTimes : 0.0);
+    }
+
+    g_string_append(text,"\nAddr  Instructions        First half   Second half\n");
+    for(address = 0; address < 8192; address++)
+    {
+	count = profile->scrCount[address*2] + profile->scrCount[address*2+1];
+	if((count == 0) && (core[address] == 0))
+	{
+	    skipped = TRUE;
+	    continue;
+	}
+	if(skipped)
+	{
+	    g_string_append(text,"   ...\n");
+	    skipped = FALSE;
+	}
+
+	g_string_append_printf(text,"%4d  ",address);
+	appendInstruction(text,core[address]);
+	g_string_append_printf(text,"  %12" PRIu64 "  %12" PRIu64,
+			       profile->scrCount[address*2],profile->scrCount[address*2+1]);
+	if(count != 0)
+	{
+	    g_string_append(text,"  ");
+	    stars = (int) (((count * HOTTEST_STARS) + hottest - 1) / hottest);
+	    for(int n = 0; n < stars; n++) g_string_append_c(text,'*');
+	}
+	g_string_append_c(text,'\n');
+    }
+    if(skipped)
+    {
+	g_string_append(text,"   ...\n");
+    }
+
+    wiringStatistics(text);
+
+    ok = g_file_set_contents(fileName,text->str,(gssize) text->len,error);
+    g_string_free(text,TRUE);
+    return ok;
+}
@@ -0,0 +1,54 @@
+/*  This file is part of the Elliott 803 emulator.
+
+    Copyright © 2020  Peter Onion
+
+    See LICENCE file. 
+*/
+
+#pragma once
+/* Execution profile of an 803 program.  The counters are updated by
+   the emulator at every fetch while a machine's Profile pointer is
+   set, so profiling is turned on and off by setting or clearing it. */
+
+#include <stdint.h>
+#include <glib.h>
+#include "E803-types.h"
+
+typedef struct _e803Profile
+{
+    uint64_t fnCount[64];        // Instructions obeyed for each function
+    uint64_t fnWordTimes[64];    // Word times from each fetch to the next one
+    uint64_t scrCount[16384];    // Instructions obeyed at each SCR (address * 2 + half)
+    int lastFn;                  // Function being timed, or -1
+    int64_t lastStart;           // Word time it was fetched in
+} E803Profile;
+
+E803Profile *ProfileNew(void);
+void ProfileReset(E803Profile *profile);
+void ProfileFree(E803Profile *profile);
+gboolean ProfileDump(E803Profile *profile,E803word *core,const gchar *fileName,GError **error);
+
+/* Called at each fetch that isn't stopped.  The word times since the
+   last fetch, including L and B cycles and any skipped while idle,
+   are charged to the previous instruction. */
+static inline void profileFetch(E803Profile *profile,int fn,int32_t scr,int64_t wordTime)
+{
+    if(profile->lastFn >= 0)
+    {
+	profile->fnWordTimes[profile->lastFn] += (uint64_t) (wordTime - profile->lastStart);
+    }
+    profile->lastFn = fn;
+    profile->lastStart = wordTime;
+    profile->fnCount[fn] += 1;
+    profile->scrCount[scr & 16383] += 1;
+}
+
+// Called when the machine is stopped so that isn't charged to anything.
+static inline void profileStopped(E803Profile *profile,int64_t wordTime)
+{
+    if(profile->lastFn >= 0)
+    {
+	profile->fnWordTimes[profile->lastFn] += (uint64_t) (wordTime - profile->lastStart);
+	profile->lastFn = -1;
+    }
+}
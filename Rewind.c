@@ -0,0 +1,432 @@
+/*  This file is part of the Elliott 803 emulator.
+
+    Copyright © 2020  Peter Onion
+
+    See LICENCE file. 
+*/
+
+/* Checkpoints for going backwards.  The store is kept up to date in a
+   shadow copy at each checkpoint, so the words that have changed since
+   the last one are found by looking only at the dirty bits set by
+   writeStore().  What the shadow held for them is what the new
+   checkpoint saves. */
+
+#define G_LOG_USE_STRUCTURED
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "Rewind.h"
+#include "Breakpoints.h"
+#include "Scheduler.h"
+#include "Wiring.h"
+
+typedef struct _rewindWord
+{
+    int address;
+    E803word word;
+} RewindWord;
+
+/* A checkpoint.  words holds what changed in the store since the one
+   before as it was then, so it is used to go back past this one. */
+typedef struct _rewindRecord
+{
+    int64_t wordTime;
+    E803Machine machine;
+    int count;
+    RewindWord words[];
+} RewindRecord;
+
+// What a machine uses that must be left alone while going forward again
+typedef struct _replayState
+{
+    void (*wire)(E803Machine *cpu,enum WiringEvent event,unsigned int value);
+    struct _e803CpuSound *sound;
+    struct _e803Profile *profile;
+    struct _e803Trace *trace;
+    struct _e803Breakpoints *breakpoints;
+    struct _e803Scheduler *scheduler;
+    int64_t start;
+} ReplayState;
+
+static gsize recordSize(int count)
+{
+    return sizeof(RewindRecord) + (gsize) count * sizeof(RewindWord);
+}
+
+E803Rewind *RewindNew(gsize limit,int interval)
+{
+    E803Rewind *rewind;
+
+    rewind = (E803Rewind *) calloc(1,sizeof(E803Rewind));
+    rewind->shadow = (E803word *) calloc(8192,sizeof(E803word));
+    rewind->records = g_queue_new();
+    rewind->limit = limit;
+    rewind->interval = (interval > 0) ? interval : 1;
+    return rewind;
+}
+
+void RewindFree(E803Rewind *rewind)
+{
+    g_queue_free_full(rewind->records,g_free);
+    free(rewind->shadow);
+    free(rewind);
+}
+
+// Forget everything, for example after a snapshot has been restored.
+void RewindReset(E803Rewind *rewind)
+{
+    g_queue_free_full(rewind->records,g_free);
+    rewind->records = g_queue_new();
+    rewind->size = 0;
+    rewind->seenValid = false;
+}
+
+static void dropOldest(E803Rewind *rewind)
+{
+    RewindRecord *record;
+
+    record = (RewindRecord *) g_queue_pop_head(rewind->records);
+    rewind->size -= recordSize(record->count);
+    g_free(record);
+}
+
+static unsigned int signals(E803Machine *cpu)
+{
+    return (cpu->CpuRunning ? 1U : 0U) | (cpu->S ? 2U : 0U) |
+	(cpu->SS25 ? 4U : 0U) | (cpu->SS3 ? 8U : 0U);
+}
+
+// Remember what the outside world could change before the next call.
+void RewindSeen(E803Rewind *rewind,E803Machine *cpu)
+{
+    rewind->seenValid = true;
+    rewind->seenWG = cpu->WG;
+    rewind->seenButtons = cpu->WG_ControlButtons;
+    rewind->seenSignals = signals(cpu);
+}
+
+static void takeCheckpoint(E803Rewind *rewind,E803Machine *cpu)
+{
+    RewindRecord *record;
+    uint32_t bits;
+    int address,count;
+
+    // Checkpoints from before the barrier can't be used any more
+    while(!g_queue_is_empty(rewind->records) &&
+	  (((RewindRecord *) g_queue_peek_head(rewind->records))->wordTime < rewind->barrier))
+    {
+	dropOldest(rewind);
+    }
+
+    if(g_queue_is_empty(rewind->records))
+    {   /* Start of history, so nothing to undo */
+	memcpy(rewind->shadow,cpu->CoreStore,8192 * sizeof(E803word));
+	memset(rewind->dirty,0,sizeof(rewind->dirty));
+    }
+
+    // Writing a word with what it already held doesn't count
+    count = 0;
+    for(int n = 0; n < 256; n++)
+    {
+	for(bits = rewind->dirty[n]; bits != 0; bits &= bits - 1)
+	{
+	    address = (n << 5) + __builtin_ctz(bits);
+	    if(cpu->CoreStore[address] != rewind->shadow[address]) count += 1;
+	}
+    }
+
+    record = (RewindRecord *) g_malloc(recordSize(count));
+    record->wordTime = cpu->CPU_word_time_count;
+    record->machine = *cpu;
+    record->count = 0;
+    for(int n = 0; n < 256; n++)
+    {
+	for(bits = rewind->dirty[n]; bits != 0; bits &= bits - 1)
+	{
+	    address = (n << 5) + __builtin_ctz(bits);
+	    if(cpu->CoreStore[address] != rewind->shadow[address])
+	    {
+		record->words[record->count].address = address;
+		record->words[record->count].word = rewind->shadow[address];
+		record->count += 1;
+		rewind->shadow[address] = cpu->CoreStore[address];
+	    }
+	}
+	rewind->dirty[n] = 0;
+    }
+
+    g_queue_push_tail(rewind->records,record);
+    rewind->size += recordSize(count);
+
+    // Always keep the newest one
+    while((rewind->size > rewind->limit) && (g_queue_get_length(rewind->records) > 1))
+    {
+	dropOldest(rewind);
+    }
+}
+
+/* Called by Emulate() before each stretch of emulation.  Takes a
+   checkpoint if one is due and returns how many of wordTimesLeft can be
+   emulated before the next one. */
+int RewindCheckpoint(E803Rewind *rewind,E803Machine *cpu,int wordTimesLeft)
+{
+    RewindRecord *newest;
+    int64_t wordTimes;
+
+    if(!rewind->seenValid || (rewind->seenWG != cpu->WG) ||
+       (rewind->seenButtons != cpu->WG_ControlButtons) || (rewind->seenSignals != signals(cpu)))
+    {
+	rewindBarrier(rewind,cpu);
+    }
+
+    newest = (RewindRecord *) g_queue_peek_tail(rewind->records);
+    if((newest == NULL) || (newest->wordTime < rewind->barrier) ||
+       ((cpu->CPU_word_time_count - newest->wordTime) >= rewind->interval))
+    {
+	takeCheckpoint(rewind,cpu);
+	newest = (RewindRecord *) g_queue_peek_tail(rewind->records);
+    }
+
+    wordTimes = newest->wordTime + rewind->interval - cpu->CPU_word_time_count;
+    return (wordTimes < wordTimesLeft) ? (int) wordTimes : wordTimesLeft;
+}
+
+// The earliest word time that can be gone back to, or -1.
+int64_t RewindOldest(E803Rewind *rewind)
+{
+    RewindRecord *record;
+
+    for(GList *link = rewind->records->head; link != NULL; link = link->next)
+    {
+	record = (RewindRecord *) link->data;
+	if(record->wordTime >= rewind->barrier) return record->wordTime;
+    }
+    return -1;
+}
+
+// The newest checkpoint that can be used to get to wordTime.
+static GList *findRecord(E803Rewind *rewind,int64_t wordTime)
+{
+    RewindRecord *record;
+
+    for(GList *link = rewind->records->tail; link != NULL; link = link->prev)
+    {
+	record = (RewindRecord *) link->data;
+	if(record->wordTime < rewind->barrier) break;
+	if(record->wordTime <= wordTime) return link;
+    }
+    return NULL;
+}
+
+/* Put the machine back as it was at a checkpoint.  Later checkpoints
+   are dropped, as after this they are the future. */
+static void restoreRecord(E803Rewind *rewind,E803Machine *cpu,GList *link)
+{
+    RewindRecord *record;
+    uint32_t bits;
+    int address;
+
+    // Back to the newest checkpoint first
+    for(int n = 0; n < 256; n++)
+    {
+	for(bits = rewind->dirty[n]; bits != 0; bits &= bits - 1)
+	{
+	    address = (n << 5) + __builtin_ctz(bits);
+	    cpu->CoreStore[address] = rewind->shadow[address];
+	}
+    }
+
+    while(rewind->records->tail != link)
+    {
+	record = (RewindRecord *) g_queue_pop_tail(rewind->records);
+	for(int n = 0; n < record->count; n++)
+	{
+	    cpu->CoreStore[record->words[n].address] = record->words[n].word;
+	}
+	rewind->size -= recordSize(record->count);
+	g_free(record);
+    }
+
+    record = (RewindRecord *) link->data;
+    RestoreMachine(cpu,&record->machine);
+    flushDecodedStore(cpu);
+
+    memcpy(rewind->shadow,cpu->CoreStore,8192 * sizeof(E803word));
+    memset(rewind->dirty,0,sizeof(rewind->dirty));
+}
+
+/* Nothing was transferred while going forward again, so whatever was
+   asked for was never ready. */
+static void replayWire(E803Machine *cpu,enum WiringEvent event,unsigned int value)
+{
+    if(((event == F71) || (event == F72) || (event == F74)) && (value != 0))
+    {
+	cpu->Ready = false;
+    }
+}
+
+/* Emulate again without sound, peripherals, breakpoints, profiling or
+   tracing, none of which should see the same word time twice. */
+static void replayStart(E803Rewind *rewind,E803Machine *cpu,ReplayState *state)
+{
+    state->wire = cpu->wire;
+    state->sound = cpu->sound;
+    state->profile = cpu->Profile;
+    state->trace = cpu->Trace;
+    state->breakpoints = cpu->Breakpoints;
+    state->scheduler = cpu->Scheduler;
+    state->start = cpu->CPU_word_time_count;
+
+    cpu->wire = replayWire;
+    cpu->sound = NULL;
+    cpu->Profile = NULL;
+    cpu->Trace = NULL;
+    cpu->Breakpoints = NULL;
+    cpu->Scheduler = NULL;
+    rewind->replaying = true;
+}
+
+static void replayEnd(E803Rewind *rewind,E803Machine *cpu,ReplayState *state)
+{
+    cpu->wire = state->wire;
+    cpu->sound = state->sound;
+    cpu->Profile = state->profile;
+    cpu->Trace = state->trace;
+    cpu->Breakpoints = state->breakpoints;
+    cpu->Scheduler = state->scheduler;
+    rewind->replaying = false;
+
+    // Nothing timed happens on the way, it all stays as far ahead as it was
+    if(cpu->Scheduler != NULL)
+	SchedulerShift(cpu->Scheduler,cpu->CPU_word_time_count - state->start);
+
+    // Going forward again didn't change anything from outside
+    RewindSeen(rewind,cpu);
+}
+
+static void replay(E803Rewind *rewind,E803Machine *cpu,int64_t wordTimes)
+{
+    ReplayState state;
+
+    replayStart(rewind,cpu,&state);
+    if(wordTimes > 0) Emulate(cpu,(int) wordTimes);
+    replayEnd(rewind,cpu,&state);
+}
+
+/* Go back to the state at the end of word time wordTime.  FALSE, with
+   nothing changed, if that is before the oldest usable checkpoint or
+   after now. */
+gboolean RewindTo(E803Rewind *rewind,E803Machine *cpu,int64_t wordTime)
+{
+    GList *link;
+
+    if(wordTime > cpu->CPU_word_time_count) return FALSE;
+    if((link = findRecord(rewind,wordTime)) == NULL) return FALSE;
+
+    restoreRecord(rewind,cpu,link);
+    replay(rewind,cpu,wordTime - ((RewindRecord *) link->data)->wordTime);
+    return TRUE;
+}
+
+/* Go back to just before the last instruction fetched before word time
+   before for which match returns TRUE (any instruction if match is
+   NULL).  Each stretch between checkpoints is emulated again one word
+   time at a time, newest first, until one is found.  If none is the
+   machine is left at the oldest usable checkpoint and FALSE is
+   returned. */
+gboolean RewindToFetch(E803Rewind *rewind,E803Machine *cpu,int64_t before,RewindMatch match,void *data)
+{
+    GList *link,*oldest = NULL;
+    RewindRecord *record;
+    ReplayState state;
+    int64_t end,at,found;
+    int32_t scr;
+    bool fetching;
+
+    end = (before < cpu->CPU_word_time_count) ? before : cpu->CPU_word_time_count;
+    while((link = findRecord(rewind,end - 1)) != NULL)
+    {
+	record = (RewindRecord *) link->data;
+	restoreRecord(rewind,cpu,link);
+
+	found = -1;
+	replayStart(rewind,cpu,&state);
+	while(cpu->CPU_word_time_count < end)
+	{
+	    at = cpu->CPU_word_time_count;
+	    scr = cpu->SCR;
+	    fetching = cpu->CpuRunning && cpu->R && !cpu->S;
+	    Emulate(cpu,1);
+	    if(fetching && !cpu->S && ((match == NULL) || (match)(cpu,scr,data)))
+	    {
+		found = at;
+	    }
+	}
+	replayEnd(rewind,cpu,&state);
+
+	if(found >= 0)
+	{
+	    restoreRecord(rewind,cpu,link);
+	    replay(rewind,cpu,found - record->wordTime);
+	    return TRUE;
+	}
+	end = record->wordTime;
+	oldest = link;
+    }
+
+    if(oldest != NULL)
+    {
+	restoreRecord(rewind,cpu,oldest);
+	RewindSeen(rewind,cpu);
+    }
+    return FALSE;
+}
+
+/* Where going backwards starts from.  A machine stopped by a breakpoint
+   goes back from just before the fetch that stopped it, as the word
+   times spent stopped since then can't be emulated again. */
+int64_t RewindNow(E803Machine *cpu)
+{
+    if(cpu->S && (cpu->Breakpoints != NULL) && (cpu->Breakpoints->lastHit != NULL))
+	return cpu->Breakpoints->lastHitAt - 1;
+    return cpu->CPU_word_time_count;
+}
+
+// Having gone back the machine isn't stopped by a breakpoint any more.
+static gboolean wentBack(E803Machine *cpu,gboolean ok)
+{
+    if(cpu->Breakpoints != NULL) cpu->Breakpoints->lastHit = NULL;
+    return ok;
+}
+
+gboolean RewindWordTimes(E803Rewind *rewind,E803Machine *cpu,int wordTimes)
+{
+    return wentBack(cpu,RewindTo(rewind,cpu,RewindNow(cpu) - wordTimes));
+}
+
+gboolean RewindInstructions(E803Rewind *rewind,E803Machine *cpu,int instructions)
+{
+    gboolean ok = TRUE;
+    int64_t now = RewindNow(cpu);
+
+    while(ok && (instructions-- > 0))
+    {
+	ok = RewindToFetch(rewind,cpu,now,NULL,NULL);
+	now = cpu->CPU_word_time_count;
+    }
+    return wentBack(cpu,ok);
+}
+
+static bool breakpointFetch(E803Machine *cpu,int32_t scr,void *data)
+{
+    return breakpointsMatch((E803Breakpoints *) data,cpu,scr,cpu->IR_saved);
+}
+
+// Back to just before the last instruction a breakpoint looks for.
+gboolean RewindToBreakpoint(E803Rewind *rewind,E803Machine *cpu)
+{
+    if(cpu->Breakpoints == NULL) return FALSE;
+    return wentBack(cpu,RewindToFetch(rewind,cpu,RewindNow(cpu),breakpointFetch,cpu->Breakpoints));
+}
@@ -0,0 +1,75 @@
+/*  This file is part of the Elliott 803 emulator.
+
+    Copyright © 2020  Peter Onion
+
+    See LICENCE file. 
+*/
+
+#pragma once
+/* Going backwards in time.  While a machine's Rewind pointer is set a
+   checkpoint is taken every so many word times.  Each one holds the
+   registers and what the words of store written since the checkpoint
+   before held at that checkpoint.  Going back undoes the stores,
+   newest first, and then emulates forward again from the checkpoint to
+   the word time wanted.
+
+   Nothing outside the machine is rewound, so history starts again
+   whenever something from outside changes it: a peripheral transfer,
+   a button being pressed or the debugger changing a register or the
+   store.  The checkpoints are kept in a queue whose total size is
+   capped, the oldest being dropped first. */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <glib.h>
+#include "E803-types.h"
+#include "Emulate.h"
+
+typedef struct _e803Rewind
+{
+    uint32_t dirty[256];     // Words written since the newest checkpoint
+    E803word *shadow;        // The store as it was at the newest checkpoint
+    GQueue *records;         // Checkpoints, oldest first
+    gsize size;              // Bytes used by the checkpoints
+    gsize limit;             // Most bytes they may use
+    int interval;            // Word times between checkpoints
+    int64_t barrier;         // Word time of the last change from outside
+    bool replaying;          // Emulating forward again after going back
+
+    /* What the operator and the power supplies could have changed,
+       as it was at the end of the last call to Emulate() */
+    bool seenValid;
+    E803word seenWG;
+    unsigned int seenButtons;
+    unsigned int seenSignals;
+} E803Rewind;
+
+// Called with each fetch that is found going backwards.
+typedef bool (*RewindMatch)(E803Machine *cpu,int32_t scr,void *data);
+
+E803Rewind *RewindNew(gsize limit,int interval);
+void RewindFree(E803Rewind *rewind);
+void RewindReset(E803Rewind *rewind);
+int RewindCheckpoint(E803Rewind *rewind,E803Machine *cpu,int wordTimesLeft);
+void RewindSeen(E803Rewind *rewind,E803Machine *cpu);
+int64_t RewindOldest(E803Rewind *rewind);
+gboolean RewindTo(E803Rewind *rewind,E803Machine *cpu,int64_t wordTime);
+gboolean RewindToFetch(E803Rewind *rewind,E803Machine *cpu,int64_t before,RewindMatch match,void *data);
+
+// What the debugger and the batch runner use
+int64_t RewindNow(E803Machine *cpu);
+gboolean RewindWordTimes(E803Rewind *rewind,E803Machine *cpu,int wordTimes);
+gboolean RewindInstructions(E803Rewind *rewind,E803Machine *cpu,int instructions);
+gboolean RewindToBreakpoint(E803Rewind *rewind,E803Machine *cpu);
+
+// Called by writeStore() for each word that changes.
+static inline void rewindDirty(E803Rewind *rewind,int address)
+{
+    rewind->dirty[(address >> 5) & 255] |= 1U << (address & 31);
+}
+
+// Anything from outside that changes the machine.
+static inline void rewindBarrier(E803Rewind *rewind,E803Machine *cpu)
+{
+    rewind->barrier = cpu->CPU_word_time_count;
+}
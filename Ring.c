@@ -0,0 +1,40 @@
+/*  This file is part of the Elliott 803 emulator.
+
+    Copyright © 2020  Peter Onion
+
+    See LICENCE file. 
+*/
+
+#define G_LOG_USE_STRUCTURED
+#include <stdio.h>
+#include <stdlib.h>
+#include <glib.h>
+
+#include "Ring.h"
+
+// count is rounded up to a power of two.
+E803Ring *RingNew(guint count,gsize slotSize)
+{
+    E803Ring *ring;
+    guint size = 1;
+
+    while(size < count) size <<= 1;
+
+    ring = (E803Ring *) calloc(1,sizeof(E803Ring));
+    ring->slots = (guint8 *) calloc(size,slotSize);
+    ring->slotSize = slotSize;
+    ring->mask = size - 1;
+    return ring;
+}
+
+void RingFree(E803Ring *ring)
+{
+    free(ring->slots);
+    free(ring);
+}
+
+// Log how full it got, for tuning the sizes.
+void RingReport(E803Ring *ring,const char *name)
+{
+    g_info("%s ring: %u slots, deepest %u, dropped %u\n",name,ring->mask + 1,ring->deepest,ring->dropped);
+}
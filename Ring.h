@@ -0,0 +1,59 @@
+/*  This file is part of the Elliott 803 emulator.
+
+    Copyright © 2020  Peter Onion
+
+    See LICENCE file. 
+*/
+
+#pragma once
+/* A fixed size ring of fixed size slots for passing things from one
+   thread to one other without locks or allocation.  Only the producer
+   moves head and only the consumer moves tail, so each only has to
+   read the other's index atomically.  Items are copied in and out, so
+   they must be plain data. */
+
+#include <string.h>
+#include <glib.h>
+
+typedef struct _e803Ring
+{
+    guint8 *slots;
+    gsize slotSize;
+    guint mask;              // Number of slots - 1
+    volatile gint head;      // Items pushed, wraps
+    volatile gint tail;      // Items popped, wraps
+    guint deepest;           // Most items it has held
+    guint dropped;           // Pushes refused because it was full
+} E803Ring;
+
+E803Ring *RingNew(guint count,gsize slotSize);
+void RingFree(E803Ring *ring);
+void RingReport(E803Ring *ring,const char *name);
+
+// Producer only.  FALSE if the ring is full.
+static inline gboolean RingPush(E803Ring *ring,const void *item)
+{
+    guint head = (guint) ring->head;
+    guint depth = head - (guint) g_atomic_int_get(&ring->tail);
+
+    if(depth > ring->mask)
+    {
+	ring->dropped += 1;
+	return FALSE;
+    }
+    if(depth >= ring->deepest) ring->deepest = depth + 1;
+    memcpy(&ring->slots[(head & ring->mask) * ring->slotSize],item,ring->slotSize);
+    g_atomic_int_set(&ring->head,(gint) (head + 1));
+    return TRUE;
+}
+
+// Consumer only.  FALSE if the ring is empty.
+static inline gboolean RingPop(E803Ring *ring,void *item)
+{
+    guint tail = (guint) ring->tail;
+
+    if(tail == (guint) g_atomic_int_get(&ring->head)) return FALSE;
+    memcpy(item,&ring->slots[(tail & ring->mask) * ring->slotSize],ring->slotSize);
+    g_atomic_int_set(&ring->tail,(gint) (tail + 1));
+    return TRUE;
+}
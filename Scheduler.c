@@ -0,0 +1,211 @@
+/*  This file is part of the Elliott 803 emulator.
+
+    Copyright © 2020  Peter Onion
+
+    See LICENCE file. 
+*/
+
+/* The timing wheel.  All the events in the wheel are at word times
+   from base to base + SCHEDULER_SLOTS - 1, so each slot only ever
+   holds events for one word time. */
+
+#define G_LOG_USE_STRUCTURED
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "Scheduler.h"
+
+#define SLOT_MASK (SCHEDULER_SLOTS - 1)
+#define WHEEL_WORDS (SCHEDULER_SLOTS / 64)
+
+static gint compareEvents(gconstpointer a,gconstpointer b)
+{
+    const E803SchedulerEvent *ea = (const E803SchedulerEvent *) a;
+    const E803SchedulerEvent *eb = (const E803SchedulerEvent *) b;
+
+    return (ea->at < eb->at) ? -1 : (ea->at > eb->at) ? 1 : 0;
+}
+
+// Events for the same word time are called in the order they were posted.
+static void insert(E803Scheduler *scheduler,E803SchedulerEvent *event)
+{
+    E803SchedulerEvent **tail;
+    int slot;
+
+    event->next = NULL;
+    if(event->at < (scheduler->base + SCHEDULER_SLOTS))
+    {
+	slot = (int) (event->at & SLOT_MASK);
+	for(tail = &scheduler->slots[slot]; *tail != NULL; tail = &(*tail)->next);
+	*tail = event;
+	scheduler->occupied[slot >> 6] |= 1ULL << (slot & 63);
+    }
+    else
+    {
+	scheduler->later = g_slist_insert_sorted(scheduler->later,event,compareEvents);
+    }
+
+    if(event->at < scheduler->next) scheduler->next = event->at;
+}
+
+// The first occupied slot going round from base.
+static int64_t soonest(E803Scheduler *scheduler)
+{
+    int start = (int) (scheduler->base & SLOT_MASK);
+    int word,slot;
+    uint64_t bits;
+
+    for(int n = 0; n <= WHEEL_WORDS; n++)
+    {
+	word = ((start >> 6) + n) % WHEEL_WORDS;
+	bits = scheduler->occupied[word];
+	if(n == 0)
+	    bits &= ~0ULL << (start & 63);
+	else if(n == WHEEL_WORDS)
+	    bits &= ~(~0ULL << (start & 63));
+
+	if(bits != 0)
+	{
+	    slot = (word << 6) + __builtin_ctzll(bits);
+	    return scheduler->base + ((slot - start) & SLOT_MASK);
+	}
+    }
+
+    if(scheduler->later != NULL)
+	return ((E803SchedulerEvent *) scheduler->later->data)->at;
+    return INT64_MAX;
+}
+
+// Move the wheel on to base, bringing in events from the list that now fit.
+static void advance(E803Scheduler *scheduler,int64_t base)
+{
+    E803SchedulerEvent *event;
+
+    scheduler->base = base;
+    while((scheduler->later != NULL) &&
+	  ((event = (E803SchedulerEvent *) scheduler->later->data)->at < (base + SCHEDULER_SLOTS)))
+    {
+	scheduler->later = g_slist_delete_link(scheduler->later,scheduler->later);
+	insert(scheduler,event);
+    }
+    scheduler->next = soonest(scheduler);
+}
+
+// Take every event out, wheel first then the list.
+static GSList *takeAll(E803Scheduler *scheduler)
+{
+    GSList *events = NULL;
+    E803SchedulerEvent *event;
+
+    for(int slot = SCHEDULER_SLOTS - 1; slot >= 0; slot--)
+    {
+	while((event = scheduler->slots[slot]) != NULL)
+	{
+	    scheduler->slots[slot] = event->next;
+	    events = g_slist_prepend(events,event);
+	}
+    }
+    memset(scheduler->occupied,0,sizeof(scheduler->occupied));
+
+    events = g_slist_concat(events,scheduler->later);
+    scheduler->later = NULL;
+    scheduler->next = INT64_MAX;
+    return events;
+}
+
+E803Scheduler *SchedulerNew(int64_t now)
+{
+    E803Scheduler *scheduler;
+
+    scheduler = (E803Scheduler *) calloc(1,sizeof(E803Scheduler));
+    scheduler->base = now;
+    scheduler->next = INT64_MAX;
+    return scheduler;
+}
+
+void SchedulerFree(E803Scheduler *scheduler)
+{
+    E803SchedulerEvent *event;
+
+    g_slist_free_full(takeAll(scheduler),free);
+    while((event = scheduler->spare) != NULL)
+    {
+	scheduler->spare = event->next;
+	free(event);
+    }
+    free(scheduler);
+}
+
+/* Call callback with data once the word time count reaches at.  One
+   posted for a word time already passed is called as soon as it can
+   be. */
+void SchedulerPost(E803Scheduler *scheduler,int64_t at,SchedulerCallback callback,void *data)
+{
+    E803SchedulerEvent *event;
+
+    // Timers repost themselves, so reuse events rather than allocate
+    if((event = scheduler->spare) != NULL)
+	scheduler->spare = event->next;
+    else
+	event = (E803SchedulerEvent *) calloc(1,sizeof(E803SchedulerEvent));
+
+    event->at = (at < scheduler->base) ? scheduler->base : at;
+    event->callback = callback;
+    event->data = data;
+    insert(scheduler,event);
+}
+
+/* Move every event by wordTimes, for when the word time count is set
+   back or forward by restoring a snapshot or going backwards, so that
+   they stay as far from now as they were. */
+void SchedulerShift(E803Scheduler *scheduler,int64_t wordTimes)
+{
+    GSList *events,*l;
+    E803SchedulerEvent *event;
+
+    if(wordTimes == 0) return;
+
+    events = takeAll(scheduler);
+    scheduler->base += wordTimes;
+    for(l = events; l != NULL; l = l->next)
+    {
+	event = (E803SchedulerEvent *) l->data;
+	event->at += wordTimes;
+	insert(scheduler,event);
+    }
+    g_slist_free(events);
+}
+
+// Call everything that is due, soonest first.
+void SchedulerRun(E803Scheduler *scheduler,E803Machine *cpu)
+{
+    int64_t now = cpu->CPU_word_time_count;
+    E803SchedulerEvent *events,*event;
+    int64_t at;
+    int slot;
+
+    while(scheduler->next <= now)
+    {
+	at = scheduler->next;
+	advance(scheduler,at);
+
+	slot = (int) (at & SLOT_MASK);
+	events = scheduler->slots[slot];
+	scheduler->slots[slot] = NULL;
+	scheduler->occupied[slot >> 6] &= ~(1ULL << (slot & 63));
+
+	// Anything posted now for the same word time waits for the next pass
+	advance(scheduler,at + 1);
+	while((event = events) != NULL)
+	{
+	    events = event->next;
+	    event->callback(cpu,event->data);
+	    event->next = scheduler->spare;
+	    scheduler->spare = event;
+	}
+    }
+
+    if(scheduler->base <= now) advance(scheduler,now + 1);
+}
@@ -0,0 +1,60 @@
+/*  This file is part of the Elliott 803 emulator.
+
+    Copyright © 2020  Peter Onion
+
+    See LICENCE file. 
+*/
+
+#pragma once
+/* Things that must happen at a given word time.  Peripherals, the
+   power supplies and timers post a callback for a word time and
+   Emulate() stops at the soonest one and calls it, so between events
+   it has only one deadline to look at.
+
+   Events in the next SCHEDULER_SLOTS word times are kept in a timing
+   wheel with one slot per word time and a bit per slot to find the
+   next occupied one quickly.  Those further off wait in a list until
+   the wheel comes round to them. */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <glib.h>
+#include "E803-types.h"
+#include "Emulate.h"
+
+#define SCHEDULER_SLOTS 1024
+
+typedef void (*SchedulerCallback)(E803Machine *cpu,void *data);
+
+typedef struct _e803SchedulerEvent
+{
+    int64_t at;
+    SchedulerCallback callback;
+    void *data;
+    struct _e803SchedulerEvent *next;
+} E803SchedulerEvent;
+
+typedef struct _e803Scheduler
+{
+    E803SchedulerEvent *slots[SCHEDULER_SLOTS];   // Events at base onwards
+    uint64_t occupied[SCHEDULER_SLOTS / 64];
+    GSList *later;           // Events past the wheel, soonest first
+    int64_t base;            // Word time the wheel starts at
+    int64_t next;            // Soonest event, INT64_MAX when there are none
+    E803SchedulerEvent *spare;   // Called events kept to be posted again
+} E803Scheduler;
+
+E803Scheduler *SchedulerNew(int64_t now);
+void SchedulerFree(E803Scheduler *scheduler);
+void SchedulerPost(E803Scheduler *scheduler,int64_t at,SchedulerCallback callback,void *data);
+void SchedulerShift(E803Scheduler *scheduler,int64_t wordTimes);
+void SchedulerRun(E803Scheduler *scheduler,E803Machine *cpu);
+
+// Word times until the soonest event, at most wordTimesLeft.
+static inline int SchedulerUntil(E803Scheduler *scheduler,E803Machine *cpu,int wordTimesLeft)
+{
+    int64_t until = scheduler->next - cpu->CPU_word_time_count;
+
+    if(until < 1) return 1;
+    return (until < wordTimesLeft) ? (int) until : wordTimesLeft;
+}
@@ -0,0 +1,201 @@
+/*  This file is part of the Elliott 803 emulator.
+
+    Copyright © 2020  Peter Onion
+
+    See LICENCE file. 
+*/
+
+/* Snapshots.  The sections are kept in a list in the order they were
+   registered, which is also the order they are saved and restored in. */
+
+#define G_LOG_USE_STRUCTURED
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "Snapshot.h"
+
+typedef struct _snapshotSection
+{
+    char tag[4];
+    SnapshotSaver save;
+    SnapshotRestorer restore;
+} SnapshotSection;
+
+static GSList *Sections = NULL;
+
+void SnapshotRegister(const char *tag,SnapshotSaver save,SnapshotRestorer restore)
+{
+    SnapshotSection *section;
+
+    if(strlen(tag) != 4)
+    {
+	g_error("%s tag \"%s\" is not four characters\n",__FUNCTION__,tag);
+    }
+
+    section = g_new(SnapshotSection,1);
+    memcpy(section->tag,tag,4);
+    section->save = save;
+    section->restore = restore;
+    Sections = g_slist_append(Sections,section);
+}
+
+// Save every registered section.  Free the result with g_byte_array_unref.
+GByteArray *SnapshotTake(void)
+{
+    GByteArray *snapshot;
+    SnapshotHeader header;
+    SnapshotSectionHeader sectionHeader;
+    SnapshotSection *section;
+    guint start;
+
+    // Big enough for the core store and everything else
+    snapshot = g_byte_array_sized_new(72 * 1024);
+
+    memset(&header,0,sizeof(header));
+    g_byte_array_append(snapshot,(const guint8 *) &header,sizeof(header));
+
+    for(GSList *list = Sections; list != NULL; list = g_slist_next(list))
+    {
+	section = (SnapshotSection *) list->data;
+
+	memcpy(sectionHeader.tag,section->tag,4);
+	sectionHeader.length = 0;
+	start = snapshot->len;
+	g_byte_array_append(snapshot,(const guint8 *) &sectionHeader,sizeof(sectionHeader));
+
+	(section->save)(snapshot);
+
+	// Fill in the length now it is known
+	sectionHeader.length = (guint32) (snapshot->len - start - sizeof(sectionHeader));
+	memcpy(snapshot->data + start,&sectionHeader,sizeof(sectionHeader));
+	header.sectionCount += 1;
+    }
+
+    memcpy(header.magic,SNAPSHOT_MAGIC,sizeof(header.magic));
+    header.length = snapshot->len;
+    memcpy(snapshot->data,&header,sizeof(header));
+
+    return snapshot;
+}
+
+static SnapshotSection *findSection(const char *tag)
+{
+    SnapshotSection *section;
+
+    for(GSList *list = Sections; list != NULL; list = g_slist_next(list))
+    {
+	section = (SnapshotSection *) list->data;
+	if(memcmp(section->tag,tag,4) == 0) return section;
+    }
+    return NULL;
+}
+
+/* Restore the sections in a snapshot.  The whole snapshot is checked
+   before anything is changed, but a section that refuses its data
+   leaves the ones before it restored. */
+gboolean SnapshotRestore(const guint8 *data,gsize length,GError **error)
+{
+    SnapshotHeader header;
+    SnapshotSectionHeader sectionHeader;
+    SnapshotSection *section;
+    gsize offset;
+
+    if(length < sizeof(header))
+    {
+	g_set_error(error,G_FILE_ERROR,G_FILE_ERROR_INVAL,"too short to be a snapshot");
+	return FALSE;
+    }
+    memcpy(&header,data,sizeof(header));
+    if((memcmp(header.magic,SNAPSHOT_MAGIC,sizeof(header.magic)) != 0) || (header.length != length))
+    {
+	g_set_error(error,G_FILE_ERROR,G_FILE_ERROR_INVAL,"not a snapshot from this version of the emulator");
+	return FALSE;
+    }
+
+    // Check the sections fit before using any of them
+    offset = sizeof(header);
+    for(guint32 n = 0; n < header.sectionCount; n++)
+    {
+	if((length - offset) < sizeof(sectionHeader))
+	{
+	    g_set_error(error,G_FILE_ERROR,G_FILE_ERROR_INVAL,"snapshot is truncated");
+	    return FALSE;
+	}
+	memcpy(&sectionHeader,data + offset,sizeof(sectionHeader));
+	offset += sizeof(sectionHeader);
+	if((length - offset) < sectionHeader.length)
+	{
+	    g_set_error(error,G_FILE_ERROR,G_FILE_ERROR_INVAL,"snapshot is truncated");
+	    return FALSE;
+	}
+	offset += sectionHeader.length;
+    }
+
+    offset = sizeof(header);
+    for(guint32 n = 0; n < header.sectionCount; n++)
+    {
+	memcpy(&sectionHeader,data + offset,sizeof(sectionHeader));
+	offset += sizeof(sectionHeader);
+
+	if((section = findSection(sectionHeader.tag)) != NULL)
+	{
+	    if(!(section->restore)(data + offset,sectionHeader.length))
+	    {
+		g_set_error(error,G_FILE_ERROR,G_FILE_ERROR_INVAL,"snapshot section %.4s is not valid",
+			    sectionHeader.tag);
+		return FALSE;
+	    }
+	}
+	offset += sectionHeader.length;
+    }
+    return TRUE;
+}
+
+// Append the fields of from to data.
+void SnapshotSaveFields(GByteArray *data,const void *from,const SnapshotField *fields,gsize count)
+{
+    for(gsize n = 0; n < count; n++)
+	g_byte_array_append(data,(const guint8 *) from + fields[n].offset,(guint) fields[n].size);
+}
+
+// The number of bytes SnapshotSaveFields() appends.
+gsize SnapshotFieldsLength(const SnapshotField *fields,gsize count)
+{
+    gsize length = 0;
+
+    for(gsize n = 0; n < count; n++)
+	length += fields[n].size;
+    return length;
+}
+
+/* Put the fields saved by SnapshotSaveFields() back into to.  data must
+   hold SnapshotFieldsLength() bytes.  Returns what follows them. */
+const guint8 *SnapshotRestoreFields(void *to,const guint8 *data,const SnapshotField *fields,gsize count)
+{
+    for(gsize n = 0; n < count; n++)
+    {
+	memcpy((guint8 *) to + fields[n].offset,data,fields[n].size);
+	data += fields[n].size;
+    }
+    return data;
+}
+
+gboolean SnapshotWrite(GByteArray *snapshot,const gchar *fileName,GError **error)
+{
+    return g_file_set_contents(fileName,(const gchar *) snapshot->data,(gssize) snapshot->len,error);
+}
+
+// Read a snapshot file to pass to SnapshotRestore.
+GBytes *SnapshotRead(const gchar *fileName,GError **error)
+{
+    gchar *contents;
+    gsize length;
+
+    if(!g_file_get_contents(fileName,&contents,&length,error))
+    {
+	return NULL;
+    }
+    return g_bytes_new_take(contents,length);
+}
@@ -0,0 +1,60 @@
+/*  This file is part of the Elliott 803 emulator.
+
+    Copyright © 2020  Peter Onion
+
+    See LICENCE file. 
+*/
+
+#pragma once
+/* Snapshots of the whole emulator.  Each part that has state registers
+   a section with a four character tag and functions to save and restore
+   it, in the same way that parts connect to the wiring.  A snapshot is
+   a header followed by the sections, each a tag, a length and the data
+   in the byte order of the machine that took it.  Sections that nothing
+   has registered for are skipped when a snapshot is restored, so the
+   headless tools can restore snapshots taken by the GUI. */
+
+#include <stddef.h>
+#include <glib.h>
+
+#define SNAPSHOT_MAGIC "E803SNP1"
+
+typedef struct _snapshotHeader
+{
+    char magic[8];
+    guint32 length;          // Of the whole snapshot, header included
+    guint32 sectionCount;
+} SnapshotHeader;
+
+typedef struct _snapshotSectionHeader
+{
+    char tag[4];
+    guint32 length;          // Of the data that follows
+} SnapshotSectionHeader;
+
+// Append the state to data.
+typedef void (*SnapshotSaver)(GByteArray *data);
+// Put the state back, FALSE if the data doesn't make sense.
+typedef gboolean (*SnapshotRestorer)(const guint8 *data,gsize length);
+
+void SnapshotRegister(const char *tag,SnapshotSaver save,SnapshotRestorer restore);
+
+/* The fields of a struct that go in a section, saved one after another
+   so that neither the padding between them nor the compiler's layout
+   ends up in the snapshot. */
+typedef struct _snapshotField
+{
+    gsize offset,size;
+} SnapshotField;
+
+#define SNAPSHOT_FIELD(type,name) {offsetof(type,name),sizeof(((type *) NULL)->name)}
+
+void SnapshotSaveFields(GByteArray *data,const void *from,const SnapshotField *fields,gsize count);
+gsize SnapshotFieldsLength(const SnapshotField *fields,gsize count);
+const guint8 *SnapshotRestoreFields(void *to,const guint8 *data,const SnapshotField *fields,gsize count);
+
+GByteArray *SnapshotTake(void);
+gboolean SnapshotRestore(const guint8 *data,gsize length,GError **error);
+
+gboolean SnapshotWrite(GByteArray *snapshot,const gchar *fileName,GError **error);
+GBytes *SnapshotRead(const gchar *fileName,GError **error);
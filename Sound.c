@@ -14,13 +14,17 @@
 #include "Sound.h"
 #include "Wiring.h"
 #include "Cpu.h"
+#include "Emulate.h"
 #include "wg-definitions.h"
-
-
-#define SOUNDDEBUG 0
-
-extern GMutex SoundEffectsQueueMutex;
-extern GSList  *runingSndEffects;
+#include "Scheduler.h"
+#include "CpuSound.h"
+#include "Ring.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
 
 /* Various ALSA configuration values */
 static snd_pcm_format_t soundSampleFormat = SND_PCM_FORMAT_S16_LE;
@@ -33,6 +37,12 @@ static unsigned int PeriodBufferSizeInBytes;
 static int iFramesPerWordTime;
 static int iWordTimesPerPeriod;
 
+/* Turbo mode. 1 = real time (driven by the ALSA period clock),
+   N = N times real time, 0 = as fast as the host allows.
+   In turbo mode the CPU sound is muted. */
+static int turboFactor = 1;
+static E803CpuSound *CpuSound = NULL;      /* What the CPU sounds like, or NULL in turbo mode */
+
 int callCount = 0;
 
 // Alsa configurator !
@@ -44,6 +54,11 @@ void setDevice(char *deviceName)
     soundDevice = strdup(deviceName);
 }
 
+void setTurbo(int factor)
+{
+    turboFactor = (factor < 0) ? 0 : factor;
+}
+
 
 static int set_hwparamsV3(snd_pcm_t *handle,
 			  snd_pcm_hw_params_t *params,
@@ -276,202 +291,164 @@ static gboolean soundInitV3(snd_pcm_format_t SampleFormat,
     return TRUE;
 }
 
-static int CPU_SampleCount;
-static int16_t *CPU_Samples = NULL;
-
-void addSamplesFromCPU(int16_t first,int16_t remainder)
-{
-    int16_t *samplePtr;
-#if SOUNDDEBUG
-    g_debug("%s called 0x%x 0x%x %d ",__FUNCTION__,first,remainder,CPU_SampleCount);
-#endif
-    if(CPU_Samples == NULL)
-    {
-	CPU_Samples = (int16_t *) malloc((size_t) PeriodBufferSizeInBytes);
-	CPU_SampleCount = 0;
-    }
-    
-    samplePtr = &CPU_Samples[CPU_SampleCount];
+/* Button sound effects.  The GUI thread hands over the effects to
+   start through a ring and the emulation thread plays them in a fixed
+   pool of voices, so neither waits for the other and nothing is
+   allocated while they play.  Effects that arrive when every voice is
+   busy are dropped. */
+#define VOICES 32
+#define EFFECTS_RING 64
 
-    *samplePtr++ = first;   // L
-    *samplePtr++ = first;   // R
+static E803Ring *SoundEffectsRing = NULL;
+static struct sndEffect Voices[VOICES];    // frameCount is 0 when a voice is free
 
-    for(int n = 1; n < iFramesPerWordTime; n++)
-    {
-	    *samplePtr++ = remainder;   // L
-	    *samplePtr++ = remainder;   // R
-    }
+// Called before the GUI and emulation threads start.
+void SoundInit(void)
+{
+    SoundEffectsRing = RingNew(EFFECTS_RING,sizeof(struct sndEffect));
+}
 
-    CPU_SampleCount += (iFramesPerWordTime *2);
+// Called from the GUI thread
+void playSndEffect(const struct sndEffect *effect)
+{
+    RingPush(SoundEffectsRing,effect);
+}
 
-#if SOUNDDEBUG
-    g_debug("%d\n",CPU_SampleCount);
-#endif
+static inline int16_t saturate(int32_t sample)
+{
+    return (int16_t) ((sample > INT16_MAX) ? INT16_MAX : (sample < INT16_MIN) ? INT16_MIN : sample);
 }
 
-static void addInCPU_Sound(void)
+/* Add frames of a mono effect to both channels of buffer, clipping
+   instead of wrapping round when it gets too loud. */
+static void mixVoice(int16_t *buffer,const int16_t *src,int frames)
 {
-    int spareSamples;
-    if(CPU_Samples != NULL)
+    int n = 0;
+
+#if defined(__SSE2__)
+    __m128i mono,*dst;
+
+    for(; n + 8 <= frames; n += 8)
     {
-	for(int n = 0; n<(480*2); n++)
-	{
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wconversion"
-	    periodBuffer[n] += CPU_Samples[n];
-#pragma GCC diagnostic pop
-	}
+	mono = _mm_loadu_si128((const __m128i *) &src[n]);
+	dst = (__m128i *) &buffer[n * 2];
+	_mm_storeu_si128(dst,_mm_adds_epi16(_mm_loadu_si128(dst),_mm_unpacklo_epi16(mono,mono)));
+	_mm_storeu_si128(dst + 1,_mm_adds_epi16(_mm_loadu_si128(dst + 1),_mm_unpackhi_epi16(mono,mono)));
     }
-    spareSamples = (CPU_SampleCount - (480 * 2));
+#elif defined(__ARM_NEON)
+    int16x8x2_t stereo;
 
-    for(int n = 0; n < spareSamples; n++)
+    for(; n + 8 <= frames; n += 8)
     {
-	CPU_Samples[n] = CPU_Samples[(480*2) + n];
+	stereo = vzipq_s16(vld1q_s16(&src[n]),vld1q_s16(&src[n]));
+	vst1q_s16(&buffer[n * 2],vqaddq_s16(vld1q_s16(&buffer[n * 2]),stereo.val[0]));
+	vst1q_s16(&buffer[(n * 2) + 8],vqaddq_s16(vld1q_s16(&buffer[(n * 2) + 8]),stereo.val[1]));
+    }
+#endif
+    for(; n < frames; n++)
+    {
+	buffer[n * 2] = saturate(buffer[n * 2] + src[n]);
+	buffer[(n * 2) + 1] = saturate(buffer[(n * 2) + 1] + src[n]);
     }
-
-#if SOUNDDEBUG
-    g_debug("%s CPU_SampleCount = %d spareSamples = %d\n",__FUNCTION__,CPU_SampleCount,spareSamples);
-#endif    
-    CPU_SampleCount = spareSamples;
 }
 
-//(*soundFunc)(periodBuffer,480,0.01,iWordTimesPerPeriod - wordTimesAdjustment);
-static void keyboardSoundFunc(void *buffer, int sampleCount, 
-			      __attribute__((unused)) double time, 
-			      __attribute__((unused)) int wordtimes)
+static void keyboardSoundFunc(int16_t *buffer,int frameCount)
 {
-    GSList *effects,*next;
-    struct sndEffect *effect;
-    gint16 *dst,*src,sample;
-    int n;
+    struct sndEffect effect,*voice;
+    int frames;
 
-    effects = runingSndEffects; 
-
-    while(effects != NULL )
+    // Start any new effects in free voices
+    while(RingPop(SoundEffectsRing,&effect))
     {
-	effect = (struct sndEffect *) effects->data;
-
-	if(effect->frameCount >= sampleCount)
-	{
-	    //g_debug("len=%d\n",effect->frameCount);
-	    dst = buffer;
-	    src = effect->frames;
-	    n = sampleCount;
-	    while(n--)
-	    {
-		sample = *src++;
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wconversion"
-		*dst++ +=  sample;
-		*dst++ +=  sample;
-#pragma GCC diagnostic pop
-	    }
-			    
-	    // Update pointer adn counter
-	    effect->frameCount -= sampleCount;
-	    effect->frames =  src;
-	    effects = g_slist_next(effects);
-	}
-	else
+	for(voice = Voices; voice < &Voices[VOICES]; voice++)
 	{
-	    dst = buffer;
-	    src = effect->frames;
-	    n = effect->frameCount;
-	    while(n--)
+	    if(voice->frameCount == 0)
 	    {
-		sample = *src++;
-#pragma GCC diagnostic push
-#pragma GCC diagnostic ignored "-Wconversion"
-		*dst++ +=  sample;
-		*dst++ +=  sample;
-#pragma GCC diagnostic pop
+		*voice = effect;
+		break;
 	    }
-	    // Effect finished so remove from list
-	    next = g_slist_next(effects);
-	    runingSndEffects = g_slist_remove_link(runingSndEffects,effects);
-	    g_slist_free_1(effects);
-	    free(effect);
-	    effects = next;
 	}
     }
+
+    for(voice = Voices; voice < &Voices[VOICES]; voice++)
+    {
+	if(voice->frameCount == 0) continue;
+
+	frames = (voice->frameCount < frameCount) ? voice->frameCount : frameCount;
+	mixVoice(buffer,voice->frames,frames);
+	voice->frames += frames;
+	voice->frameCount -= frames;
+    }
 }
 
-static void DoSoundStuff(void)
+// Pull events off the button event queue and set variables/wires accordingly
+static void processButtonEvents(void)
 {
-    ButtonEvent *be;
+    ButtonEvent be;
     static unsigned int F1bits = 0,N1bits = 0,F2bits = 0,N2bits = 0;
     gboolean F1changed = FALSE;
     gboolean N1changed = FALSE;
     gboolean F2changed = FALSE;
     gboolean N2changed = FALSE;
 
-    static int wordTimesAdjustment = 0;
-    
-    bzero(periodBuffer,PeriodBufferSizeInBytes);
-    
-    g_mutex_lock(&SoundEffectsQueueMutex);
-    keyboardSoundFunc(periodBuffer, 480, 0.0,0);
-    g_mutex_unlock(&SoundEffectsQueueMutex);
-
-    // Pull events of the button event queue and set variables/wires accordingly
-    if(ButtonEventQueue != NULL)
+    if(ButtonEventRing != NULL)
     {	
-	while((be = (ButtonEvent *) g_async_queue_try_pop (ButtonEventQueue)) != NULL)
+	while(RingPop(ButtonEventRing,&be))
 	{
-	    g_debug("Poped %d %d %d\n",be->press,be->rowId,be->value);
-	    switch(be->rowId)
+	    g_debug("Poped %d %d %d\n",be.press,be.rowId,be.value);
+	    switch(be.rowId)
 	    {
 	    case F1:
-		if(be->press)
-		    F1bits |=  be->value;
+		if(be.press)
+		    F1bits |=  be.value;
 		else
-		    F1bits &= ~be->value;
+		    F1bits &= ~be.value;
 		F1changed = TRUE;
 		break;
 
 	    case N1:
-		if(be->press)
-		    N1bits |=  be->value;
+		if(be.press)
+		    N1bits |=  be.value;
 		else
-		    N1bits &= ~be->value;
+		    N1bits &= ~be.value;
 		N1changed = TRUE;
 		break;
 
 	    case F2:
-		if(be->press)
-		    F2bits |=  be->value;
+		if(be.press)
+		    F2bits |=  be.value;
 		else
-		    F2bits &= ~be->value;
+		    F2bits &= ~be.value;
 		F2changed = TRUE;		    
 		break;
 		    
 	    case N2:
-		if(be->press)
-		    N2bits |=  be->value;
+		if(be.press)
+		    N2bits |=  be.value;
 		else
-		    N2bits &= ~be->value;
+		    N2bits &= ~be.value;
 		N2changed = TRUE;	    
 		break;
 
 	    case OPERATE:
-		wiring(OPERATEWIRE,be->press ? 1 : 0);
+		wiring(OPERATEWIRE,be.press ? 1 : 0);
 		break;
 
 	    case RON: 
-		if(be->press)
-		    wiring(RONWIRES,be->value);
+		if(be.press)
+		    wiring(RONWIRES,be.value);
 		break;
 
 	    case CLEARSTORE:
-		wiring(CSWIRE,be->press ? 1 : 0);		    
+		wiring(CSWIRE,be.press ? 1 : 0);		    
 		break;
 
 	    case MANUALDATA:
-		wiring(MDWIRE,be->press ? 1 : 0);		    
+		wiring(MDWIRE,be.press ? 1 : 0);		    
 		break;
 
 	    case RESET:
-		wiring(RESETWIRE,be->press ? 1 : 0);
+		wiring(RESETWIRE,be.press ? 1 : 0);
 		break;
 		    
 	    case BATOFF:
@@ -491,17 +468,16 @@ static void DoSoundStuff(void)
 		break;
 
 	    case SELECTEDSTOP:
-		wiring(SSWIRE,be->press ? 1 : 0);
+		wiring(SSWIRE,be.press ? 1 : 0);
 		break;
 
 	    case VOLUME:
-		wiring(VOLUME_CONTROL,be->value);
+		wiring(VOLUME_CONTROL,be.value);
 		break;
 		    
 	    default:
 		break;
 	    }
-	    free(be);
 	}
     }
 
@@ -510,14 +486,45 @@ static void DoSoundStuff(void)
     if(N1changed) wiring(N1WIRES,N1bits);
     if(F2changed) wiring(F2WIRES,F2bits);
     if(N2changed) wiring(N2WIRES,N2bits);
+}
+
+/* The 100Hz timer for the power supplies runs in emulated time.  Ten
+   milliseconds is 625/18 word times, so each tick posts the next 34 or
+   35 word times on and carries the eighteenths left over in the
+   event's data.  Being relative to now it follows the word time count
+   when a snapshot or the debugger moves it.
+
+   This means the power supplies and charger run N times faster in
+   turbo mode and stand still while the debugger has the machine
+   halted, as the rest of the 803 does.  That is on purpose: they stay
+   in step with the programs they power, and a journal replays them
+   the same however fast it is played. */
+#define TIMER_EIGHTEENTHS 625
+
+static void timer100Hz(E803Machine *cpu,void *data)
+{
+    int eighteenths = GPOINTER_TO_INT(data) + TIMER_EIGHTEENTHS;
 
     wiring(TIMER100HZ,0);
 
+    SchedulerPost(cpu->Scheduler,cpu->CPU_word_time_count + (eighteenths / 18),
+		  timer100Hz,GINT_TO_POINTER(eighteenths % 18));
+}
+
+static void DoSoundStuff(void)
+{
+    static int wordTimesAdjustment = 0;
+    
+    bzero(periodBuffer,PeriodBufferSizeInBytes);
+    
+    keyboardSoundFunc(periodBuffer,480);
+
+    processButtonEvents();
+
     // This does ~14 word times of emulation.
     CPU_sound(periodBuffer,480,0.01,iWordTimesPerPeriod - wordTimesAdjustment);
     
-    addInCPU_Sound();
-    wordTimesAdjustment = (CPU_SampleCount/2)  / iFramesPerWordTime;
+    wordTimesAdjustment = CpuSoundMix(CpuSound,periodBuffer,480) / iFramesPerWordTime;
 }
 
 // Taken from Alsa demo code 
@@ -635,6 +642,112 @@ static int write_and_poll_loop(snd_pcm_t *handle)
 }
 
 
+/* Turbo mode emulation loop.  The emulation is no longer paced by
+   the sound card.  Each time slot runs a batch of word times and
+   then tops up the ALSA buffer with button sound effects without
+   ever waiting for it.  For a fixed multiplier the loop sleeps off
+   the rest of the slot, otherwise the batch size is adjusted to fill
+   the slot. */
+
+#define TURBO_SLOT 10000      // Length of a time slot in microseconds
+#define TURBO_REPORT 5000000  // How often to log the emulation speed
+#define TURBO_MAX_BATCH (1 << 24)
+
+// Keep the sound card fed with button sound effects without blocking.
+static int feedSoundEffects(snd_pcm_t *handle)
+{
+    snd_pcm_sframes_t avail,err;
+
+    while((avail = snd_pcm_avail_update(handle)) >= (snd_pcm_sframes_t) FramesPerPeriod)
+    {
+	bzero(periodBuffer,PeriodBufferSizeInBytes);
+	
+	keyboardSoundFunc(periodBuffer,480);
+
+	err = snd_pcm_writei(handle, periodBuffer, FramesPerPeriod);
+	if(err < 0)
+	{
+	    avail = err;
+	    break;
+	}
+    }
+
+    if(avail < 0)
+    {
+	if(xrun_recovery(handle, avail) < 0)
+	{
+	    g_warning("Write error: %s\n", snd_strerror((int) avail));
+	    return -1;
+	}
+    }
+    return 0;
+}
+
+static int turbo_loop(snd_pcm_t *handle)
+{
+    gint64 slotStart,elapsed,reportStart;
+    int batch;
+    double wordTimesRun;
+    gboolean idle;
+
+    g_info("Turbo mode, %d x real time (0 = unlimited)\n",turboFactor);
+
+    batch = iWordTimesPerPeriod;
+    if(turboFactor > 0) batch *= turboFactor;
+
+    wordTimesRun = 0.0;
+    reportStart = g_get_monotonic_time();
+    
+    while(Running)
+    {
+	slotStart = g_get_monotonic_time();
+	
+	processButtonEvents();
+	CPU_sound(periodBuffer,480,0.01,batch);
+	idle = CPU_idle();
+	callCount += 1;
+	wordTimesRun += (double) CPU_wordTimesRun();
+
+	if(feedSoundEffects(handle) < 0)
+	{
+	    exit(EXIT_FAILURE);
+	}
+
+	elapsed = g_get_monotonic_time() - slotStart;
+
+	// Don't spin while the 803 is waiting for the operator or the PLTS.
+	if((turboFactor > 0) || idle)
+	{
+	    if(elapsed < TURBO_SLOT)
+		g_usleep((gulong) (TURBO_SLOT - elapsed));
+	}
+	else
+	{
+	    // Grow or shrink the batch to fit the slot.
+	    if(elapsed < ((TURBO_SLOT * 9) / 10))
+	    {
+		if(batch < TURBO_MAX_BATCH) batch += (batch / 4) + 1;
+	    }
+	    else if(elapsed > TURBO_SLOT)
+	    {
+		batch -= batch / 4;
+		if(batch < iWordTimesPerPeriod) batch = iWordTimesPerPeriod;
+	    }
+	}
+
+	elapsed = g_get_monotonic_time() - reportStart;
+	if(elapsed >= TURBO_REPORT)
+	{
+	    g_info("%.0f word times/s (%.1f x real time)\n",
+		   wordTimesRun * 1.0E6 / (double) elapsed,
+		   (wordTimesRun * 288.0) / (double) elapsed);
+	    wordTimesRun = 0.0;
+	    reportStart += elapsed;
+	}
+    }
+    return 0;
+}
+
 // This is the emulation thread !
 
 gpointer worker(__attribute__((unused)) gpointer data)
@@ -643,12 +756,25 @@ gpointer worker(__attribute__((unused)) gpointer data)
     
     soundInitV3(SND_PCM_FORMAT_S16_LE,48000,100,4);
 
+    // The CPU sound is mixed in with the sound effects, turbo mode is silent.
+    if(turboFactor == 1)
+    {
+	CpuSound = CpuSoundNew(iFramesPerWordTime);
+	WiredMachine->sound = CpuSound;
+    }
+
+    SchedulerPost(WiredMachine->Scheduler,WiredMachine->CPU_word_time_count,timer100Hz,GINT_TO_POINTER(0));
+
     // This is where all the emulation happens !
-    err =  write_and_poll_loop(AlsaHandle);
+    if(turboFactor == 1)
+	err =  write_and_poll_loop(AlsaHandle);
+    else
+	err = turbo_loop(AlsaHandle);
     if (err < 0)
         g_warning("Transfer failed: %s\n", snd_strerror(err));
     snd_pcm_close(AlsaHandle);
 
+    RingReport(SoundEffectsRing,"Sound effect");
     g_info("Worker finished!\n");
     return(NULL);
 }
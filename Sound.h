@@ -7,9 +7,12 @@
 
 gpointer worker(gpointer data);
 
-void addSamplesFromCPU(int16_t first,int16_t remainder);
+struct sndEffect;
 
+void SoundInit(void);
+void playSndEffect(const struct sndEffect *effect);
 
 void setDevice(char *deviceName);
+void setTurbo(int factor);
 
 
@@ -0,0 +1,166 @@
+/*  This file is part of the Elliott 803 emulator.
+
+    Copyright © 2020  Peter Onion
+
+    See LICENCE file. 
+*/
+
+#define G_LOG_USE_STRUCTURED
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "Tape.h"
+
+#define RING_MASK (TAPE_RING - 1)
+
+void TapeInit(E803Tape *tape)
+{
+    memset(tape,0,sizeof(E803Tape));
+}
+
+// Let go of a tape that was all there.
+static void drop(E803Tape *tape)
+{
+    if(tape->mapped != NULL) g_mapped_file_unref(tape->mapped);
+    if(tape->held != NULL) g_bytes_unref(tape->held);
+    tape->mapped = NULL;
+    tape->held = NULL;
+    tape->data = NULL;
+    tape->length = tape->position = 0;
+}
+
+void TapeTidy(E803Tape *tape)
+{
+    drop(tape);
+    g_free(tape->ring);
+    tape->ring = NULL;
+}
+
+/* A whole tape in place of whatever was in the reader, including any
+   stream that has started but not been taken over yet. */
+static void whole(E803Tape *tape)
+{
+    tape->streamsSeen = g_atomic_int_get(&tape->streams);
+    g_atomic_int_set(&tape->rewindsSeen,g_atomic_int_get(&tape->rewinds));
+    tape->streaming = false;
+}
+
+gboolean TapeMap(E803Tape *tape,const gchar *fileName,GError **error)
+{
+    GMappedFile *mapped;
+
+    mapped = g_mapped_file_new(fileName,FALSE,error);
+    if(mapped == NULL) return FALSE;
+
+    drop(tape);
+    whole(tape);
+    tape->mapped = mapped;
+    tape->data = (const guint8 *) g_mapped_file_get_contents(mapped);
+    tape->length = g_mapped_file_get_length(mapped);
+    return TRUE;
+}
+
+// A copy of length characters, for tapes restored from snapshots.
+void TapeHold(E803Tape *tape,const guint8 *data,gsize length)
+{
+    drop(tape);
+    whole(tape);
+    tape->held = g_bytes_new(data,length);
+    tape->data = (const guint8 *) g_bytes_get_data(tape->held,NULL);
+    tape->length = length;
+}
+
+/* Called by TapeRead() when a stream has started or been rewound.  For
+   a new stream the reader skips whatever is left of the stream before,
+   but never goes backwards.  A rewind goes back to the start of the
+   stream, unless a whole tape has replaced it. */
+void tapeFollow(E803Tape *tape)
+{
+    gint streams = g_atomic_int_get(&tape->streams);
+    gint rewinds = g_atomic_int_get(&tape->rewinds);
+    guint start = (guint) g_atomic_int_get(&tape->start);
+
+    if(streams != tape->streamsSeen)
+    {
+	tape->streamsSeen = streams;
+	if((gint) (start - (guint) tape->read) > 0)
+	    g_atomic_int_set(&tape->read,(gint) start);
+	drop(tape);
+	tape->streaming = true;
+    }
+    if(rewinds != tape->rewindsSeen)
+    {
+	if(tape->streaming) g_atomic_int_set(&tape->read,(gint) start);
+	g_atomic_int_set(&tape->rewindsSeen,rewinds);
+    }
+}
+
+gsize TapeUnread(E803Tape *tape)
+{
+    if(tapeChanged(tape)) tapeFollow(tape);
+
+    if(!tape->streaming) return tape->length - tape->position;
+    return (guint) g_atomic_int_get(&tape->written) - (guint) tape->read;
+}
+
+void TapeSaveUnread(E803Tape *tape,GByteArray *data)
+{
+    gsize unread = TapeUnread(tape);
+    guint from,first;
+
+    if(!tape->streaming)
+    {
+	if(unread != 0) g_byte_array_append(data,&tape->data[tape->position],(guint) unread);
+	return;
+    }
+
+    // It may wrap round the end of the ring
+    from = (guint) tape->read & RING_MASK;
+    first = MIN((guint) unread,TAPE_RING - from);
+    g_byte_array_append(data,&tape->ring[from],first);
+    g_byte_array_append(data,tape->ring,(guint) unread - first);
+}
+
+// Writer only.  Begin a new tape, which the reader moves on to.
+void TapeStart(E803Tape *tape)
+{
+    if(tape->ring == NULL) tape->ring = (guint8 *) g_malloc(TAPE_RING);
+    g_atomic_int_set(&tape->start,g_atomic_int_get(&tape->written));
+    g_atomic_int_inc(&tape->streams);
+}
+
+/* Writer only.  Where the next characters go and how many will fit
+   there, 0 when the ring is full.  While a rewind is waiting for the
+   reader the stream's start counts as not read yet. */
+gsize TapeSpace(E803Tape *tape,guint8 **to)
+{
+    guint written = (guint) tape->written;
+    guint from,space;
+
+    if(tape->ring == NULL) return 0;
+    if(g_atomic_int_get(&tape->rewinds) != g_atomic_int_get(&tape->rewindsSeen))
+	from = (guint) g_atomic_int_get(&tape->start);
+    else
+	from = (guint) g_atomic_int_get(&tape->read);
+    space = TAPE_RING - (written - from);
+    *to = &tape->ring[written & RING_MASK];
+    return MIN(space,TAPE_RING - (written & RING_MASK));
+}
+
+// Writer only.  length characters have been put where TapeSpace() said.
+void TapeWritten(E803Tape *tape,gsize length)
+{
+    g_atomic_int_set(&tape->written,(gint) ((guint) tape->written + (guint) length));
+}
+
+/* Writer only.  Have the reader read the stream again from its start.
+   FALSE if some of it has already been written over. */
+gboolean TapeRewind(E803Tape *tape)
+{
+    if(tape->ring == NULL) return FALSE;
+    if(((guint) tape->written - (guint) g_atomic_int_get(&tape->start)) > TAPE_RING) return FALSE;
+    g_atomic_int_inc(&tape->rewinds);
+    return TRUE;
+}
@@ -0,0 +1,92 @@
+/*  This file is part of the Elliott 803 emulator.
+
+    Copyright © 2020  Peter Onion
+
+    See LICENCE file. 
+*/
+
+#pragma once
+/* The tape in a reader.  A tape file is mapped into memory rather than
+   read, so a tape of any length is read in place with nothing copied.
+   A tape arriving from outside, such as from the PLTS, streams through
+   a ring of TAPE_RING bytes instead, and the reader can start on it
+   before the end has arrived.
+
+   Everything except TapeStart(), TapeSpace(), TapeWritten() and
+   TapeRewind() belongs to the thread that reads the tape.  Those four
+   belong to the thread writing the stream and may be used while the
+   tape is being read.  Only the writer moves written and only the
+   reader moves read, as in E803Ring, and a new stream takes over from
+   whatever was in the reader the next time the reader looks.  A rewind
+   is the same, the reader going back to start when it next looks.  It
+   only works while the whole stream is still in the ring, and until the
+   reader has gone back the writer keeps clear of the stream's start. */
+
+#include <stdbool.h>
+#include <glib.h>
+
+#define TAPE_RING 65536
+
+typedef struct _e803Tape
+{
+    /* A tape that is all there */
+    const guint8 *data;      // Its characters
+    gsize length;
+    gsize position;          // Characters read
+    GMappedFile *mapped;     // The file data is mapped from, or NULL
+    GBytes *held;            // Or the copy data points into, or NULL
+
+    /* A tape streaming through the ring */
+    guint8 *ring;            // NULL until there has been a stream
+    volatile gint written;   // Characters put in the ring, wraps
+    volatile gint read;      // Characters taken out, wraps
+    volatile gint start;     // Where the newest stream starts
+    volatile gint streams;   // Streams started
+    gint streamsSeen;        // Streams the reader has taken over
+    volatile gint rewinds;   // Rewinds asked for
+    volatile gint rewindsSeen; // Rewinds the reader has done
+    bool streaming;          // The reader is on the ring
+} E803Tape;
+
+void TapeInit(E803Tape *tape);
+void TapeTidy(E803Tape *tape);
+gboolean TapeMap(E803Tape *tape,const gchar *fileName,GError **error);
+void TapeHold(E803Tape *tape,const guint8 *data,gsize length);
+gsize TapeUnread(E803Tape *tape);
+void TapeSaveUnread(E803Tape *tape,GByteArray *data);
+void tapeFollow(E803Tape *tape);
+
+// The writer's side of a stream
+void TapeStart(E803Tape *tape);
+gsize TapeSpace(E803Tape *tape,guint8 **to);
+void TapeWritten(E803Tape *tape,gsize length);
+gboolean TapeRewind(E803Tape *tape);
+
+// A new stream or a rewind for the reader to catch up with
+static inline gboolean tapeChanged(E803Tape *tape)
+{
+    return (g_atomic_int_get(&tape->streams) != tape->streamsSeen) ||
+	(g_atomic_int_get(&tape->rewinds) != tape->rewindsSeen);
+}
+
+/* The next character, FALSE if there isn't one yet.  Called with each
+   F71, so it is kept short. */
+static inline gboolean TapeRead(E803Tape *tape,guint8 *character)
+{
+    guint read;
+
+    if(G_UNLIKELY(tapeChanged(tape))) tapeFollow(tape);
+
+    if(!tape->streaming)
+    {
+	if(tape->position >= tape->length) return FALSE;
+	*character = tape->data[tape->position++];
+	return TRUE;
+    }
+
+    read = (guint) tape->read;
+    if(read == (guint) g_atomic_int_get(&tape->written)) return FALSE;
+    *character = tape->ring[read & (TAPE_RING - 1)];
+    g_atomic_int_set(&tape->read,(gint) (read + 1));
+    return TRUE;
+}
@@ -0,0 +1,98 @@
+/*  This file is part of the Elliott 803 emulator.
+
+    Copyright © 2020  Peter Onion
+
+    See LICENCE file. 
+*/
+
+/* Instruction trace ring buffers.  Records are added by traceFetch()
+   in Trace.h, this makes the rings and writes them to files. */
+
+#define G_LOG_USE_STRUCTURED
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "Trace.h"
+
+// Make a ring for at least length instructions.
+E803Trace *TraceNew(guint length)
+{
+    E803Trace *trace;
+    guint size = 1024;
+
+    while((size < length) && (size < 0x40000000U))
+    {
+	size <<= 1;
+    }
+
+    trace = (E803Trace *) calloc(1,sizeof(E803Trace));
+    trace->records = (E803TraceRecord *) calloc(size,sizeof(E803TraceRecord));
+    if(trace->records == NULL)
+    {
+	g_error("Can't allocate a trace of %u instructions\n",size);
+    }
+    trace->mask = size - 1;
+    return trace;
+}
+
+void TraceReset(E803Trace *trace)
+{
+    g_atomic_int_set(&trace->head,0);
+    trace->full = FALSE;
+}
+
+void TraceFree(E803Trace *trace)
+{
+    free(trace->records);
+    free(trace);
+}
+
+/* Write the records in the ring, oldest first.  This can be called
+   while the machine is running, in which case any records that were
+   overwritten while they were being copied are left out. */
+gboolean TraceDump(E803Trace *trace,const gchar *fileName,GError **error)
+{
+    E803TraceHeader *header;
+    E803TraceRecord *records;
+    guint size = trace->mask + 1;
+    guint head,headAfter,count,first,lost;
+    gsize length;
+    gchar *buffer;
+    gboolean ok;
+
+    head = (guint) g_atomic_int_get(&trace->head);
+    count = trace->full ? size : head;
+    first = head - count;
+
+    length = sizeof(E803TraceHeader) + count * sizeof(E803TraceRecord);
+    buffer = g_malloc(length);
+    records = (E803TraceRecord *) (buffer + sizeof(E803TraceHeader));
+
+    for(guint n = 0; n < count; n++)
+    {
+	records[n] = trace->records[(first + n) & trace->mask];
+    }
+
+    // Anything at or before headAfter - size may have been overwritten
+    headAfter = (guint) g_atomic_int_get(&trace->head);
+    lost = 0;
+    if((headAfter - head + 1) > (size - count))
+    {
+	lost = (headAfter - head + 1) - (size - count);
+	if(lost > count) lost = count;
+    }
+    count -= lost;
+    memmove(records,records + lost,count * sizeof(E803TraceRecord));
+
+    header = (E803TraceHeader *) buffer;
+    memcpy(header->magic,TRACE_MAGIC,sizeof(header->magic));
+    header->recordSize = sizeof(E803TraceRecord);
+    header->recordCount = count;
+
+    length = sizeof(E803TraceHeader) + count * sizeof(E803TraceRecord);
+    ok = g_file_set_contents(fileName,buffer,(gssize) length,error);
+    g_free(buffer);
+    return ok;
+}
@@ -0,0 +1,85 @@
+/*  This file is part of the Elliott 803 emulator.
+
+    Copyright © 2020  Peter Onion
+
+    See LICENCE file. 
+*/
+
+#pragma once
+/* Instruction trace.  While a machine's Trace pointer is set every
+   instruction fetched is recorded in a ring buffer, so the last N
+   instructions before something goes wrong can be written out and
+   turned into text later with 803-trace.  The emulation thread is the
+   only writer, so the ring needs no locks. */
+
+#include <stdint.h>
+#include <glib.h>
+#include "E803-types.h"
+#include "Emulate.h"
+
+// Flags in E803TraceRecord
+#define TRACE_OFLOW 0x01
+#define TRACE_FPO   0x02
+#define TRACE_BMOD  0x04   // Instruction was B-modified
+
+// One instruction, as it was fetched.  ACC and AR are before it is obeyed.
+typedef struct _e803TraceRecord
+{
+    E803word ACC;
+    E803word AR;
+    uint64_t wordTime;     // CPU_word_time_count at the fetch
+    uint32_t sequence;     // Number of instructions traced before this one
+    uint32_t IR;           // Function and address after B-modification
+    uint16_t SCR;          // Address * 2 + half
+    uint8_t fn;
+    uint8_t flags;
+} E803TraceRecord;
+
+typedef struct _e803Trace
+{
+    E803TraceRecord *records;
+    guint mask;            // Number of records - 1
+    gint head;             // Next record to write, only changed by the emulation thread
+    gboolean full;         // The ring has wrapped at least once
+} E803Trace;
+
+/* Trace files start with this header followed by the records, oldest
+   first, in the byte order of the machine that wrote them. */
+#define TRACE_MAGIC "E803TRC2"
+
+typedef struct _e803TraceHeader
+{
+    char magic[8];
+    uint32_t recordSize;
+    uint32_t recordCount;
+} E803TraceHeader;
+
+E803Trace *TraceNew(guint length);
+void TraceReset(E803Trace *trace);
+void TraceFree(E803Trace *trace);
+gboolean TraceDump(E803Trace *trace,const gchar *fileName,GError **error);
+
+// Called at each fetch that isn't stopped.
+static inline void traceFetch(E803Trace *trace,E803Machine *cpu,int32_t scr,bool bMod)
+{
+    guint head = (guint) trace->head;
+    E803TraceRecord *record = &trace->records[head & trace->mask];
+
+    record->ACC = cpu->ACC;
+    record->AR = cpu->AR;
+    record->wordTime = (uint64_t) cpu->CPU_word_time_count;
+    record->sequence = head;
+    record->IR = (uint32_t) cpu->IR & 0x7FFFF;
+    record->SCR = (uint16_t) scr;
+    record->fn = (uint8_t) cpu->fn;
+    record->flags = (uint8_t) ((cpu->OFLOW ? TRACE_OFLOW : 0) |
+			       (cpu->FPO ? TRACE_FPO : 0) |
+			       (bMod ? TRACE_BMOD : 0));
+
+    if(((head + 1) & trace->mask) == 0)
+    {
+	trace->full = TRUE;
+    }
+    // The record must be complete before a reader can see it
+    g_atomic_int_set(&trace->head,(gint) (head + 1));
+}
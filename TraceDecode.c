@@ -0,0 +1,114 @@
+/*  This file is part of the Elliott 803 emulator.
+
+    Copyright © 2020  Peter Onion
+
+    See LICENCE file. 
+*/
+
+/* 803-trace turns the binary instruction traces written by the
+   emulators into text, one line per instruction.  */
+
+#define G_LOG_USE_STRUCTURED
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <glib.h>
+
+#include "E803-types.h"
+#include "Trace.h"
+
+static gint lastCount = 0;
+
+// Command line options
+static GOptionEntry entries[] =
+{
+    { "last", 'n', 0, G_OPTION_ARG_INT, &lastCount, "Only show the last N instructions.", "N" },
+    { NULL }
+};
+
+// 39 bit words as signed integers
+static int64_t wordValue(E803word word)
+{
+    word &= 0x7FFFFFFFFFULL;
+    return (word & 0x4000000000ULL) ? (int64_t) word - (int64_t) 0x8000000000ULL : (int64_t) word;
+}
+
+static void printRecord(const E803TraceRecord *record)
+{
+    printf("%10" PRIu32 " %12" PRIu64 "  %4u%c  %02o %4" PRIu32 "%c  ACC=%013" PRIo64 " %+14" PRId64
+	   "  AR=%013" PRIo64 "%s%s\n",
+	   record->sequence,record->wordTime,
+	   record->SCR >> 1,(record->SCR & 1) ? '+' : ' ',
+	   record->fn,record->IR & 8191,(record->flags & TRACE_BMOD) ? 'B' : ' ',
+	   (uint64_t) (record->ACC & 0x7FFFFFFFFFULL),wordValue(record->ACC),
+	   (uint64_t) (record->AR & 0x7FFFFFFFFFULL),
+	   (record->flags & TRACE_OFLOW) ? " OFLOW" : "",
+	   (record->flags & TRACE_FPO) ? " FPO" : "");
+}
+
+int main(int argc,char **argv)
+{
+    GOptionContext *context;
+    GError *error = NULL;
+    gchar *contents;
+    gsize length;
+    E803TraceHeader header;
+    const E803TraceRecord *records;
+    guint count,first;
+
+    context = g_option_context_new ("TRACEFILE - decode an Elliott 803 instruction trace");
+    g_option_context_add_main_entries (context, entries, NULL);
+    if (!g_option_context_parse (context, &argc, &argv, &error))
+    {
+      g_print ("option parsing failed: %s\n", error->message);
+      exit (1);
+    }
+    if(argc != 2)
+    {
+	g_print("usage: %s [--last N] TRACEFILE\n",argv[0]);
+	exit(1);
+    }
+
+    if(!g_file_get_contents(argv[1],&contents,&length,&error))
+    {
+	g_print("Failed to read trace file %s (%s)\n",argv[1],error->message);
+	exit(1);
+    }
+
+    if(length < sizeof(header))
+    {
+	g_print("%s is too short to be a trace\n",argv[1]);
+	exit(1);
+    }
+    memcpy(&header,contents,sizeof(header));
+    if((memcmp(header.magic,TRACE_MAGIC,sizeof(header.magic)) != 0) ||
+       (header.recordSize != sizeof(E803TraceRecord)))
+    {
+	g_print("%s is not a trace from this version of the emulator\n",argv[1]);
+	exit(1);
+    }
+
+    count = header.recordCount;
+    if(((length - sizeof(header)) / sizeof(E803TraceRecord)) < count)
+    {
+	count = (guint) ((length - sizeof(header)) / sizeof(E803TraceRecord));
+	g_warning("%s is truncated, only %u instructions\n",argv[1],count);
+    }
+
+    first = 0;
+    if((lastCount > 0) && ((guint) lastCount < count))
+    {
+	first = count - (guint) lastCount;
+    }
+
+    records = (const E803TraceRecord *) (contents + sizeof(header));
+    printf("       Seq    Word time   SCR    Instr    ACC                               AR\n");
+    for(guint n = first; n < count; n++)
+    {
+	printRecord(&records[n]);
+    }
+
+    g_free(contents);
+    return EXIT_SUCCESS;
+}
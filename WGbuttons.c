@@ -17,11 +17,11 @@
 #include "Common.h"
 #include "Keyboard.h"
 #include "wg-definitions.h"
+#include "Sound.h"
 
 #define SOUNDS 1
 
 static gboolean startSndEffect(struct sndEffect *effect);
-GSList *runingSndEffects = NULL;
 
 enum {WG_PRESS=1,WG_RELEASE,RR_PRESS,RR_RELEASE};
 enum {BUTTON_UP=0,BUTTON_DOWN,BUTTON_RELEASED};
@@ -268,19 +268,18 @@ int doFREE_PRESS(__attribute__((unused))int state,
 		 void *data,guint time)
 {
     WGButton *buttonp;
-    ButtonEvent *be;
+    ButtonEvent be;
     
     buttonp = (WGButton *) data;
     buttonp->state = BUTTON_DOWN;
     rowValues[buttonp->rowId] |= buttonp->value;
 
-    be = (ButtonEvent *) malloc(sizeof(ButtonEvent));
-    be->press = TRUE;
-    be->rowId = buttonp->rowId;
-    be->value = buttonp->value;
-    be->time  = time;
+    be.press = TRUE;
+    be.rowId = buttonp->rowId;
+    be.value = buttonp->value;
+    be.time  = time;
 
-    g_async_queue_push(ButtonEventQueue,(gpointer) be);
+    RingPush(ButtonEventRing,&be);
     
 #if SOUNDS    
     startSndEffect(buttonp->sndEffects[4]);
@@ -294,19 +293,18 @@ int doFREE_RELEASE(__attribute__((unused))int state,
 		   void *data,guint time)
 {
     WGButton *buttonp;
-    ButtonEvent *be;
+    ButtonEvent be;
     
     buttonp = (WGButton *) data;
     buttonp->state = BUTTON_UP;
     rowValues[buttonp->rowId] &= ~buttonp->value;
 
-    be = (ButtonEvent *) malloc(sizeof(ButtonEvent));
-    be->press = FALSE;
-    be->rowId = buttonp->rowId;
-    be->value = buttonp->value;
-    be->time  = time;
+    be.press = FALSE;
+    be.rowId = buttonp->rowId;
+    be.value = buttonp->value;
+    be.time  = time;
 	
-    g_async_queue_push (ButtonEventQueue,(gpointer) be);
+    RingPush(ButtonEventRing,&be);
     
 #if SOUNDS    
     startSndEffect(buttonp->sndEffects[5]);
@@ -333,20 +331,19 @@ int doWG_PRESS(__attribute__((unused))int state,
 	       guint time)
 {
     WGButton *button;
-    ButtonEvent *be;
+    ButtonEvent be;
 
     button = (WGButton *) data;
 
     button->state = BUTTON_DOWN;
     rowValues[button->rowId] |= button->value;
 
-    be = (ButtonEvent *) malloc(sizeof(ButtonEvent));
-    be->press = TRUE;
-    be->rowId = button->rowId;
-    be->value = button->value;
-    be->time  = time;
+    be.press = TRUE;
+    be.rowId = button->rowId;
+    be.value = button->value;
+    be.time  = time;
 
-    g_async_queue_push  (ButtonEventQueue,(gpointer) be);
+    RingPush(ButtonEventRing,&be);
     
 #if SOUNDS    
     if(state == 0)
@@ -363,7 +360,7 @@ int doWG_RELEASE(__attribute__((unused))int state,
 		 __attribute__((unused))guint time)
 {
     WGButton *button;
-    ButtonEvent *be;
+    ButtonEvent be;
     
     button = (WGButton *) data;
 
@@ -372,13 +369,12 @@ int doWG_RELEASE(__attribute__((unused))int state,
     button->state = BUTTON_UP;
     rowValues[button->rowId] &= ~button->value;
 
-    be = (ButtonEvent *) malloc(sizeof(ButtonEvent));
-    be->press = FALSE;
-    be->rowId = button->rowId;
-    be->value = button->value;
-    be->time  = time;
+    be.press = FALSE;
+    be.rowId = button->rowId;
+    be.value = button->value;
+    be.time  = time;
 
-    g_async_queue_push  (ButtonEventQueue,(gpointer) be);
+    RingPush(ButtonEventRing,&be);
 
 #if SOUNDS    
     if(state == 4)
@@ -406,19 +402,18 @@ int doRADIO_PRESS(__attribute__((unused))int state,
 {
     int rowId;
     WGButton *buttonp,*RRbuttonp;
-    ButtonEvent *be;
+    ButtonEvent be;
 
     RRbuttonp = (WGButton *) data;
     if(RRbuttonp->state == BUTTON_DOWN) return -1;
     RRbuttonp->state = BUTTON_DOWN;
 
-    be = (ButtonEvent *) malloc(sizeof(ButtonEvent));
-    be->press = TRUE;
-    be->rowId = RRbuttonp->rowId;
-    be->value = RRbuttonp->value;
-    be->time  = time;
+    be.press = TRUE;
+    be.rowId = RRbuttonp->rowId;
+    be.value = RRbuttonp->value;
+    be.time  = time;
 
-    g_async_queue_push (ButtonEventQueue,(gpointer) be);
+    RingPush(ButtonEventRing,&be);
     
     rowId = RRbuttonp->rowId;
     rowValues[rowId] |= RRbuttonp->value;
@@ -431,13 +426,12 @@ int doRADIO_PRESS(__attribute__((unused))int state,
 	    buttonp->state = BUTTON_UP;
 	    rowValues[buttonp->rowId] &= ~buttonp->value;
 		
-	    be = (ButtonEvent *) malloc(sizeof(ButtonEvent));
-	    be->press = FALSE;
-	    be->rowId = buttonp->rowId;
-	    be->value = buttonp->value;
-	    be->time  = time;
+	    be.press = FALSE;
+	    be.rowId = buttonp->rowId;
+	    be.value = buttonp->value;
+	    be.time  = time;
 
-	    g_async_queue_push (ButtonEventQueue,(gpointer) be);
+	    RingPush(ButtonEventRing,&be);
 	}
 	buttonp++;
     }
@@ -563,7 +557,6 @@ void OperateBarPressed(gboolean pressed,guint time)
 }
 
 
-extern GMutex SoundEffectsQueueMutex;
 GString *SoundEffectsDirectory = NULL;
 
 static void loadSndEffects(WGButton *button)
@@ -586,20 +579,9 @@ static void loadSndEffects(WGButton *button)
 
 static gboolean startSndEffect(struct sndEffect *effect)
 {
-    struct sndEffect *playing;
-    
     if(effect == NULL) return FALSE;
 
-    playing = (struct sndEffect *) malloc(sizeof(struct sndEffect));
-
-    *playing = *effect;
-
-    g_mutex_lock(&SoundEffectsQueueMutex);
-
-    runingSndEffects = g_slist_prepend(runingSndEffects,playing);
-
-    g_mutex_unlock(&SoundEffectsQueueMutex);
-    
+    playSndEffect(effect);
     return TRUE;
 }
 
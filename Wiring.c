@@ -8,21 +8,27 @@
 #define G_LOG_USE_STRUCTURED
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
 #include <glib.h>
 #include "Wiring.h"
 
+// In the same order as enum WiringEvent
 const char *WiringEventDescriptions[] = {
     "No Event",
     "Mains turned on at the contactor",
     "Mains turned off at the contactor",
     "Mains on to the Charger",
     "Mains off to the Charger",
-    "Computer On pressed",
-    "Computer Off pressed",
     "Battery On pressed",
     "Battery Off pressed",
+    "Computer On pressed",
+    "Computer Off pressed",
     "Power supplies On",
     "Power supplies Off",
+    "PTS 24 volts on",
     "Wordgen F1 buttons",
     "Wordgen N1 buttons",
     "Wordgen F2 buttons",
@@ -34,16 +40,39 @@ const char *WiringEventDescriptions[] = {
     "Wordgen Single Step",
     "Wordgen Operate Bar",
     "100Hz timer signal",
+    "Update displays",
+    "Volume control",
+    "F71",
+    "F72",
+    "F74",
+    "F75",
+    "F76",
+    "F77",
+    "Ready",
+    "Act",
+    "Tape reader lines",
+    "Character lines",
     NULL
 };
 
-static GSList *Interconnections[LAST_WIRING_EVENT] = { NULL };
+Wire Wires[LAST_WIRING_EVENT];
+int WiringSlowly = 0;
+
+static WiringMonitor Monitor = NULL;
+static int Counting = 0;
+static uint64_t Fires[LAST_WIRING_EVENT];
+static uint64_t Nanoseconds[LAST_WIRING_EVENT];
 
 void connectWires(enum WiringEvent event,Connectors handler)
 {
+    Wire *wire;
+
     if((event >= 1) && (event < LAST_WIRING_EVENT))
     {
-	Interconnections[event] = g_slist_append(Interconnections[event],(gpointer)handler);
+	wire = &Wires[event];
+	if(wire->count == WIRING_CONNECTIONS)
+	    g_error("%s too many connections to event %d\n",__FUNCTION__,event);
+	wire->handlers[wire->count++] = handler;
     }
     else
     {
@@ -51,20 +80,68 @@ void connectWires(enum WiringEvent event,Connectors handler)
     }
 }
 
-// Call registered handlers when a wire state is set.
-void wiring(enum WiringEvent event,unsigned int values)
+// Only one at a time, NULL to remove it.
+void monitorWiring(WiringMonitor monitor)
+{
+    Monitor = monitor;
+    WiringSlowly = (Monitor != NULL) || Counting;
+}
+
+// The counts start again each time it is turned on.
+void wiringCounting(int on)
 {
+    if(on && !Counting)
+    {
+	memset(Fires,0,sizeof(Fires));
+	memset(Nanoseconds,0,sizeof(Nanoseconds));
+    }
+    Counting = on;
+    WiringSlowly = (Monitor != NULL) || Counting;
+}
 
-    GSList *handler;
-    Connectors connectors;
-    if((event >= 1) && (event < LAST_WIRING_EVENT))
+static uint64_t nanoseconds(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC,&now);
+    return ((uint64_t) now.tv_sec * 1000000000ULL) + (uint64_t) now.tv_nsec;
+}
+
+// wiring() when there is a monitor or the wires are being counted.
+void wiringSlowly(enum WiringEvent event,unsigned int values)
+{
+    const Wire *wire = &Wires[event];
+    uint64_t started = 0;
+
+    if(Monitor != NULL) (Monitor)(event,values);
+
+    if(Counting) started = nanoseconds();
+    for(int n = 0; n < wire->count; n++)
+    {
+	(wire->handlers[n])(values);
+    }
+    if(Counting)
+    {
+	Fires[event] += 1;
+	Nanoseconds[event] += nanoseconds() - started;
+    }
+}
+
+// A table of the wires that have been set since counting started.
+void wiringStatistics(GString *text)
+{
+    gboolean any = FALSE;
+
+    for(int event = 1; event < LAST_WIRING_EVENT; event++)
     {
-	handler = Interconnections[event];
-	while(handler != NULL)
+	if(Fires[event] == 0) continue;
+	if(!any)
 	{
-	    connectors = (Connectors ) handler->data;
-	    (connectors)(values);
-	    handler = g_slist_next(handler);
+	    g_string_append(text,"\nWire                               Handlers         Fired   Handler ns  ns each\n");
+	    any = TRUE;
 	}
+	g_string_append_printf(text,"%-33s  %8d  %12" PRIu64 " %12" PRIu64 " %8.1f\n",
+			       WiringEventDescriptions[event],Wires[event].count,Fires[event],Nanoseconds[event],
+			       (double) Nanoseconds[event] / (double) Fires[event]);
     }
 }
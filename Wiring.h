@@ -5,6 +5,10 @@
     See LICENCE file. 
 */
 
+#pragma once
+
+#include <glib.h>
+
 enum WiringEvent {MAINS_SUPPLY_ON=1,MAINS_SUPPLY_OFF,CHARGER_CONNECTED,CHARGER_DISCONNECTED,
 		  BATTERY_ON_PRESSED,BATTERY_OFF_PRESSED,COMPUTER_ON_PRESSED,COMPUTER_OFF_PRESSED,
 		  SUPPLIES_ON,SUPPLIES_OFF,PTS24VOLTSON,
@@ -17,10 +21,50 @@ enum WiringEvent {MAINS_SUPPLY_ON=1,MAINS_SUPPLY_OFF,CHARGER_CONNECTED,CHARGER_D
 
 typedef void (*Connectors)(unsigned int);
 
-// Set a wire to a value
-void wiring(enum WiringEvent event,unsigned int values);
-
 // Register a connection (handler) to a type of wire. 
 void connectWires(enum WiringEvent event,Connectors handler);
 
+// Sees every wire set before the handlers do.  Used to record them.
+typedef void (*WiringMonitor)(enum WiringEvent event,unsigned int values);
+void monitorWiring(WiringMonitor monitor);
+
+/* Count how often each wire is set and how long its handlers take.
+   Turned on and off with the execution profile, on the thread that
+   sets the wires, and reported in it. */
+void wiringCounting(int on);
+void wiringStatistics(GString *text);
+
+/* The handlers for each wire are kept in a flat array so that setting
+   a wire is a short loop of calls.  Monitoring and counting go the
+   slow way round. */
+#define WIRING_CONNECTIONS 8
+
+typedef struct _wire
+{
+    int count;
+    Connectors handlers[WIRING_CONNECTIONS];
+} Wire;
+
+extern Wire Wires[LAST_WIRING_EVENT];
+extern int WiringSlowly;
+
+void wiringSlowly(enum WiringEvent event,unsigned int values);
+
+// Set a wire to a value
+static inline void wiring(enum WiringEvent event,unsigned int values)
+{
+    const Wire *wire;
+
+    if((event < 1) || (event >= LAST_WIRING_EVENT)) return;
+    if(WiringSlowly)
+    {
+	wiringSlowly(event,values);
+	return;
+    }
 
+    wire = &Wires[event];
+    for(int n = 0; n < wire->count; n++)
+    {
+	(wire->handlers[n])(values);
+    }
+}